@@ -0,0 +1,147 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#include "appmotorcache.h"
+#include "appmotorcache_p.h"
+#include "protocol.h"
+
+#include <QApplication>
+#include <QFileInfo>
+#include <QQmlApplicationEngine>
+#include <QQmlComponent>
+#include <QQuickView>
+
+int AppMotorCachePrivate::s_argc = 0;
+std::vector<char *> AppMotorCachePrivate::s_argv;
+QApplication *AppMotorCachePrivate::s_application = NULL;
+QQmlApplicationEngine *AppMotorCachePrivate::s_engine = NULL;
+QQuickView *AppMotorCachePrivate::s_view = NULL;
+QString AppMotorCachePrivate::s_applicationFilePath;
+
+// Commonly used QML imports, each compiled separately so that
+// a missing module does not prevent loading the others
+static const char * const PRELOADED_IMPORTS[] = {
+    "import QtQuick 2.0\nItem {}\n",
+    "import QtQuick.Window 2.0\nItem {}\n",
+    "import QtQuick.Layouts 1.0\nItem {}\n",
+    "import QtQuick.Controls 2.0\nItem {}\n",
+    "import FishUI 1.0\nItem {}\n",
+};
+
+// Make the application arguments the ones of the QApplication
+static void setArguments(int argc, char **argv)
+{
+    // Within the capacity, the array stays where it is
+    std::vector<char *> &arguments = AppMotorCachePrivate::s_argv;
+    arguments.assign(argv, argv + argc);
+    arguments.push_back(NULL);
+    AppMotorCachePrivate::s_argc = argc;
+}
+
+void AppMotorCachePrivate::createApplication(int argc, char **argv)
+{
+    if (s_application)
+        return;
+
+    // The application handed the instance over is launched by a booster,
+    // which accepts no more arguments than this from the invoker
+    s_argv.reserve(qMax((size_t)INVOKER_MSG_ARGS_MAX, (size_t)argc) + 1);
+
+    setArguments(argc, argv);
+    s_application = new QApplication(s_argc, s_argv.data());
+}
+
+void AppMotorCachePrivate::createView()
+{
+    if (!s_application || s_view)
+        return;
+
+    s_engine = new QQmlApplicationEngine;
+
+    for (size_t i = 0; i < sizeof PRELOADED_IMPORTS / sizeof *PRELOADED_IMPORTS; ++i) {
+        QQmlComponent component(s_engine);
+        component.setData(PRELOADED_IMPORTS[i], QUrl());
+        delete component.create();
+    }
+
+    s_view = new QQuickView(s_engine, NULL);
+    s_view->create();
+}
+
+void AppMotorCachePrivate::clear()
+{
+    delete s_view;
+    s_view = NULL;
+
+    delete s_engine;
+    s_engine = NULL;
+
+    delete s_application;
+    s_application = NULL;
+}
+
+QApplication *AppMotorCache::application(int &argc, char **argv)
+{
+    QApplication *application = AppMotorCachePrivate::s_application;
+    if (!application)
+        return new QApplication(argc, argv);
+
+    // QCoreApplication::arguments() reads the array the application
+    // object was created with
+    setArguments(argc, argv);
+    AppMotorCachePrivate::s_application = NULL;
+
+    QFileInfo binary(QString::fromLocal8Bit(argv[0]));
+    AppMotorCachePrivate::s_applicationFilePath = binary.absoluteFilePath();
+    QCoreApplication::setApplicationName(binary.fileName());
+
+    return application;
+}
+
+QQmlApplicationEngine *AppMotorCache::engine()
+{
+    QQmlApplicationEngine *engine = AppMotorCachePrivate::s_engine;
+    if (!engine)
+        return new QQmlApplicationEngine;
+
+    AppMotorCachePrivate::s_engine = NULL;
+    return engine;
+}
+
+QQuickView *AppMotorCache::view()
+{
+    QQuickView *view = AppMotorCachePrivate::s_view;
+    if (!view)
+        return new QQuickView;
+
+    AppMotorCachePrivate::s_view = NULL;
+
+    // Engine not taken by the application goes with the view,
+    // children are deleted after the view content
+    if (AppMotorCachePrivate::s_engine) {
+        AppMotorCachePrivate::s_engine->setParent(view);
+        AppMotorCachePrivate::s_engine = NULL;
+    }
+
+    return view;
+}
+
+QString AppMotorCache::applicationFilePath()
+{
+    if (!AppMotorCachePrivate::s_applicationFilePath.isEmpty())
+        return AppMotorCachePrivate::s_applicationFilePath;
+
+    return QCoreApplication::applicationFilePath();
+}
@@ -0,0 +1,92 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifndef APPMOTORCACHE_H
+#define APPMOTORCACHE_H
+
+#include <QtGlobal>
+#include <QString>
+
+class QApplication;
+class QQmlApplicationEngine;
+class QQuickView;
+
+/*!
+ * \class AppMotorCache
+ * \brief Hands instances pre-created by the booster over to the application.
+ *
+ * When an application is started through cutefish-appmotor, the booster
+ * has already created a QApplication, a QML engine with the common
+ * imports loaded and a QQuickView using that engine. Applications that
+ * ask AppMotorCache for these objects instead of constructing their own
+ * get the warm instances. When the application is not boosted, new
+ * instances are created, so the same code works in both cases.
+ *
+ * \code
+ *     QApplication *app = AppMotorCache::application(argc, argv);
+ *     QQmlApplicationEngine *engine = AppMotorCache::engine();
+ *     engine->load(QUrl("qrc:/main.qml"));
+ *     return app->exec();
+ * \endcode
+ *
+ * The ownership of the instances is transferred to the application. The
+ * view must be deleted before the engine, and both before the application.
+ */
+class Q_DECL_EXPORT AppMotorCache
+{
+public:
+
+    /*!
+     * \brief Return the application object.
+     * Arguments and application name of a pre-created instance are
+     * changed to the ones of the application. Like the QApplication
+     * constructor, this must be called only once.
+     * \param argc Argument count given to main(), must stay valid as
+     *        long as the application object exists.
+     * \param argv Argument array given to main()
+     */
+    static QApplication *application(int &argc, char **argv);
+
+    /*!
+     * \brief Return the QML engine.
+     * Returns the pre-created engine on the first call, new engines after
+     * that. application() must have been called first.
+     */
+    static QQmlApplicationEngine *engine();
+
+    /*!
+     * \brief Return a QQuickView.
+     * Returns the pre-created view on the first call, new views after
+     * that. The pre-created view uses the pre-created engine. If the
+     * engine has not been taken with engine() before, it is handed over
+     * together with the view and deleted with it.
+     * application() must have been called first.
+     */
+    static QQuickView *view();
+
+    /*!
+     * \brief Return path of the application binary.
+     * QCoreApplication::applicationFilePath() returns the path of the
+     * booster in a boosted application.
+     */
+    static QString applicationFilePath();
+
+private:
+
+    //! Not instantiable
+    AppMotorCache();
+};
+
+#endif // APPMOTORCACHE_H
@@ -0,0 +1,69 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifndef APPMOTORCACHE_P_H
+#define APPMOTORCACHE_P_H
+
+#include <QtGlobal>
+#include <QString>
+
+#include <vector>
+
+class QApplication;
+class QQmlApplicationEngine;
+class QQuickView;
+
+/*!
+ * \class AppMotorCachePrivate
+ * \brief Booster side of AppMotorCache, not part of the application API.
+ */
+class Q_DECL_EXPORT AppMotorCachePrivate
+{
+public:
+
+    /*!
+     * \brief Create the application object that is handed over later.
+     * \param argc Argument count of the booster process.
+     * \param argv Argument array of the booster process.
+     */
+    static void createApplication(int argc, char **argv);
+
+    //! Create the QML engine and view that are handed over later,
+    //! and load common QML imports in the engine
+    static void createView();
+
+    //! Delete instances that have not been handed over, for
+    //! applications that do not use AppMotorCache
+    static void clear();
+
+    /*!
+     * \brief Arguments of the application object.
+     * QApplication keeps references to the count and the array, so the
+     * array is reserved for as many arguments as the invoker can pass
+     * (INVOKER_MSG_ARGS_MAX) and is never reallocated.
+     */
+    static int s_argc;
+    static std::vector<char *> s_argv;
+
+    //! Instances not yet handed over, NULL if none
+    static QApplication *s_application;
+    static QQmlApplicationEngine *s_engine;
+    static QQuickView *s_view;
+
+    //! Path of the boosted application binary, empty if not boosted
+    static QString s_applicationFilePath;
+};
+
+#endif // APPMOTORCACHE_P_H
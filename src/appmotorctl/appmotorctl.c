@@ -0,0 +1,190 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* Maximum length of a request line, see Daemon::readControlClient() */
+#define MAX_REQUEST 256
+
+static void usage(int status)
+{
+    printf("\n"
+           "Usage: %s [options] command [arguments]\n"
+           "\n"
+           "Query and control a running %s.\n"
+           "\n"
+           "Commands:\n"
+           "  status                 Show daemon state and the booster pool of each\n"
+           "                         booster type: spare and ready boosters, invokers\n"
+           "                         waiting, hits, misses, last warm-up time.\n"
+           "  children               Show one line per booster, template and launched\n"
+           "                         application.\n"
+           "  warmup [LEVEL]         Warm spare boosters up to LEVEL in place: none,\n"
+           "                         libraries, application, qml or full (default).\n"
+           "  pool MIN MAX           Set the number of spare boosters kept when idle\n"
+           "                         and during launch bursts.\n"
+           "  boot-mode              Enter boot mode, same as SIGUSR2.\n"
+           "  normal-mode            Leave boot mode, same as SIGUSR1.\n"
+           "  metrics                Print launch counters and latency histograms in\n"
+           "                         the Prometheus text format, e.g. for the\n"
+           "                         textfile collector of the node exporter.\n"
+           "  memory                 Show RSS, PSS and USS of the daemon, boosters and\n"
+           "                         launched applications, and the memory saved by\n"
+           "                         sharing.\n"
+           "\n"
+           "Options:\n"
+           "  -a, --application APP  Control the daemon of an application specific\n"
+           "                         booster (default: the generic daemon).\n"
+           "  -h, --help             Print this help.\n"
+           "\n",
+           PROG_NAME_APPMOTORCTL, PROG_NAME_DAEMON);
+
+    exit(status);
+}
+
+static int control_connect(const char *app_name)
+{
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (!runtime_dir || !*runtime_dir) {
+        fprintf(stderr, "%s: XDG_RUNTIME_DIR is not defined\n", PROG_NAME_APPMOTORCTL);
+        return -1;
+    }
+
+    struct sockaddr_un sun = {
+        .sun_family = AF_UNIX,
+    };
+    int length = snprintf(sun.sun_path, sizeof sun.sun_path, "%s/mapplauncherd/_%s/control",
+                          runtime_dir, app_name);
+    if (length <= 0 || (size_t)length >= sizeof sun.sun_path || strchr(app_name, '/')) {
+        fprintf(stderr, "%s: invalid application: %s\n", PROG_NAME_APPMOTORCTL, app_name);
+        return -1;
+    }
+
+    int fd = socket(PF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *)&sun, sizeof sun) == -1) {
+        fprintf(stderr, "%s: can't connect to %s: %m\n", PROG_NAME_APPMOTORCTL, sun.sun_path);
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option longopts[] = {
+        {"application", required_argument, NULL, 'a'},
+        {"help",        no_argument,       NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    const char *app_name = "default";
+    int opt;
+    while ((opt = getopt_long(argc, argv, "+a:h", longopts, NULL)) != -1) {
+        switch (opt) {
+        case 'a':
+            app_name = optarg;
+            break;
+        case 'h':
+            usage(EXIT_SUCCESS);
+            break;
+        default:
+            usage(EXIT_FAILURE);
+        }
+    }
+
+    if (optind >= argc)
+        usage(EXIT_FAILURE);
+
+    // Request is the command line joined by spaces
+    char request[MAX_REQUEST + 1] = "";
+    size_t length = 0;
+    for (int i = optind; i < argc; ++i) {
+        int n = snprintf(request + length, sizeof request - length, "%s%s",
+                         argv[i], i + 1 < argc ? " " : "\n");
+        if (n < 0 || (size_t)n >= sizeof request - length) {
+            fprintf(stderr, "%s: command too long\n", PROG_NAME_APPMOTORCTL);
+            return EXIT_FAILURE;
+        }
+        length += n;
+    }
+
+    int fd = control_connect(app_name);
+    if (fd == -1)
+        return EXIT_FAILURE;
+
+    if (send(fd, request, length, MSG_NOSIGNAL) != (ssize_t)length) {
+        fprintf(stderr, "%s: sending the command failed: %m\n", PROG_NAME_APPMOTORCTL);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    // Response is "ok" or "error: <reason>" followed by data lines,
+    // the daemon closes the connection after it
+    char response[4096];
+    size_t received = 0;
+    bool first_line = true;
+    bool failed = false;
+    for (;;) {
+        ssize_t rc = recv(fd, response + received, sizeof response - received, 0);
+        if (rc == -1 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            break;
+        received += rc;
+
+        char *line = response;
+        char *end;
+        while ((end = memchr(line, '\n', received - (line - response)))) {
+            *end = '\0';
+            if (first_line) {
+                failed = strcmp(line, "ok") != 0;
+                if (failed)
+                    fprintf(stderr, "%s: %s\n", PROG_NAME_APPMOTORCTL, line);
+                first_line = false;
+            } else {
+                printf("%s\n", line);
+            }
+            line = end + 1;
+        }
+
+        // Keep an incomplete line, flush one that does not fit
+        received -= line - response;
+        memmove(response, line, received);
+        if (received == sizeof response) {
+            fwrite(response, 1, received, stdout);
+            received = 0;
+        }
+    }
+    close(fd);
+
+    if (first_line) {
+        fprintf(stderr, "%s: no response\n", PROG_NAME_APPMOTORCTL);
+        return EXIT_FAILURE;
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
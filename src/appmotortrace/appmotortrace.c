@@ -0,0 +1,448 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <limits.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/* Maximum length of a decoded message */
+#define MAX_MESSAGE 4096
+
+struct trace_file {
+    const char *path;
+    const struct trace_header *header;
+    size_t size;
+};
+
+struct entry {
+    const struct trace_file *file;
+    struct trace_record record;
+};
+
+static struct trace_file *files = NULL;
+static size_t file_count = 0;
+
+static struct entry *entries = NULL;
+static size_t entry_count = 0;
+static size_t entry_capacity = 0;
+
+static void usage(int status)
+{
+    printf("\n"
+           "Usage: %s [options] [file|directory]...\n"
+           "\n"
+           "Decode the binary traces written by %s --trace. Without\n"
+           "arguments, all traces in $XDG_RUNTIME_DIR/mapplauncherd/trace are\n"
+           "decoded. Messages of all processes are printed ordered by time, one\n"
+           "per line: seconds since boot, microseconds since the previous\n"
+           "message, pid/tid, level and the message.\n"
+           "\n"
+           "Options:\n"
+           "  -p, --pid PID          Print only messages of process PID.\n"
+           "  -h, --help             Print this help.\n"
+           "\n",
+           PROG_NAME_APPMOTORTRACE, PROG_NAME_DAEMON);
+
+    exit(status);
+}
+
+static const char *level_name(int level)
+{
+    switch (level) {
+    case LOG_CRIT:    return "died";
+    case LOG_ERR:     return "error";
+    case LOG_WARNING: return "warning";
+    case LOG_NOTICE:  return "notice";
+    case LOG_INFO:    return "info";
+    default:          return "debug";
+    }
+}
+
+static bool valid_header(const struct trace_header *header, size_t size)
+{
+    if (size < TRACE_HEADER_SIZE || memcmp(header->magic, TRACE_MAGIC, sizeof header->magic))
+        return false;
+    if (header->version != TRACE_VERSION || header->record_size != sizeof(struct trace_record))
+        return false;
+    if (!header->record_count || (header->record_count & (header->record_count - 1)))
+        return false;
+
+    size_t strings_end = TRACE_HEADER_SIZE + (size_t)header->format_count * sizeof(struct trace_format)
+            + header->string_size;
+    return header->records_offset >= strings_end
+            && header->records_offset + (size_t)header->record_count * header->record_size <= size;
+}
+
+static void open_file(const char *path, pid_t pid)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "%s: can't open %s: %m\n", PROG_NAME_APPMOTORTRACE, path);
+        return;
+    }
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= TRACE_HEADER_SIZE)
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED || !valid_header(map, (size_t)st.st_size)) {
+        fprintf(stderr, "%s: %s is not a trace\n", PROG_NAME_APPMOTORTRACE, path);
+        if (map != MAP_FAILED)
+            munmap(map, (size_t)st.st_size);
+        return;
+    }
+
+    const struct trace_header *header = map;
+    if (pid && header->pid != pid) {
+        munmap(map, (size_t)st.st_size);
+        return;
+    }
+
+    files = realloc(files, (file_count + 1) * sizeof *files);
+    if (!files)
+        abort();
+    files[file_count].path = strdup(path);
+    files[file_count].header = header;
+    files[file_count].size = (size_t)st.st_size;
+    ++file_count;
+}
+
+static void open_directory(const char *path, pid_t pid)
+{
+    DIR *dir = opendir(path);
+    if (!dir) {
+        fprintf(stderr, "%s: can't open %s: %m\n", PROG_NAME_APPMOTORTRACE, path);
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] == '.')
+            continue;
+        char file[PATH_MAX];
+        snprintf(file, sizeof file, "%s/%s", path, entry->d_name);
+        open_file(file, pid);
+    }
+    closedir(dir);
+}
+
+static void open_path(const char *path, pid_t pid)
+{
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode))
+        open_directory(path, pid);
+    else
+        open_file(path, pid);
+}
+
+/* Copy the records that have been completely written */
+static void read_records(const struct trace_file *file)
+{
+    const struct trace_header *header = file->header;
+    const char *records = (const char *)header + header->records_offset;
+
+    for (uint32_t slot = 0; slot < header->record_count; ++slot) {
+        const struct trace_record *record = (const struct trace_record *)(records + (size_t)slot * header->record_size);
+        uint64_t sequence = __atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE);
+        if (!sequence || ((sequence - 1) & (header->record_count - 1)) != slot)
+            continue;
+
+        if (entry_count == entry_capacity) {
+            entry_capacity = entry_capacity ? entry_capacity * 2 : 1024;
+            entries = realloc(entries, entry_capacity * sizeof *entries);
+            if (!entries)
+                abort();
+        }
+
+        struct entry *entry = &entries[entry_count];
+        memcpy(&entry->record, record, sizeof entry->record);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        // Skip records that were overwritten while being copied
+        if (__atomic_load_n(&record->sequence, __ATOMIC_RELAXED) != sequence)
+            continue;
+        if (entry->record.size > sizeof entry->record.data)
+            continue;
+
+        entry->file = file;
+        ++entry_count;
+    }
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    const struct entry *x = a;
+    const struct entry *y = b;
+    if (x->record.time != y->record.time)
+        return x->record.time < y->record.time ? -1 : 1;
+    if (x->file != y->file)
+        return x->file < y->file ? -1 : 1;
+    return x->record.sequence < y->record.sequence ? -1 : x->record.sequence > y->record.sequence;
+}
+
+static void append(char *message, size_t *length, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static void append(char *message, size_t *length, const char *format, ...)
+{
+    if (*length >= MAX_MESSAGE - 1)
+        return;
+
+    va_list arg;
+    va_start(arg, format);
+    int n = vsnprintf(message + *length, MAX_MESSAGE - *length, format, arg);
+    va_end(arg);
+    if (n > 0)
+        *length = *length + (size_t)n < MAX_MESSAGE ? *length + (size_t)n : MAX_MESSAGE - 1;
+}
+
+static void append_text(char *message, size_t *length, const char *text, size_t size)
+{
+    append(message, length, "%.*s", (int)size, text);
+}
+
+static bool take(const struct trace_record *record, size_t *offset, void *value, size_t size)
+{
+    if (*offset + size > record->size)
+        return false;
+    memcpy(value, record->data + *offset, size);
+    *offset += size;
+    return true;
+}
+
+/* Rebuild the conversion specification with '*' replaced by the stored
+ * values and the length modifier replaced by the given one */
+static void conversion_spec(char *spec, size_t size, const struct trace_conversion *conversion,
+                            const int64_t *stars, const char *length, char type)
+{
+    size_t used = 0;
+    int star = 0;
+    for (const char *p = conversion->start; p < conversion->end - 1 && used < size - 1; ++p) {
+        if (*p == '*') {
+            int n = snprintf(spec + used, size - used, "%d", (int)stars[star++]);
+            used = n > 0 && used + (size_t)n < size ? used + (size_t)n : size - 1;
+        } else if (!strchr("hlqjzZtL", *p)) {
+            spec[used++] = *p;
+        }
+    }
+    snprintf(spec + used, size - used, "%s%c", length, type);
+}
+
+/* Format a record with its format string the same way printf() would */
+static void decode_message(const struct entry *entry, char *message)
+{
+    const struct trace_record *record = &entry->record;
+    const struct trace_header *header = entry->file->header;
+    size_t length = 0;
+    message[0] = 0;
+
+    if (record->format == TRACE_FORMAT_TEXT) {
+        append_text(message, &length, (const char *)record->data, record->size);
+        return;
+    }
+
+    const struct trace_format *formats = (const struct trace_format *)((const char *)header + TRACE_HEADER_SIZE);
+    const char *strings = (const char *)(formats + header->format_count);
+    const struct trace_format *format = record->format < header->format_count ? &formats[record->format] : NULL;
+    if (!format || !format->length || format->length == TRACE_FORMAT_NONE ||
+        format->offset + (size_t)format->length >= header->string_size) {
+        append(message, &length, "<unknown format %u>", record->format);
+        return;
+    }
+
+    const char *text = strings + format->offset;
+    const char *text_end = text + format->length;
+    size_t offset = 0;
+    struct trace_conversion conversion;
+    const char *next = text;
+    while ((next = trace_next_conversion(next, &conversion)) && next <= text_end) {
+        // Text before the conversion, "%%" as "%"
+        for (const char *p = text; p < conversion.start; ++p) {
+            append_text(message, &length, p, 1);
+            if (p[0] == '%' && p[1] == '%')
+                ++p;
+        }
+        text = conversion.end;
+
+        int64_t stars[2];
+        int star_count = conversion.star_width + conversion.star_precision;
+        bool complete = true;
+        for (int i = 0; i < star_count && complete; ++i)
+            complete = take(record, &offset, &stars[i], sizeof stars[i]);
+
+        char spec[64];
+        uint64_t value = 0;
+        double real = 0;
+        switch (conversion.conversion) {
+        case 'd':
+        case 'i':
+            if ((complete = complete && take(record, &offset, &value, sizeof value))) {
+                conversion_spec(spec, sizeof spec, &conversion, stars, "ll", conversion.conversion);
+                append(message, &length, spec, (long long)value);
+            }
+            break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            if ((complete = complete && take(record, &offset, &value, sizeof value))) {
+                conversion_spec(spec, sizeof spec, &conversion, stars, "ll", conversion.conversion);
+                append(message, &length, spec, (unsigned long long)value);
+            }
+            break;
+        case 'c':
+            if ((complete = complete && take(record, &offset, &value, sizeof value))) {
+                conversion_spec(spec, sizeof spec, &conversion, stars, "", 'c');
+                append(message, &length, spec, (int)value);
+            }
+            break;
+        case 'p':
+            if ((complete = complete && take(record, &offset, &value, sizeof value))) {
+                conversion_spec(spec, sizeof spec, &conversion, stars, "", 'p');
+                append(message, &length, spec, (void *)(uintptr_t)value);
+            }
+            break;
+        case 's': {
+            uint16_t size = 0;
+            if ((complete = complete && take(record, &offset, &size, sizeof size))) {
+                char string[TRACE_RECORD_SIZE];
+                if ((complete = size < sizeof string && take(record, &offset, string, size))) {
+                    string[size] = 0;
+                    conversion_spec(spec, sizeof spec, &conversion, stars, "", 's');
+                    append(message, &length, spec, string);
+                }
+            }
+            break;
+        }
+        case 'm':
+            conversion_spec(spec, sizeof spec, &conversion, stars, "", 's');
+            append(message, &length, spec, strerror((int)record->error));
+            break;
+        case 0:
+            complete = false;
+            break;
+        default:
+            if ((complete = complete && take(record, &offset, &real, sizeof real))) {
+                conversion_spec(spec, sizeof spec, &conversion, stars, "", conversion.conversion);
+                append(message, &length, spec, real);
+            }
+            break;
+        }
+
+        if (!complete) {
+            append(message, &length, "...");
+            return;
+        }
+    }
+
+    for (const char *p = text; p < text_end; ++p) {
+        append_text(message, &length, p, 1);
+        if (p[0] == '%' && p[1] == '%')
+            ++p;
+    }
+    if (record->flags & TRACE_TRUNCATED)
+        append(message, &length, "...");
+}
+
+/* Remove line breaks so that every message takes one line */
+static void strip(char *message)
+{
+    size_t length = strlen(message);
+    while (length > 0 && (message[length - 1] == '\n' || message[length - 1] == ' '))
+        message[--length] = 0;
+    for (char *p = message; *p; ++p) {
+        if (*p == '\n')
+            *p = ' ';
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option longopts[] = {
+        {"pid",  required_argument, NULL, 'p'},
+        {"help", no_argument,       NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    pid_t pid = 0;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "p:h", longopts, NULL)) != -1) {
+        switch (opt) {
+        case 'p':
+            pid = atoi(optarg);
+            if (pid <= 0)
+                usage(EXIT_FAILURE);
+            break;
+        case 'h':
+            usage(EXIT_SUCCESS);
+            break;
+        default:
+            usage(EXIT_FAILURE);
+        }
+    }
+
+    if (optind < argc) {
+        for (int i = optind; i < argc; ++i)
+            open_path(argv[i], pid);
+    } else {
+        const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+        if (!runtime_dir || !*runtime_dir) {
+            fprintf(stderr, "%s: XDG_RUNTIME_DIR is not defined\n", PROG_NAME_APPMOTORTRACE);
+            return EXIT_FAILURE;
+        }
+        char path[PATH_MAX];
+        snprintf(path, sizeof path, "%s/mapplauncherd/trace", runtime_dir);
+        open_directory(path, pid);
+    }
+
+    if (!file_count)
+        return EXIT_FAILURE;
+
+    for (size_t i = 0; i < file_count; ++i)
+        read_records(&files[i]);
+    qsort(entries, entry_count, sizeof *entries, compare_entries);
+
+    char message[MAX_MESSAGE];
+    uint64_t previous = entry_count ? entries[0].record.time : 0;
+    for (size_t i = 0; i < entry_count; ++i) {
+        const struct entry *entry = &entries[i];
+        decode_message(entry, message);
+        strip(message);
+        printf("%llu.%06llu +%-7llu %d/%u %s: %s\n",
+               (unsigned long long)(entry->record.time / 1000000000u),
+               (unsigned long long)(entry->record.time % 1000000000u / 1000u),
+               (unsigned long long)((entry->record.time - previous) / 1000u),
+               entry->file->header->pid, entry->record.tid,
+               level_name(entry->record.level), message);
+        previous = entry->record.time;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,843 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+
+/*
+ * Measures how long it takes from starting an application to its main(),
+ * launched through cutefish-invoker and a locally started booster daemon
+ * and launched directly with exec(). The test applications report the
+ * time main() was entered, see benchapp.h. Results are written as JSON.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <link.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+using std::string;
+using std::vector;
+
+namespace
+{
+
+struct Options
+{
+    Options() :
+        iterations(50),
+        warmup(3),
+        interval(1000),
+        storm(0),
+        hold(0),
+        rewrite(false),
+        daemon("cutefish-appmotor"),
+        invoker("cutefish-invoker"),
+        type("cutefish")
+    {}
+
+    int iterations;
+    int warmup;
+    int interval;
+    int storm;
+    int hold;
+    bool rewrite;
+    string daemon;
+    vector<string> daemonArgs;
+    string invoker;
+    string type;
+    string output;
+    vector<string> apps;
+};
+
+//! One launch of a test application
+struct Sample
+{
+    uint64_t toMain;    // ns
+    uint64_t toExit;    // ns
+    long     rss;       // kB, at main()
+    bool     fallback;  // the invoker exec()ed the application itself
+};
+
+//! A running launch
+struct Launch
+{
+    pid_t    pid;
+    int      fd;        // read end of the standard output
+    uint64_t started;
+    uint64_t exited;    // time the standard output was closed
+    int      status;    // wait status, set by finishLaunch()
+    string   output;
+};
+
+uint64_t now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void sleepMs(int ms)
+{
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+        ;
+}
+
+pid_t spawn(const vector<string> &command, int outFd, int inFd = -1)
+{
+    pid_t pid = fork();
+    if (pid != 0)
+        return pid;
+
+    dup2(outFd, STDOUT_FILENO);
+    if (outFd > STDERR_FILENO)
+        close(outFd);
+    if (inFd != -1)
+        dup2(inFd, STDIN_FILENO);
+
+    vector<char *> argv;
+    for (size_t i = 0; i < command.size(); ++i)
+        argv.push_back(const_cast<char *>(command[i].c_str()));
+    argv.push_back(NULL);
+
+    execvp(argv[0], argv.data());
+    fprintf(stderr, "appmotor-bench: can't run %s: %s\n", argv[0], strerror(errno));
+    _exit(127);
+}
+
+//! Start the command with its standard output connected to a pipe and
+//! the standard input to inFd, if given
+bool startLaunch(const vector<string> &command, Launch &launch, int inFd = -1)
+{
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1)
+        return false;
+
+    launch.started = now();
+    launch.exited = 0;
+    launch.status = -1;
+    launch.pid = spawn(command, fds[1], inFd);
+    close(fds[1]);
+    if (launch.pid == -1) {
+        close(fds[0]);
+        return false;
+    }
+
+    launch.fd = fds[0];
+    return true;
+}
+
+//! Read available output, return false once the output is closed
+bool readLaunch(Launch &launch)
+{
+    char buf[512];
+    ssize_t len = read(launch.fd, buf, sizeof buf);
+    if (len > 0) {
+        launch.output.append(buf, len);
+        return true;
+    }
+    if (len == -1 && (errno == EINTR || errno == EAGAIN))
+        return true;
+
+    launch.exited = now();
+    close(launch.fd);
+    launch.fd = -1;
+    return false;
+}
+
+//! Reap the process, return false if the application did not report main()
+bool finishLaunch(Launch &launch, Sample &sample)
+{
+    while (waitpid(launch.pid, &launch.status, 0) == -1 && errno == EINTR)
+        ;
+
+    unsigned long long mainTime = 0;
+    long rss = 0;
+    int pid = 0;
+    size_t pos = launch.output.find("appmotor-bench main ");
+    if (pos == string::npos ||
+        sscanf(launch.output.c_str() + pos, "appmotor-bench main %llu %ld %d",
+               &mainTime, &rss, &pid) != 3 ||
+        mainTime < launch.started)
+        return false;
+
+    sample.toMain = mainTime - launch.started;
+    sample.toExit = launch.exited - launch.started;
+    sample.rss = rss;
+    sample.fallback = (pid == launch.pid);
+    return true;
+}
+
+//! Run the command once
+bool launch(const vector<string> &command, Sample &sample)
+{
+    Launch launch;
+    if (!startLaunch(command, launch))
+        return false;
+
+    while (readLaunch(launch))
+        ;
+
+    return finishLaunch(launch, sample);
+}
+
+//! Nearest-rank percentile of sorted values
+uint64_t percentile(const vector<uint64_t> &sorted, int p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t rank = (sorted.size() * p + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+string jsonString(const string &str)
+{
+    string quoted = "\"";
+    for (size_t i = 0; i < str.size(); ++i) {
+        if (str[i] == '"' || str[i] == '\\')
+            quoted += '\\';
+        quoted += str[i];
+    }
+    return quoted + "\"";
+}
+
+string format(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+string format(const char *fmt, ...)
+{
+    char buf[512];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof buf, fmt, ap);
+    va_end(ap);
+    return buf;
+}
+
+string formatStats(const char *name, vector<uint64_t> values)
+{
+    std::sort(values.begin(), values.end());
+    return format("\"%s\": {\"p50\": %.1f, \"p95\": %.1f, \"p99\": %.1f, \"min\": %.1f, \"max\": %.1f}",
+                  name, percentile(values, 50) / 1e3, percentile(values, 95) / 1e3,
+                  percentile(values, 99) / 1e3, values.empty() ? 0 : values.front() / 1e3,
+                  values.empty() ? 0 : values.back() / 1e3);
+}
+
+//! Return the results of one application in one mode as a JSON object
+string formatResult(const string &app, const char *mode, const vector<Sample> &samples,
+                    int failures, const string &extra = string())
+{
+    vector<uint64_t> toMain;
+    vector<uint64_t> toExit;
+    vector<uint64_t> rss;
+    int fallbacks = 0;
+    for (size_t i = 0; i < samples.size(); ++i) {
+        toMain.push_back(samples[i].toMain);
+        toExit.push_back(samples[i].toExit);
+        rss.push_back(samples[i].rss);
+        if (samples[i].fallback)
+            fallbacks++;
+    }
+    std::sort(rss.begin(), rss.end());
+
+    string result = format("    {\"app\": %s, \"mode\": \"%s\", \"samples\": %u, \"failures\": %d",
+                           jsonString(app).c_str(), mode, (unsigned)samples.size(), failures);
+    if (strcmp(mode, "exec") != 0)
+        result += format(", \"fallbacks\": %d", fallbacks);
+    result += extra;
+    result += ",\n     " + formatStats("launch_to_main_us", toMain);
+    result += ",\n     " + formatStats("launch_to_exit_us", toExit);
+    result += format(",\n     \"rss_at_main_kb\": %llu}", (unsigned long long)percentile(rss, 50));
+    return result;
+}
+
+void usage(int status)
+{
+    printf("Usage: appmotor-bench [options] app...\n"
+           "\n"
+           "Launch each test application through cutefish-invoker and a booster daemon\n"
+           "started for the benchmark, and directly with exec(). Print launch-to-main()\n"
+           "and launch-to-exit latency percentiles in microseconds as JSON.\n"
+           "\n"
+           "Options:\n"
+           "  -n, --iterations N   Measured launches per application and mode, 0 for\n"
+           "                       none (default 50)\n"
+           "  -w, --warmup N       Launches before measuring (default 3)\n"
+           "  -i, --interval MS    Pause after each launch, lets a booster be respawned\n"
+           "                       (default 1000)\n"
+           "  -s, --storm N        Also start N invokers of each application at once and\n"
+           "                       report throughput and the share of launches the\n"
+           "                       invoker fell back to exec() for\n"
+           "  -H, --hold N         Also keep N invokers of each application waiting\n"
+           "                       for their application (--wait-term), so that the\n"
+           "                       daemon holds N invoker sockets, then end the\n"
+           "                       applications and check every exit status. Exit\n"
+           "                       latency is measured from the release\n"
+           "  -R, --rewrite        Also check that boosters preloading a copy of the\n"
+           "                       first application (--application-binary) start it\n"
+           "                       with exec() once the copy is rewritten in place\n"
+           "  -d, --daemon PATH    Booster daemon (default cutefish-appmotor)\n"
+           "  -a, --daemon-arg ARG Pass ARG to the daemon, e.g. --pool-max=8 (repeatable)\n"
+           "  -I, --invoker PATH   Invoker (default cutefish-invoker)\n"
+           "  -t, --type TYPE      Booster type (default cutefish)\n"
+           "  -o, --output FILE    Write the results to FILE instead of stdout\n"
+           "  -h, --help           Print this help\n");
+    exit(status);
+}
+
+Options parseOptions(int argc, char **argv)
+{
+    struct option longopts[] = {
+        {"iterations", required_argument, NULL, 'n'},
+        {"warmup",     required_argument, NULL, 'w'},
+        {"interval",   required_argument, NULL, 'i'},
+        {"storm",      required_argument, NULL, 's'},
+        {"hold",       required_argument, NULL, 'H'},
+        {"rewrite",    no_argument,       NULL, 'R'},
+        {"daemon",     required_argument, NULL, 'd'},
+        {"daemon-arg", required_argument, NULL, 'a'},
+        {"invoker",    required_argument, NULL, 'I'},
+        {"type",       required_argument, NULL, 't'},
+        {"output",     required_argument, NULL, 'o'},
+        {"help",       no_argument,       NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    Options options;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:w:i:s:H:Rd:a:I:t:o:h", longopts, NULL)) != -1) {
+        switch (opt) {
+        case 'n': options.iterations = atoi(optarg); break;
+        case 'w': options.warmup = atoi(optarg); break;
+        case 'i': options.interval = atoi(optarg); break;
+        case 's': options.storm = atoi(optarg); break;
+        case 'H': options.hold = atoi(optarg); break;
+        case 'R': options.rewrite = true; break;
+        case 'd': options.daemon = optarg; break;
+        case 'a': options.daemonArgs.push_back(optarg); break;
+        case 'I': options.invoker = optarg; break;
+        case 't': options.type = optarg; break;
+        case 'o': options.output = optarg; break;
+        case 'h': usage(EXIT_SUCCESS); break;
+        default: usage(EXIT_FAILURE);
+        }
+    }
+
+    for (int i = optind; i < argc; ++i)
+        options.apps.push_back(argv[i]);
+
+    if (options.apps.empty() || options.iterations < 0 || options.warmup < 0 ||
+        options.interval < 0 || options.storm < 0 || options.hold < 0 ||
+        (!options.iterations && !options.storm && !options.hold && !options.rewrite))
+        usage(EXIT_FAILURE);
+
+    return options;
+}
+
+//! Run the warm-up and measured launches of one application in one mode
+vector<Sample> measure(const Options &options, const vector<string> &command, int &failures)
+{
+    vector<Sample> samples;
+    failures = 0;
+
+    for (int i = 0; i < options.warmup + options.iterations; ++i) {
+        Sample sample;
+        bool ok = launch(command, sample);
+        if (i >= options.warmup) {
+            if (ok)
+                samples.push_back(sample);
+            else
+                failures++;
+        }
+        sleepMs(options.interval);
+    }
+
+    return samples;
+}
+
+//! Start options.storm launches at once and wait for all of them
+vector<Sample> storm(const Options &options, const vector<string> &command,
+                     int &failures, uint64_t &duration)
+{
+    vector<Sample> samples;
+    vector<Launch> launches(options.storm);
+    vector<struct pollfd> fds;
+    failures = 0;
+
+    uint64_t started = now();
+    for (size_t i = 0; i < launches.size(); ++i) {
+        if (!startLaunch(command, launches[i])) {
+            launches[i].pid = -1;
+            failures++;
+            continue;
+        }
+        struct pollfd pfd = { launches[i].fd, POLLIN, 0 };
+        fds.push_back(pfd);
+    }
+
+    // Collect the output of all launches until every one has exited
+    size_t running = fds.size();
+    while (running > 0) {
+        if (poll(fds.data(), fds.size(), -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (size_t i = 0, j = 0; i < launches.size(); ++i) {
+            if (launches[i].pid == -1)
+                continue;
+            struct pollfd &pfd = fds[j++];
+            if (pfd.fd == -1 || !pfd.revents)
+                continue;
+            if (!readLaunch(launches[i])) {
+                pfd.fd = -1;
+                running--;
+            }
+        }
+    }
+    duration = now() - started;
+
+    for (size_t i = 0; i < launches.size(); ++i) {
+        if (launches[i].pid == -1)
+            continue;
+
+        if (launches[i].fd != -1) {
+            close(launches[i].fd);
+            launches[i].exited = now();
+        }
+
+        Sample sample;
+        if (finishLaunch(launches[i], sample))
+            samples.push_back(sample);
+        else
+            failures++;
+    }
+
+    return samples;
+}
+
+//! Return the number of open descriptors of the process and the highest one
+int countFds(pid_t pid, int &maxFd)
+{
+    int count = 0;
+    maxFd = -1;
+
+    DIR *dir = opendir(format("/proc/%d/fd", (int)pid).c_str());
+    if (!dir)
+        return 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] == '.')
+            continue;
+        count++;
+        maxFd = std::max(maxFd, atoi(entry->d_name));
+    }
+    closedir(dir);
+    return count;
+}
+
+//! Keep options.hold launches running at once, then end them and check
+//! that every invoker exits with the status of its application
+vector<Sample> hold(const Options &options, const vector<string> &command, pid_t daemonPid,
+                    int &failures, int &daemonFds, int &daemonMaxFd)
+{
+    vector<Sample> samples;
+    vector<Launch> launches(options.hold);
+    vector<int> inputs(options.hold, -1);
+    failures = 0;
+
+    // Start the launches one by one, each gets a booster
+    for (size_t i = 0; i < launches.size(); ++i) {
+        vector<string> held = command;
+        held.push_back("--hold");
+        held.push_back(format("%u", (unsigned)(i % 250 + 1)));
+
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) == -1 || !startLaunch(held, launches[i], fds[0])) {
+            launches[i].pid = -1;
+            failures++;
+            continue;
+        }
+        close(fds[0]);
+        inputs[i] = fds[1];
+
+        // Running once main() is reported
+        while (launches[i].output.find('\n') == string::npos && readLaunch(launches[i]))
+            ;
+    }
+
+    daemonFds = countFds(daemonPid, daemonMaxFd);
+
+    // Release the applications and collect the rest of their output
+    uint64_t released = now();
+    vector<struct pollfd> fds;
+    for (size_t i = 0; i < launches.size(); ++i) {
+        if (inputs[i] != -1)
+            close(inputs[i]);
+        if (launches[i].pid == -1)
+            continue;
+        struct pollfd pfd = { launches[i].fd, POLLIN, 0 };
+        fds.push_back(pfd);
+    }
+
+    size_t running = 0;
+    for (size_t i = 0; i < fds.size(); ++i)
+        running += fds[i].fd != -1;
+
+    while (running > 0) {
+        if (poll(fds.data(), fds.size(), -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (size_t i = 0, j = 0; i < launches.size(); ++i) {
+            if (launches[i].pid == -1)
+                continue;
+            struct pollfd &pfd = fds[j++];
+            if (pfd.fd == -1 || !pfd.revents)
+                continue;
+            if (!readLaunch(launches[i])) {
+                pfd.fd = -1;
+                running--;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < launches.size(); ++i) {
+        if (launches[i].pid == -1)
+            continue;
+
+        if (launches[i].fd != -1) {
+            close(launches[i].fd);
+            launches[i].exited = now();
+        }
+
+        Sample sample;
+        bool ok = finishLaunch(launches[i], sample);
+        int expected = (int)(i % 250 + 1);
+        if (!WIFEXITED(launches[i].status) || WEXITSTATUS(launches[i].status) != expected) {
+            fprintf(stderr, "appmotor-bench: held launch %u exited with status 0x%x, expected %d\n",
+                    (unsigned)i, launches[i].status, expected);
+            ok = false;
+        }
+
+        if (ok) {
+            sample.toExit = launches[i].exited - released;
+            samples.push_back(sample);
+        } else {
+            failures++;
+        }
+    }
+
+    return samples;
+}
+
+//! Copy a position independent executable so that the booster can also
+//! preload it: glibc does not dlopen() objects flagged with DF_1_PIE
+bool makeLoadable(const string &from, const string &to)
+{
+    int fd = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+
+    string data;
+    char buf[65536];
+    ssize_t len;
+    while ((len = read(fd, buf, sizeof buf)) > 0)
+        data.append(buf, len);
+    close(fd);
+
+    // Clear the flag in the dynamic section
+    const ElfW(Ehdr) *ehdr = reinterpret_cast<const ElfW(Ehdr) *>(data.data());
+    if (data.size() < sizeof *ehdr || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+        ehdr->e_shoff + (uint64_t)ehdr->e_shnum * sizeof(ElfW(Shdr)) > data.size())
+        return false;
+
+    for (int i = 0; i < ehdr->e_shnum; ++i) {
+        const ElfW(Shdr) *shdr = reinterpret_cast<const ElfW(Shdr) *>(data.data() + ehdr->e_shoff) + i;
+        if (shdr->sh_type != SHT_DYNAMIC || shdr->sh_offset + shdr->sh_size > data.size())
+            continue;
+
+        ElfW(Dyn) *dyn = reinterpret_cast<ElfW(Dyn) *>(&data[shdr->sh_offset]);
+        for (size_t j = 0; j < shdr->sh_size / sizeof *dyn; ++j) {
+            if (dyn[j].d_tag == DT_FLAGS_1)
+                dyn[j].d_un.d_val &= ~(ElfW(Xword))DF_1_PIE;
+        }
+    }
+
+    fd = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0755);
+    if (fd == -1)
+        return false;
+    bool written = write(fd, data.data(), data.size()) == (ssize_t)data.size();
+    close(fd);
+    return written;
+}
+
+//! Launch the command with --hold, find out the executable of the
+//! application process, then end it and check its exit status
+bool launchHeld(const vector<string> &command, int code, string &exe)
+{
+    vector<string> held = command;
+    held.push_back("--hold");
+    held.push_back(format("%d", code));
+
+    Launch launch;
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1)
+        return false;
+    if (!startLaunch(held, launch, fds[0])) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    close(fds[0]);
+
+    while (launch.output.find('\n') == string::npos && readLaunch(launch))
+        ;
+
+    // The booster binary if it preloaded the application, else the application
+    int pid = 0;
+    size_t pos = launch.output.find("appmotor-bench main ");
+    char path[PATH_MAX];
+    ssize_t len = -1;
+    if (pos != string::npos &&
+        sscanf(launch.output.c_str() + pos, "appmotor-bench main %*u %*d %d", &pid) == 1)
+        len = readlink(format("/proc/%d/exe", pid).c_str(), path, sizeof path - 1);
+    exe = len > 0 ? string(path, len) : string();
+
+    close(fds[1]);
+    while (readLaunch(launch))
+        ;
+
+    Sample sample;
+    return finishLaunch(launch, sample) && !sample.fallback && WIFEXITED(launch.status) &&
+           WEXITSTATUS(launch.status) == code && !exe.empty();
+}
+
+//! Launch the preloaded copy, rewrite it in place and launch it again
+string rewrite(const Options &options, const vector<string> &command, const string &copy,
+               int &failures)
+{
+    failures = 0;
+
+    // Let the spare booster finish preloading
+    sleepMs(options.interval);
+
+    string exe;
+    bool launched = launchHeld(command, 1, exe);
+    bool preloaded = launched && exe != copy;
+    if (!preloaded) {
+        fprintf(stderr, "appmotor-bench: %s was not preloaded (exe %s)\n", copy.c_str(), exe.c_str());
+        failures++;
+    }
+
+    // The spare boosters preload the copy before it is rewritten
+    sleepMs(options.interval);
+
+    // Same inode, different size and mtime
+    int fd = open(copy.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    char page[4096];
+    memset(page, 0, sizeof page);
+    if (fd == -1 || write(fd, page, sizeof page) != (ssize_t)sizeof page) {
+        fprintf(stderr, "appmotor-bench: can't rewrite %s: %s\n", copy.c_str(), strerror(errno));
+        failures++;
+    }
+    if (fd != -1)
+        close(fd);
+
+    launched = launchHeld(command, 2, exe);
+    bool executed = launched && exe == copy;
+    if (!executed) {
+        fprintf(stderr, "appmotor-bench: rewritten %s was not started with exec() (exe %s)\n",
+                copy.c_str(), exe.c_str());
+        failures++;
+    }
+
+    return format(", \"preloaded\": %s, \"exec_after_rewrite\": %s",
+                  preloaded ? "true" : "false", executed ? "true" : "false");
+}
+
+//! Raise the soft limit of open files to the hard limit, held launches
+//! need two descriptors each
+void raiseFileLimit()
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options options = parseOptions(argc, argv);
+    raiseFileLimit();
+
+    // Private runtime directory for the sockets of the daemon
+    char runtimeDir[] = "/tmp/appmotor-bench-XXXXXX";
+    if (!mkdtemp(runtimeDir)) {
+        fprintf(stderr, "appmotor-bench: can't create runtime directory: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    setenv("XDG_RUNTIME_DIR", runtimeDir, 1);
+
+    // No display or GPU needed
+    setenv("QT_QPA_PLATFORM", "offscreen", 0);
+    setenv("QT_QUICK_BACKEND", "software", 0);
+
+    // Keep the output of the daemon out of the results
+    vector<string> daemonCommand;
+    daemonCommand.push_back(options.daemon);
+    daemonCommand.insert(daemonCommand.end(), options.daemonArgs.begin(), options.daemonArgs.end());
+
+    // Boosters preload a copy of the first application that can be rewritten
+    string copy = string(runtimeDir) + "/rewrite-" + options.apps[0].substr(options.apps[0].rfind('/') + 1);
+    if (options.rewrite) {
+        if (!makeLoadable(options.apps[0], copy)) {
+            fprintf(stderr, "appmotor-bench: can't copy %s\n", options.apps[0].c_str());
+            return EXIT_FAILURE;
+        }
+        daemonCommand.push_back("--application-binary=" + copy);
+    }
+    pid_t daemonPid = spawn(daemonCommand, STDERR_FILENO);
+    if (daemonPid == -1) {
+        fprintf(stderr, "appmotor-bench: can't start %s\n", options.daemon.c_str());
+        return EXIT_FAILURE;
+    }
+
+    // Wait for the invoker socket
+    string socketPath = string(runtimeDir) + "/mapplauncherd/_default/" + options.type + "/socket";
+    struct stat st;
+    for (int i = 0; i < 300 && stat(socketPath.c_str(), &st) == -1; ++i)
+        sleepMs(100);
+
+    FILE *out = stdout;
+    if (!options.output.empty() && !(out = fopen(options.output.c_str(), "w"))) {
+        fprintf(stderr, "appmotor-bench: can't write %s: %s\n", options.output.c_str(), strerror(errno));
+        out = stdout;
+    }
+
+    int status = EXIT_SUCCESS;
+    vector<string> results;
+    for (size_t i = 0; i < options.apps.size(); ++i) {
+        const string &app = options.apps[i];
+        int failures = 0;
+
+        vector<string> invoked;
+        invoked.push_back(options.invoker);
+        invoked.push_back("--type=" + options.type);
+        invoked.push_back("--respawn=0");
+        invoked.push_back(app);
+
+        vector<string> direct;
+        direct.push_back(app);
+
+        if (options.iterations > 0) {
+            vector<Sample> samples = measure(options, invoked, failures);
+            results.push_back(formatResult(app, "invoker", samples, failures));
+            if (failures)
+                status = EXIT_FAILURE;
+
+            samples = measure(options, direct, failures);
+            results.push_back(formatResult(app, "exec", samples, failures));
+            if (failures)
+                status = EXIT_FAILURE;
+        }
+
+        if (options.storm > 0) {
+            uint64_t duration = 0;
+            vector<Sample> samples = storm(options, invoked, failures, duration);
+            int fallbacks = 0;
+            for (size_t j = 0; j < samples.size(); ++j)
+                fallbacks += samples[j].fallback;
+            results.push_back(formatResult(app, "storm", samples, failures,
+                    format(", \"concurrency\": %d, \"duration_ms\": %.1f, \"launches_per_s\": %.1f,"
+                           " \"fallback_rate\": %.3f",
+                           options.storm, duration / 1e6,
+                           duration ? samples.size() * 1e9 / duration : 0.0,
+                           (double)fallbacks / options.storm)));
+            if (failures)
+                status = EXIT_FAILURE;
+            sleepMs(options.interval);
+        }
+
+        if (options.hold > 0) {
+            int daemonFds = 0;
+            int daemonMaxFd = -1;
+            vector<Sample> samples = hold(options, invoked, daemonPid, failures,
+                                          daemonFds, daemonMaxFd);
+            int held = 0;
+            for (size_t j = 0; j < samples.size(); ++j)
+                held += !samples[j].fallback;
+            results.push_back(formatResult(app, "hold", samples, failures,
+                    format(", \"concurrency\": %d, \"held\": %d, \"daemon_fds\": %d,"
+                           " \"daemon_max_fd\": %d",
+                           options.hold, held, daemonFds, daemonMaxFd)));
+            if (failures)
+                status = EXIT_FAILURE;
+            sleepMs(options.interval);
+        }
+    }
+
+    if (options.rewrite) {
+        vector<string> invoked;
+        invoked.push_back(options.invoker);
+        invoked.push_back("--type=" + options.type);
+        invoked.push_back("--respawn=0");
+        invoked.push_back(copy);
+
+        int failures = 0;
+        string extra = rewrite(options, invoked, copy, failures);
+        results.push_back(format("    {\"app\": %s, \"mode\": \"rewrite\", \"failures\": %d%s}",
+                                 jsonString(options.apps[0]).c_str(), failures, extra.c_str()));
+        if (failures)
+            status = EXIT_FAILURE;
+        unlink(copy.c_str());
+    }
+
+    fprintf(out, "{\n  \"iterations\": %d,\n  \"warmup\": %d,\n  \"interval_ms\": %d,\n"
+            "  \"storm\": %d,\n  \"hold\": %d,\n  \"results\": [\n",
+            options.iterations, options.warmup, options.interval, options.storm, options.hold);
+    for (size_t i = 0; i < results.size(); ++i)
+        fprintf(out, "%s%s\n", results[i].c_str(), i + 1 < results.size() ? "," : "");
+    fprintf(out, "  ]\n}\n");
+    if (out != stdout)
+        fclose(out);
+
+    kill(daemonPid, SIGTERM);
+    while (waitpid(daemonPid, NULL, 0) == -1 && errno == EINTR)
+        ;
+
+    return status;
+}
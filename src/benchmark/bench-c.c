@@ -0,0 +1,36 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "benchapp.h"
+
+int main(int argc, char **argv)
+{
+    appmotor_bench_report();
+
+    /* "--hold STATUS": keep running until the standard input is
+     * closed, then exit with STATUS, see appmotor-bench --hold */
+    if (argc == 3 && strcmp(argv[1], "--hold") == 0) {
+        char buf[64];
+        while (fread(buf, 1, sizeof buf, stdin) > 0)
+            ;
+        return atoi(argv[2]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,48 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+
+#include "benchapp.h"
+
+#include <QGuiApplication>
+#include <QQmlApplicationEngine>
+
+// Shows a window for one frame, runs with QT_QPA_PLATFORM=offscreen.
+// The timer quits if no frame is ever shown.
+static const char QML[] =
+    "import QtQuick 2.0\n"
+    "import QtQuick.Window 2.2\n"
+    "Window {\n"
+    "    visible: true\n"
+    "    width: 320; height: 240\n"
+    "    Rectangle { anchors.fill: parent; color: \"steelblue\" }\n"
+    "    onFrameSwapped: Qt.quit()\n"
+    "    Timer { interval: 5000; running: true; onTriggered: Qt.quit() }\n"
+    "}\n";
+
+int main(int argc, char **argv)
+{
+    appmotor_bench_report();
+
+    QGuiApplication app(argc, argv);
+    QQmlApplicationEngine engine;
+    QObject::connect(&engine, &QQmlApplicationEngine::quit,
+                     &app, &QGuiApplication::quit, Qt::QueuedConnection);
+    engine.loadData(QML);
+    if (engine.rootObjects().isEmpty())
+        return 1;
+
+    return app.exec();
+}
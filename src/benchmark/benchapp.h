@@ -0,0 +1,49 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+
+#ifndef BENCHAPP_H
+#define BENCHAPP_H
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Prints the time main() was entered, the resident set size and the
+ * pid for appmotor-bench, which reads them from the standard output.
+ * The pid tells launches the invoker fell back to exec() for. */
+static inline void appmotor_bench_report(void)
+{
+    struct timespec ts = { 0, 0 };
+    long size = 0;
+    long resident = 0;
+    FILE *file;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    file = fopen("/proc/self/statm", "r");
+    if (file) {
+        if (fscanf(file, "%ld %ld", &size, &resident) != 2)
+            resident = 0;
+        fclose(file);
+    }
+
+    printf("appmotor-bench main %llu %ld %d\n",
+           (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec,
+           resident * (sysconf(_SC_PAGESIZE) / 1024), (int)getpid());
+    fflush(stdout);
+}
+
+#endif // BENCHAPP_H
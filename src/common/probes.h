@@ -0,0 +1,43 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifndef PROBES_H
+#define PROBES_H
+
+/* Static tracepoints (USDT) at the stages of a launch, provider
+ * "appmotor". A probe is a single nop until a tracer such as bpftrace
+ * or perf attaches to it, e.g.
+ *
+ *   bpftrace -e 'usdt:/usr/lib/libapplauncherd.so:appmotor:booster_main
+ *                { printf("%s\n", str(arg0)); }'
+ *
+ * Without sys/sdt.h (ENABLE_PROBES=OFF) the probes compile to nothing.
+ */
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define APPMOTOR_PROBE(name) DTRACE_PROBE(appmotor, name)
+#define APPMOTOR_PROBE1(name, a) DTRACE_PROBE1(appmotor, name, a)
+#define APPMOTOR_PROBE2(name, a, b) DTRACE_PROBE2(appmotor, name, a, b)
+#define APPMOTOR_PROBE3(name, a, b, c) DTRACE_PROBE3(appmotor, name, a, b, c)
+#else
+#define APPMOTOR_PROBE(name) do {} while (0)
+#define APPMOTOR_PROBE1(name, a) do { (void)(a); } while (0)
+#define APPMOTOR_PROBE2(name, a, b) do { (void)(a); (void)(b); } while (0)
+#define APPMOTOR_PROBE3(name, a, b, c) do { (void)(a); (void)(b); (void)(c); } while (0)
+#endif
+
+#endif // PROBES_H
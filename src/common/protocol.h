@@ -24,7 +24,9 @@
 
 const uint32_t INVOKER_MSG_MAGIC                          = 0xb0070000;
 const uint32_t INVOKER_MSG_MAGIC_VERSION_MASK             = 0x0000ff00;
-const uint32_t INVOKER_MSG_MAGIC_VERSION                  = 0x00000300;
+const uint32_t INVOKER_MSG_MAGIC_VERSION                  = 0x00000400;
+/* Version 3 sends every field with its own write, still accepted */
+const uint32_t INVOKER_MSG_MAGIC_VERSION_V3               = 0x00000300;
 const uint32_t INVOKER_MSG_MAGIC_OPTION_MASK              = 0x000000ff;
 const uint32_t INVOKER_MSG_MAGIC_OPTION_WAIT              = 0x00000001;
 const uint32_t INVOKER_MSG_MAGIC_OPTION_DLOPEN_GLOBAL     = 0x00000002;
@@ -33,6 +35,7 @@ const uint32_t INVOKER_MSG_MAGIC_OPTION_SINGLE_INSTANCE   = 0x00000008;
 /* 0x00000010 was INVOKER_MSG_MAGIC_OPTION_SPLASH_SCREEN */
 const uint32_t INVOKER_MSG_MAGIC_OPTION_OOM_ADJ_DISABLE   = 0x00000020;
 /* 0x00000040 was INVOKER_MSG_MAGIC_OPTION_LANDSCAPE_SPLASH_SCREEN */
+const uint32_t INVOKER_MSG_MAGIC_OPTION_TIMING            = 0x00000080;
 
 
 const uint32_t INVOKER_MSG_MASK               = 0xffff0000;
@@ -41,6 +44,7 @@ const uint32_t INVOKER_MSG_NAME               = 0x5a5e0000;
 const uint32_t INVOKER_MSG_EXEC               = 0xe8ec0000;
 const uint32_t INVOKER_MSG_ARGS               = 0xa4650000;
 const uint32_t INVOKER_MSG_ENV                = 0xe5710000;
+const uint32_t INVOKER_MSG_ENV_BLOCK          = 0xe5720000;
 const uint32_t INVOKER_MSG_PRIO               = 0xa1ce0000;
 const uint32_t INVOKER_MSG_DELAY              = 0xb2de0012;
 const uint32_t INVOKER_MSG_IDS                = 0xb2df4000;
@@ -51,6 +55,47 @@ const uint32_t INVOKER_MSG_SPLASH             = 0x5b1a0000;
 const uint32_t INVOKER_MSG_LANDSCAPE_SPLASH   = 0x5b120000;
 const uint32_t INVOKER_MSG_EXIT               = 0xe4170000;
 const uint32_t INVOKER_MSG_ACK                = 0x600d0000;
+const uint32_t INVOKER_MSG_TIMING             = 0x71a60000;
+
+/* Version 4 sends the magic, the length of the rest of the request and
+ * the messages from INVOKER_MSG_NAME to INVOKER_MSG_END in one sendmsg(),
+ * with the I/O descriptors attached as SCM_RIGHTS */
+const uint32_t INVOKER_MSG_FRAME_MAX          = 0x00400000;
+
+/* Largest argc accepted in INVOKER_MSG_ARGS */
+const uint32_t INVOKER_MSG_ARGS_MAX           = 1024;
+
+/* With INVOKER_MSG_MAGIC_OPTION_TIMING the booster and the daemon send
+ * INVOKER_MSG_TIMING, the number of stages and that many InvokerTiming
+ * records to the invoker before the application is started. */
+const uint32_t INVOKER_TIMING_STARTUP         = 1;  /* invoker: process start, option parsing */
+const uint32_t INVOKER_TIMING_SEARCH          = 2;  /* invoker: options, search_program() */
+const uint32_t INVOKER_TIMING_CONNECT         = 3;  /* invoker: connect to the booster socket */
+const uint32_t INVOKER_TIMING_SEND            = 4;  /* invoker: build and send the request */
+const uint32_t INVOKER_TIMING_ACK             = 5;  /* invoker: wait for INVOKER_MSG_ACK */
+const uint32_t INVOKER_TIMING_REQUEST         = 6;  /* booster: accept and receive the request */
+const uint32_t INVOKER_TIMING_PARENT          = 7;  /* booster: sendDataToParent() */
+const uint32_t INVOKER_TIMING_ENVIRONMENT     = 8;  /* booster: setEnvironmentBeforeLaunch() */
+const uint32_t INVOKER_TIMING_LOAD            = 9;  /* booster: dlopen() of the application */
+const uint32_t INVOKER_TIMING_MAIN            = 10; /* booster: until main() or exec() */
+const uint32_t INVOKER_TIMING_DAEMON          = 11; /* daemon: handle the booster report */
+const uint32_t INVOKER_TIMING_MAX_STAGES      = 16;
+
+typedef struct InvokerTiming {
+    uint32_t stage;
+    uint32_t minorFaults;       /* getrusage() deltas over the stage */
+    uint32_t majorFaults;
+    uint32_t voluntarySwitches;
+    uint32_t involuntarySwitches;
+    uint32_t reserved;
+    uint64_t begin;             /* CLOCK_MONOTONIC, nanoseconds */
+    uint64_t end;
+} InvokerTiming;
+
+/* File in the mapplauncherd directory counting the launches invokers did
+ * without a booster, a native uint64_t updated under flock() */
+#define INVOKER_FALLBACKS_FILE "invoker-fallbacks"
+
 // not used (Harmattan security stuff)
 // const uint32_t INVOKER_MSG_BAD_CREDS          = 0x60035800;
 
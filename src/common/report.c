@@ -28,6 +28,7 @@
 #include <limits.h>
 
 #include "report.h"
+#include "trace.h"
 
 static enum report_output output = report_guess;
 static enum report_type level = report_warning;
@@ -116,7 +117,17 @@ void vreport(enum report_type type, const char *msg, va_list arg)
     /* Any errors during logging must not change errno */
     int saved = errno;
 
-    if ((type = normalize_type(type)) > level)
+    type = normalize_type(type);
+
+    /* The trace gets every message, it is cheap enough */
+    if (trace_enabled()) {
+        va_list copy;
+        va_copy(copy, arg);
+        trace_record(type, saved, msg, copy);
+        va_end(copy);
+    }
+
+    if (type > level)
         goto EXIT;
 
     char *str_type = "";
@@ -0,0 +1,468 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+#define TRACE_MIN_RECORDS 64
+#define TRACE_MAX_RECORDS (1u << 20)
+
+static struct trace_header *trace_map = NULL;
+static size_t trace_map_size = 0;
+static char trace_directory[PATH_MAX];
+static unsigned trace_records = 0;
+
+/* gettid() is a system call, cache it per thread */
+static __thread pid_t trace_tid = 0;
+
+static uint64_t trace_clock(clockid_t clock)
+{
+    /* Served by the vDSO without entering the kernel */
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static struct trace_format *trace_formats(struct trace_header *header)
+{
+    return (struct trace_format *)((char *)header + TRACE_HEADER_SIZE);
+}
+
+static char *trace_strings(struct trace_header *header)
+{
+    return (char *)(trace_formats(header) + header->format_count);
+}
+
+static struct trace_record *trace_slot(struct trace_header *header, uint64_t index)
+{
+    char *records = (char *)header + header->records_offset;
+    return (struct trace_record *)(records + (index & (header->record_count - 1)) * header->record_size);
+}
+
+int trace_open(const char *directory, unsigned records)
+{
+    trace_close();
+
+    unsigned count = TRACE_MIN_RECORDS;
+    while (count < records && count < TRACE_MAX_RECORDS)
+        count <<= 1;
+
+    if (mkdir(directory, S_IRUSR | S_IWUSR | S_IXUSR) == -1 && errno != EEXIST)
+        return -1;
+
+    char path[PATH_MAX];
+    int length = snprintf(path, sizeof path, "%s/%d", directory, (int)getpid());
+    if (length <= 0 || (size_t)length >= sizeof path)
+        return -1;
+
+    size_t strings_end = TRACE_HEADER_SIZE + TRACE_FORMATS * sizeof(struct trace_format) + TRACE_STRINGS;
+    size_t records_offset = (strings_end + TRACE_HEADER_SIZE - 1) / TRACE_HEADER_SIZE * TRACE_HEADER_SIZE;
+    size_t size = records_offset + (size_t)count * TRACE_RECORD_SIZE;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd == -1)
+        return -1;
+
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, (off_t)size) == 0)
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        unlink(path);
+        return -1;
+    }
+
+    /* The file is sparse, only the header is written here */
+    struct trace_header *header = map;
+    header->version = TRACE_VERSION;
+    header->record_size = TRACE_RECORD_SIZE;
+    header->record_count = count;
+    header->format_count = TRACE_FORMATS;
+    header->string_size = TRACE_STRINGS;
+    header->records_offset = (uint32_t)records_offset;
+    header->pid = (int32_t)getpid();
+    header->realtime = trace_clock(CLOCK_REALTIME);
+    header->monotonic = trace_clock(CLOCK_MONOTONIC);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(header->magic, TRACE_MAGIC, sizeof header->magic);
+
+    if (directory != trace_directory)
+        snprintf(trace_directory, sizeof trace_directory, "%s", directory);
+    trace_records = count;
+    trace_map_size = size;
+    trace_tid = 0;
+    __atomic_store_n(&trace_map, header, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void trace_reopen(void)
+{
+    if (!trace_map)
+        return;
+
+    /* Only this thread survived the fork */
+    trace_open(trace_directory, trace_records);
+}
+
+void trace_close(void)
+{
+    struct trace_header *header = __atomic_exchange_n(&trace_map, NULL, __ATOMIC_ACQ_REL);
+    if (header)
+        munmap(header, trace_map_size);
+}
+
+int trace_enabled(void)
+{
+    return trace_map != NULL;
+}
+
+void trace_remove(pid_t pid)
+{
+    char path[PATH_MAX];
+    int length = snprintf(path, sizeof path, "%s/%d", trace_directory, (int)pid);
+    if (trace_directory[0] && length > 0 && (size_t)length < sizeof path)
+        unlink(path);
+}
+
+void trace_prune(void)
+{
+    DIR *dir = trace_directory[0] ? opendir(trace_directory) : NULL;
+    if (!dir)
+        return;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        char *end = NULL;
+        long pid = strtol(entry->d_name, &end, 10);
+        if (pid <= 0 || *end)
+            continue;
+        if (kill((pid_t)pid, 0) == -1 && errno == ESRCH)
+            unlinkat(dirfd(dir), entry->d_name, 0);
+    }
+    closedir(dir);
+}
+
+const char *trace_next_conversion(const char *format, struct trace_conversion *conversion)
+{
+    for (;;) {
+        format = strchr(format, '%');
+        if (!format)
+            return NULL;
+        if (format[1] != '%')
+            break;
+        format += 2;
+    }
+
+    conversion->start = format++;
+    conversion->star_width = 0;
+    conversion->star_precision = 0;
+    conversion->precision = -1;
+    conversion->length = trace_length_none;
+    conversion->conversion = 0;
+
+    bool positional = false;
+    while (*format && strchr("-+ #0'I", *format))
+        ++format;
+    if (*format == '*')
+        conversion->star_width = 1, ++format;
+    while (isdigit((unsigned char)*format))
+        ++format;
+    if (*format == '$')
+        positional = true, ++format;
+    if (*format == '.') {
+        ++format;
+        if (*format == '*') {
+            conversion->star_precision = 1, ++format;
+        } else {
+            conversion->precision = 0;
+            while (isdigit((unsigned char)*format))
+                conversion->precision = conversion->precision * 10 + (*format++ - '0');
+        }
+    }
+
+    switch (*format) {
+    case 'h':
+        ++format;
+        if (*format == 'h')
+            conversion->length = trace_length_hh, ++format;
+        else
+            conversion->length = trace_length_h;
+        break;
+    case 'l':
+        ++format;
+        if (*format == 'l')
+            conversion->length = trace_length_ll, ++format;
+        else
+            conversion->length = trace_length_l;
+        break;
+    case 'q':
+        conversion->length = trace_length_ll, ++format;
+        break;
+    case 'j':
+        conversion->length = trace_length_j, ++format;
+        break;
+    case 'z':
+    case 'Z':
+        conversion->length = trace_length_z, ++format;
+        break;
+    case 't':
+        conversion->length = trace_length_t, ++format;
+        break;
+    case 'L':
+        conversion->length = trace_length_long_double, ++format;
+        break;
+    default:
+        break;
+    }
+
+    if (!*format) {
+        conversion->end = format;
+        return format;
+    }
+
+    conversion->end = format + 1;
+    if (!positional && strchr("diouxXcpeEfFgGaAsm", *format))
+        conversion->conversion = *format;
+    return conversion->end;
+}
+
+/* Return index of the format in the format table, adding it if needed,
+ * or -1 if it can't be stored */
+static int trace_format_index(struct trace_header *header, const char *format)
+{
+    struct trace_format *formats = trace_formats(header);
+    const uint64_t key = (uintptr_t)format;
+    const unsigned count = header->format_count;
+    unsigned i = (unsigned)((key * 0x9e3779b97f4a7c15ull) >> 32) % count;
+
+    for (unsigned probe = 0; probe < count; ++probe, i = (i + 1) % count) {
+        uint64_t current = __atomic_load_n(&formats[i].key, __ATOMIC_ACQUIRE);
+        if (current == 0) {
+            if (__atomic_compare_exchange_n(&formats[i].key, &current, key, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                size_t length = strlen(format);
+                uint32_t offset = __atomic_fetch_add(&header->strings_used, (uint32_t)length + 1,
+                                                     __ATOMIC_RELAXED);
+                if (length >= header->string_size || offset > header->string_size - length - 1) {
+                    __atomic_store_n(&formats[i].length, TRACE_FORMAT_NONE, __ATOMIC_RELEASE);
+                    return -1;
+                }
+                memcpy(trace_strings(header) + offset, format, length + 1);
+                formats[i].offset = offset;
+                __atomic_store_n(&formats[i].length, (uint32_t)length, __ATOMIC_RELEASE);
+                return (int)i;
+            }
+        }
+        if (current == key) {
+            // Another thread may still be writing the string
+            uint32_t length = __atomic_load_n(&formats[i].length, __ATOMIC_ACQUIRE);
+            return length == 0 || length == TRACE_FORMAT_NONE ? -1 : (int)i;
+        }
+    }
+    return -1;
+}
+
+static bool trace_put(struct trace_record *record, const void *data, size_t size)
+{
+    if (record->size + size > sizeof record->data) {
+        record->flags |= TRACE_TRUNCATED;
+        return false;
+    }
+    memcpy(record->data + record->size, data, size);
+    record->size += (uint32_t)size;
+    return true;
+}
+
+static bool trace_put_value(struct trace_record *record, uint64_t value)
+{
+    return trace_put(record, &value, sizeof value);
+}
+
+static bool trace_put_string(struct trace_record *record, const char *string, int precision)
+{
+    if (!string)
+        string = "(null)";
+
+    size_t length = precision >= 0 ? strnlen(string, (size_t)precision) : strlen(string);
+    size_t available = sizeof record->data - record->size;
+    if (available <= sizeof(uint16_t)) {
+        record->flags |= TRACE_TRUNCATED;
+        return false;
+    }
+    if (length > available - sizeof(uint16_t)) {
+        length = available - sizeof(uint16_t);
+        record->flags |= TRACE_TRUNCATED;
+    }
+
+    uint16_t size = (uint16_t)length;
+    trace_put(record, &size, sizeof size);
+    trace_put(record, string, length);
+    return !(record->flags & TRACE_TRUNCATED);
+}
+
+static int64_t trace_signed_arg(enum trace_length length, va_list *arg)
+{
+    switch (length) {
+    case trace_length_hh: return (signed char)va_arg(*arg, int);
+    case trace_length_h:  return (short)va_arg(*arg, int);
+    case trace_length_l:  return va_arg(*arg, long);
+    case trace_length_ll: return va_arg(*arg, long long);
+    case trace_length_j:  return va_arg(*arg, intmax_t);
+    case trace_length_z:  return va_arg(*arg, ssize_t);
+    case trace_length_t:  return va_arg(*arg, ptrdiff_t);
+    default:              return va_arg(*arg, int);
+    }
+}
+
+static uint64_t trace_unsigned_arg(enum trace_length length, va_list *arg)
+{
+    switch (length) {
+    case trace_length_hh: return (unsigned char)va_arg(*arg, unsigned int);
+    case trace_length_h:  return (unsigned short)va_arg(*arg, unsigned int);
+    case trace_length_l:  return va_arg(*arg, unsigned long);
+    case trace_length_ll: return va_arg(*arg, unsigned long long);
+    case trace_length_j:  return va_arg(*arg, uintmax_t);
+    case trace_length_z:  return va_arg(*arg, size_t);
+    case trace_length_t:  return (uint64_t)va_arg(*arg, ptrdiff_t);
+    default:              return va_arg(*arg, unsigned int);
+    }
+}
+
+/* Store the arguments of the format, return false if the format has
+ * conversions that can't be stored */
+static bool trace_encode(struct trace_record *record, const char *format, va_list *arg)
+{
+    struct trace_conversion conversion;
+    while ((format = trace_next_conversion(format, &conversion))) {
+        if (!conversion.conversion)
+            return false;
+
+        if (conversion.star_width && !trace_put_value(record, (uint64_t)(int64_t)va_arg(*arg, int)))
+            return true;
+        int precision = conversion.precision;
+        if (conversion.star_precision) {
+            precision = va_arg(*arg, int);
+            if (!trace_put_value(record, (uint64_t)(int64_t)precision))
+                return true;
+        }
+
+        bool stored = true;
+        switch (conversion.conversion) {
+        case 'd':
+        case 'i':
+            stored = trace_put_value(record, (uint64_t)trace_signed_arg(conversion.length, arg));
+            break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            stored = trace_put_value(record, trace_unsigned_arg(conversion.length, arg));
+            break;
+        case 'c':
+            if (conversion.length != trace_length_none)
+                return false;
+            stored = trace_put_value(record, (unsigned char)va_arg(*arg, int));
+            break;
+        case 'p':
+            stored = trace_put_value(record, (uintptr_t)va_arg(*arg, void *));
+            break;
+        case 's':
+            if (conversion.length != trace_length_none)
+                return false;
+            stored = trace_put_string(record, va_arg(*arg, const char *), precision);
+            break;
+        case 'm':
+            break;
+        default: {
+            double value = conversion.length == trace_length_long_double
+                    ? (double)va_arg(*arg, long double) : va_arg(*arg, double);
+            stored = trace_put(record, &value, sizeof value);
+            break;
+        }
+        }
+
+        // The decoder stops at the truncation
+        if (!stored)
+            return true;
+    }
+    return true;
+}
+
+void trace_record(int level, int error, const char *format, va_list arg)
+{
+    struct trace_header *header = __atomic_load_n(&trace_map, __ATOMIC_ACQUIRE);
+    if (!header)
+        return;
+
+    uint64_t time = trace_clock(CLOCK_MONOTONIC);
+    if (!trace_tid)
+        trace_tid = (pid_t)syscall(SYS_gettid);
+
+    uint64_t index = __atomic_fetch_add(&header->head, 1, __ATOMIC_RELAXED);
+    struct trace_record *record = trace_slot(header, index);
+    __atomic_store_n(&record->sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    record->time = time;
+    record->tid = (uint32_t)trace_tid;
+    record->level = (uint8_t)level;
+    record->flags = 0;
+    record->error = (uint32_t)error;
+    record->size = 0;
+
+    int format_index = trace_format_index(header, format);
+    bool encoded = false;
+    if (format_index >= 0) {
+        va_list copy;
+        va_copy(copy, arg);
+        record->format = (uint16_t)format_index;
+        encoded = trace_encode(record, format, &copy);
+        va_end(copy);
+    }
+
+    if (!encoded) {
+        record->format = TRACE_FORMAT_TEXT;
+        record->flags = 0;
+        errno = error;
+        int length = vsnprintf((char *)record->data, sizeof record->data, format, arg);
+        if (length < 0)
+            length = 0;
+        if ((size_t)length >= sizeof record->data) {
+            length = sizeof record->data - 1;
+            record->flags |= TRACE_TRUNCATED;
+        }
+        record->size = (uint32_t)length;
+    }
+
+    __atomic_store_n(&record->sequence, index + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,166 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Binary trace of report() messages.
+ *
+ * Every process writes to its own file, <directory>/<pid>, which is
+ * mapped shared so that the trace survives a crash of the process.
+ * The file starts with a trace_header, followed by the format table,
+ * the string area holding the format strings and the record ring:
+ *
+ *   [header][formats][strings][records]
+ *
+ * The format table starts at TRACE_HEADER_SIZE, the strings right
+ * after it and the records at records_offset. Pages of the file are
+ * allocated only when they are written to.
+ *
+ * A record holds the index of its format string in the format table
+ * and the arguments in binary form, in the order of the conversions in
+ * the format: integers, pointers and characters as 8 bytes (already
+ * narrowed to the length modifier), floating point values as a double,
+ * strings as a 16 bit length and the bytes, widths and precisions given
+ * as '*' as 8 bytes before the value. %m takes the saved errno of the
+ * record. Messages whose format can't be stored are recorded as text,
+ * formatted when they are logged.
+ *
+ * Writers reserve a record by incrementing the head atomically, clear
+ * its sequence, fill it and then publish index + 1 as its sequence.
+ * Readers keep records whose sequence matches their slot and did not
+ * change while the record was read.
+ */
+
+#define TRACE_MAGIC "AMTRACE1"
+#define TRACE_VERSION 1
+
+#define TRACE_HEADER_SIZE 4096
+#define TRACE_DEFAULT_RECORDS 4096
+#define TRACE_RECORD_SIZE 256
+#define TRACE_FORMATS 512
+#define TRACE_STRINGS (32 * 1024)
+
+/* Format of text records */
+#define TRACE_FORMAT_TEXT 0xffff
+
+/* Record flags */
+#define TRACE_TRUNCATED 0x01
+
+struct trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t record_count;      /* power of two */
+    uint32_t format_count;
+    uint32_t string_size;
+    uint32_t records_offset;    /* from the start of the file */
+    int32_t pid;
+    uint32_t reserved;
+    uint64_t realtime;          /* CLOCK_REALTIME at open, ns */
+    uint64_t monotonic;         /* CLOCK_MONOTONIC at open, ns */
+    uint64_t head;              /* index of the next record */
+    uint32_t strings_used;
+};
+
+struct trace_format {
+    uint64_t key;       /* address of the format string, 0 if unused */
+    uint32_t offset;    /* in the string area */
+    uint32_t length;    /* without terminating null, 0 until written */
+};
+
+/* Length of a format entry whose string did not fit */
+#define TRACE_FORMAT_NONE 0xffffffffu
+
+struct trace_record {
+    uint64_t sequence;  /* index + 1, 0 while being written */
+    uint64_t time;      /* CLOCK_MONOTONIC, ns */
+    uint32_t tid;
+    uint16_t format;    /* index in the format table or TRACE_FORMAT_TEXT */
+    uint8_t level;      /* enum report_type */
+    uint8_t flags;
+    uint32_t error;     /* errno for %m */
+    uint32_t size;      /* bytes used in data */
+    unsigned char data[TRACE_RECORD_SIZE - 32];
+};
+
+/* Start tracing to <directory>/<pid> with the given number of records,
+ * rounded up to a power of two. Returns 0 on success, -1 on failure. */
+extern int trace_open(const char *directory, unsigned records);
+
+/* Start a new trace file for the current process after fork(), if
+ * tracing was enabled in the parent. The inherited mapping belongs to
+ * the parent. */
+extern void trace_reopen(void);
+
+/* Stop tracing. The trace file is kept. */
+extern void trace_close(void);
+
+/* Return non-zero if tracing is enabled */
+extern int trace_enabled(void);
+
+/* Remove the trace file of the given process */
+extern void trace_remove(pid_t pid);
+
+/* Remove trace files of processes that do not exist anymore */
+extern void trace_prune(void);
+
+/* Record a message, called by vreport() for every message. The
+ * arguments are consumed. */
+extern void trace_record(int level, int error, const char *format, va_list arg);
+
+/* Length modifiers of a conversion */
+enum trace_length {
+    trace_length_none,
+    trace_length_hh,
+    trace_length_h,
+    trace_length_l,
+    trace_length_ll,
+    trace_length_j,
+    trace_length_z,
+    trace_length_t,
+    trace_length_long_double,
+};
+
+/* A printf conversion specification */
+struct trace_conversion {
+    const char *start;      /* the '%' */
+    const char *end;        /* after the conversion character */
+    int star_width;         /* width given as '*' */
+    int star_precision;     /* precision given as '*' */
+    int precision;          /* -1 if none or given as '*' */
+    enum trace_length length;
+    char conversion;        /* 0 if not supported, e.g. positional */
+};
+
+/* Find the next conversion in a format, skipping "%%". Returns the
+ * position after it or NULL if there are no more conversions. Used by
+ * both the writer and the decoder, so that they agree on the layout
+ * of the arguments. */
+extern const char *trace_next_conversion(const char *format, struct trace_conversion *conversion);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // TRACE_H
@@ -18,14 +18,23 @@
 ****************************************************************************/
 
 #include "cutefish-appmotor.h"
+#include "appmotorcache_p.h"
 #include "daemon.h"
+#include "elfinfo.h"
+#include "logger.h"
+#include "preloader.h"
 
+#include <fnmatch.h>
 #include <unistd.h>
 
-#include <QQuickView>
+#include <fstream>
+#include <sstream>
+
+#include <QLibraryInfo>
 #include <QtGlobal>
 #include <QApplication>
-#include <QDebug>
+#include <QFontDatabase>
+#include <QIcon>
 
 const string CutefishBooster::m_boosterType = "cutefish";
 
@@ -34,45 +43,119 @@ const string & CutefishBooster::boosterType() const
     return m_boosterType;
 }
 
-int CutefishBooster::launchProcess()
+// Check allow / deny rules of the application, see dlopen.conf
+static bool dlopenAllowed(const string &fileName)
 {
-    Booster::setEnvironmentBeforeLaunch();
+    std::ifstream config(DLOPEN_CONFIG_PATH);
+    string line;
+    while (std::getline(config, line)) {
+        std::istringstream words(line);
+        string action, pattern;
+        if (!(words >> action >> pattern) || action[0] == '#')
+            continue;
+
+        if (fnmatch(pattern.c_str(), fileName.c_str(), 0) != 0)
+            continue;
+
+        if (action == "allow")
+            return true;
+        if (action == "deny")
+            return false;
+
+        Logger::logWarning("Booster: invalid line in %s: %s", DLOPEN_CONFIG_PATH, line.c_str());
+    }
 
-    // Ensure a NULL-terminated argv
-    char ** dummyArgv = new char * [appData()->argc() + 1];
-    const int argc = appData()->argc();
-    for (int i = 0; i < argc; i++)
-        dummyArgv[i] = strdup(appData()->argv()[i]);
+    return true;
+}
+
+bool CutefishBooster::canLoadApplication(const string &fileName) const
+{
+    return dlopenAllowed(fileName) && Booster::canLoadApplication(fileName);
+}
 
-    dummyArgv[argc] = NULL;
+int CutefishBooster::launchProcess()
+{
+    const string &fileName = appData()->fileName();
+    if (applicationPreloaded(fileName) || canLoadApplication(fileName)) {
+        Logger::logDebug("Booster: loading '%s' with dlopen", appData()->fileName().c_str());
 
-    // Exec the binary (execv returns only in case of an error).
-    execv(appData()->fileName().c_str(), dummyArgv);
+        // Applications using AppMotorCache take over the pre-created
+        // instances, others create their own. Libraries, plugins and
+        // caches loaded by the warm-up stay in place in both cases.
+        if (!ElfInfo(appData()->fileName()).needsLibrary("libappmotorcache.so"))
+            AppMotorCachePrivate::clear();
 
-    // Delete dummy argv if execv failed
-    for (int i = 0; i < argc; i++)
-        free(dummyArgv[i]);
+        return Booster::launchProcess();
+    }
 
-    delete [] dummyArgv;
+    Booster::setEnvironmentBeforeLaunch();
 
-    return EXIT_FAILURE;
+    return execProcess();
 }
 
 void CutefishBooster::initialize(int initialArgc, char **initialArgv, int boosterLauncherSocket,
                            int socketFd, SingleInstance *singleInstance, bool bootMode)
 {
-    new QApplication(initialArgc, initialArgv);
+    // QApplication is created when warming up, see warmUp()
+    m_argc = initialArgc;
+    m_argv = initialArgv;
     Booster::initialize(initialArgc, initialArgv, boosterLauncherSocket, socketFd, singleInstance, bootMode);
 }
 
+bool CutefishBooster::preloadTemplate()
+{
+    // Loading and relocating the libraries and plugins is fork-safe,
+    // unlike connecting to the display server, so it is done once in
+    // the template process. QApplication and the QML engine in the
+    // boosters then find the plugins already loaded.
+    Preloader preloader;
+    preloader.setVariable("QT_PLUGINS", QLibraryInfo::location(QLibraryInfo::PluginsPath).toStdString());
+    preloader.setVariable("QML_IMPORTS", QLibraryInfo::location(QLibraryInfo::Qml2ImportsPath).toStdString());
+
+    if (!preloader.readManifest(PRELOAD_MANIFEST_PATH)) {
+        Logger::logWarning("Booster: cannot read %s, nothing preloaded", PRELOAD_MANIFEST_PATH);
+        return true;
+    }
+
+    preloader.load();
+
+    return true;
+}
+
 bool CutefishBooster::preload()
 {
-    QQuickView window;
-    window.create();
+    // Kept for AppMotorCache::engine() and AppMotorCache::view()
+    AppMotorCachePrivate::createView();
 
     return true;
 }
 
+bool CutefishBooster::warmUp(WarmupLevel level)
+{
+    switch (level) {
+    case WarmupLibraries:
+        return preloadTemplate();
+
+    case WarmupApplication:
+        // Connects to the display server and loads the platform theme,
+        // kept for AppMotorCache::application()
+        AppMotorCachePrivate::createApplication(m_argc, m_argv);
+        return true;
+
+    case WarmupQml:
+        return preload();
+
+    case WarmupResources:
+        // Fill font and icon theme caches
+        QFontDatabase().families();
+        QIcon::fromTheme(QStringLiteral("application-x-executable")).pixmap(32);
+        return true;
+
+    default:
+        return true;
+    }
+}
+
 int main(int argc, char **argv)
 {
     CutefishBooster *booster = new CutefishBooster;
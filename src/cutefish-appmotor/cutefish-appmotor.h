@@ -31,7 +31,7 @@ class CutefishBooster : public Booster
 public:
 
     //! Constructor.
-    CutefishBooster() {};
+    CutefishBooster() : m_argc(0), m_argv(NULL) {};
 
     //! Destructor.
     virtual ~CutefishBooster() {};
@@ -39,6 +39,7 @@ public:
     //! \reimp
     virtual const string & boosterType() const;
 
+    //! \reimp
     virtual void initialize(int initialArgc, char ** initialArgv, int boosterLauncherSocket,
                             int socketFd, SingleInstance * singleInstance,
                             bool bootMode) override;
@@ -48,8 +49,18 @@ protected:
     //! \reimp
     virtual bool preload();
 
+    //! \reimp
+    virtual bool preloadTemplate();
+
+    //! \reimp
+    virtual bool warmUp(WarmupLevel level);
+
+    //! Load the application with dlopen() if possible, exec() it otherwise
     virtual int launchProcess();
 
+    //! Return true if the application can and may be loaded with dlopen()
+    virtual bool canLoadApplication(const string &fileName) const;
+
 private:
 
     //! Disable copy-constructor
@@ -59,6 +70,10 @@ private:
     CutefishBooster & operator= (const CutefishBooster & r);
 
     static const string m_boosterType;
+
+    //! Arguments of the booster process, QApplication keeps references
+    int m_argc;
+    char ** m_argv;
 };
 
 #endif //QTBOOSTER_H
\ No newline at end of file
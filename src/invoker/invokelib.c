@@ -24,18 +24,58 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #include "report.h"
 #include "invokelib.h"
 
+// Descriptors that can be attached to a frame
+#define INVOKE_FRAME_MAX_FDS 3
+
+// Frame being collected, see invoke_frame_begin()
+static struct {
+    bool      active;
+    uint32_t  header[2];
+    char     *data;
+    size_t    size;
+    size_t    used;
+} g_frame;
+
+static void invoke_die(const char *m, size_t size)
+{
+    if (write(STDERR_FILENO, m, size) == -1) {
+        // dontcare
+    }
+    _exit(EXIT_FAILURE);
+}
+
+static void invoke_frame_append(const void *data, size_t size)
+{
+    if (g_frame.used + size > g_frame.size) {
+        size_t new_size = g_frame.size ? g_frame.size : 4096;
+        while (new_size < g_frame.used + size)
+            new_size *= 2;
+        char *new_data = realloc(g_frame.data, new_size);
+        if (!new_data) {
+            const char m[] = "*** out of memory, terminating\n";
+            invoke_die(m, sizeof m - 1);
+        }
+        g_frame.data = new_data;
+        g_frame.size = new_size;
+    }
+
+    memcpy(g_frame.data + g_frame.used, data, size);
+    g_frame.used += size;
+}
+
 static void invoke_send_or_die(int fd, const void *data, size_t size)
 {
-    if (write(fd, data, size) != (ssize_t)size) {
+    if (g_frame.active) {
+        invoke_frame_append(data, size);
+    } else if (write(fd, data, size) != (ssize_t)size) {
         const char m[] = "*** socket write failure, terminating\n";
-        if (write(STDERR_FILENO, m, sizeof m - 1) == -1) {
-            // dontcare
-        }
-        _exit(EXIT_FAILURE);
+        invoke_die(m, sizeof m - 1);
     }
 }
 
@@ -85,3 +125,64 @@ void invoke_send_str(int fd, const char *str)
     /* Send the string. */
     invoke_send_or_die(fd, str, size);
 }
+
+void invoke_send_data(int fd, const void *data, uint32_t size)
+{
+    debug("%s: %u bytes\n", __FUNCTION__, size);
+    invoke_send_or_die(fd, data, size);
+}
+
+void invoke_frame_begin(uint32_t magic)
+{
+    debug("%s: %08x\n", __FUNCTION__, magic);
+    g_frame.active = true;
+    g_frame.header[0] = magic;
+    g_frame.used = 0;
+}
+
+void invoke_send_frame(int fd, const int *fds, int n_fds)
+{
+    struct msghdr msg;
+    struct iovec iov[2];
+    char buf[CMSG_SPACE(sizeof(int) * INVOKE_FRAME_MAX_FDS)];
+    size_t fds_size = sizeof(int) * n_fds;
+
+    g_frame.active = false;
+    g_frame.header[1] = g_frame.used;
+
+    memset(&msg, 0, sizeof(msg));
+
+    iov[0].iov_base = g_frame.header;
+    iov[0].iov_len = sizeof(g_frame.header);
+    iov[1].iov_base = g_frame.data;
+    iov[1].iov_len = g_frame.used;
+
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    if (n_fds > 0 && n_fds <= INVOKE_FRAME_MAX_FDS) {
+        struct cmsghdr *cmsg;
+
+        msg.msg_control = buf;
+        msg.msg_controllen = CMSG_SPACE(fds_size);
+
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_len = CMSG_LEN(fds_size);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        memcpy(CMSG_DATA(cmsg), fds, fds_size);
+    }
+
+    debug("%s: %u bytes\n", __FUNCTION__, g_frame.header[1]);
+
+    // Blocking stream socket, sendmsg() returns when all of it is queued
+    if (sendmsg(fd, &msg, 0) != (ssize_t)(sizeof(g_frame.header) + g_frame.used)) {
+        const char m[] = "*** socket write failure, terminating\n";
+        invoke_die(m, sizeof m - 1);
+    }
+
+    free(g_frame.data);
+    g_frame.data = NULL;
+    g_frame.size = 0;
+    g_frame.used = 0;
+}
@@ -29,6 +29,14 @@ bool invoke_recv_msg(int fd, uint32_t *msg);
 
 void invoke_send_str(int fd, const char *str);
 
+void invoke_send_data(int fd, const void *data, uint32_t size);
+
+// Collect following messages into one frame instead of sending them
+void invoke_frame_begin(uint32_t magic);
+
+// Send the collected frame and given descriptors with one sendmsg()
+void invoke_send_frame(int fd, const int *fds, int n_fds);
+
 // Existence of the test mode control file is checked
 // to enable test mode.
 #define TEST_MODE_CONTROL_FILE   "/root/.itm"
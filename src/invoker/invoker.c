@@ -34,6 +34,7 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/file.h>
 #include <unistd.h>
 #include <errno.h>
 #include <sys/wait.h>
@@ -45,6 +46,7 @@
 #include <dbus/dbus.h>
 
 #include "report.h"
+#include "probes.h"
 #include "protocol.h"
 #include "invokelib.h"
 #include "search.h"
@@ -222,6 +224,149 @@ static unsigned timestamp(void)
             (unsigned)(ts.tv_nsec / (1000 * 1000u)));
 }
 
+// Launch stages of this invoker and those received from the
+// booster and the daemon, see --timing
+#define TIMING_MAX_STAGES 48
+static bool          g_timing = false;
+static bool          g_timing_printed = false;
+static InvokerTiming g_timing_stages[TIMING_MAX_STAGES];
+static unsigned      g_timing_count = 0;
+static uint64_t      g_timing_last = 0;
+static struct rusage g_timing_usage;
+
+static uint64_t timing_now(void)
+{
+    struct timespec ts = { 0, 0 };
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Ends a stage of the invoker, the next one begins now
+static void timing_mark(uint32_t stage)
+{
+    struct rusage usage;
+    uint64_t now;
+
+    if (!g_timing)
+        return;
+
+    now = timing_now();
+    getrusage(RUSAGE_SELF, &usage);
+
+    if (g_timing_count < sizeof g_timing_stages / sizeof *g_timing_stages) {
+        InvokerTiming *timing = &g_timing_stages[g_timing_count++];
+        timing->stage = stage;
+        timing->minorFaults = usage.ru_minflt - g_timing_usage.ru_minflt;
+        timing->majorFaults = usage.ru_majflt - g_timing_usage.ru_majflt;
+        timing->voluntarySwitches = usage.ru_nvcsw - g_timing_usage.ru_nvcsw;
+        timing->involuntarySwitches = usage.ru_nivcsw - g_timing_usage.ru_nivcsw;
+        timing->reserved = 0;
+        timing->begin = g_timing_last;
+        timing->end = now;
+    }
+
+    g_timing_usage = usage;
+    g_timing_last = now;
+}
+
+// Starts timing, the first stage begins at process start
+static void timing_start(void)
+{
+    uint64_t startup = 0;
+    unsigned long long start_ticks = 0;
+    struct timespec ts = { 0, 0 };
+    char buf[1024];
+
+    // Field 22 of stat is the start time in clock ticks since boot,
+    // the name in field 2 may contain spaces
+    FILE *file = fopen("/proc/self/stat", "r");
+    if (file) {
+        size_t len = fread(buf, 1, sizeof buf - 1, file);
+        buf[len] = 0;
+        fclose(file);
+
+        const char *pos = strrchr(buf, ')');
+        if (pos && sscanf(pos + 2, "%*c %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s "
+                                   "%*s %*s %*s %*s %*s %*s %*s %*s %llu",
+                          &start_ticks) == 1 &&
+            clock_gettime(CLOCK_BOOTTIME, &ts) == 0) {
+            uint64_t boottime = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+            uint64_t started = start_ticks * (1000000000 / sysconf(_SC_CLK_TCK));
+            if (boottime > started)
+                startup = boottime - started;
+        }
+    }
+
+    memset(&g_timing_usage, 0, sizeof g_timing_usage);
+    g_timing_last = timing_now() - startup;
+    timing_mark(INVOKER_TIMING_STARTUP);
+}
+
+static const char *timing_stage_name(uint32_t stage)
+{
+    static const char *const names[] = {
+        "?", "startup", "search", "connect", "send", "ack", "request",
+        "parent", "environment", "load", "main", "daemon",
+    };
+    return stage < sizeof names / sizeof *names ? names[stage] : names[0];
+}
+
+// Prints stages that have not been printed yet, ordered by their end
+static void timing_print(unsigned from)
+{
+    for (unsigned i = from; i < g_timing_count; ++i) {
+        for (unsigned j = i + 1; j < g_timing_count; ++j) {
+            if (g_timing_stages[j].end < g_timing_stages[i].end) {
+                InvokerTiming tmp = g_timing_stages[i];
+                g_timing_stages[i] = g_timing_stages[j];
+                g_timing_stages[j] = tmp;
+            }
+        }
+    }
+
+    if (!g_timing_printed)
+        fprintf(stderr, "%-12s %10s %10s %7s %7s %7s %7s\n", "stage", "end ms",
+                "took ms", "minflt", "majflt", "nvcsw", "nivcsw");
+    g_timing_printed = true;
+
+    // Times are relative to the start of the invoker process
+    uint64_t origin = g_timing_stages[0].begin;
+    for (unsigned i = from; i < g_timing_count; ++i) {
+        const InvokerTiming *timing = &g_timing_stages[i];
+        fprintf(stderr, "%-12s %10.3f %10.3f %7u %7u %7u %7u\n",
+                timing_stage_name(timing->stage),
+                (timing->end - origin) / 1e6, (timing->end - timing->begin) / 1e6,
+                timing->minorFaults, timing->majorFaults,
+                timing->voluntarySwitches, timing->involuntarySwitches);
+    }
+}
+
+// Receives stages after INVOKER_MSG_TIMING, they are printed
+// once the booster has sent the last stage before main()
+static void invoker_recv_timing(int fd)
+{
+    uint32_t count = 0;
+    if (!invoke_recv_msg(fd, &count) || count > INVOKER_TIMING_MAX_STAGES)
+        die(1, "Received bad timing (%u stages)\n", count);
+
+    unsigned first = g_timing_count;
+    bool last = false;
+    for (uint32_t i = 0; i < count; ++i) {
+        InvokerTiming timing;
+        if (read(fd, &timing, sizeof timing) != sizeof timing)
+            die(1, "Receiving timing failed\n");
+        if (g_timing_count < sizeof g_timing_stages / sizeof *g_timing_stages)
+            g_timing_stages[g_timing_count++] = timing;
+        if (timing.stage == INVOKER_TIMING_MAIN)
+            last = true;
+    }
+
+    if (last)
+        timing_print(0);
+    else if (g_timing_printed)
+        timing_print(first);
+}
+
 static bool shutdown_socket(int socket_fd)
 {
     bool disconnected = false;
@@ -399,6 +544,7 @@ static int invoker_init(const char *app_type, const char *app_name)
     }
 
     info("connected to: %s\n", sun.sun_path);
+    APPMOTOR_PROBE2(invoker_connect, sun.sun_path, fd);
     connected = true;
 
 EXIT:
@@ -427,15 +573,12 @@ static uint32_t invoker_recv_pid(int fd)
     return pid;
 }
 
-// Receives exit status of the invoked process
-static bool invoker_recv_exit(int fd, int* status)
+// Receives exit status of the invoked process after given action
+static bool invoker_recv_exit(int fd, uint32_t action, int* status)
 {
-    uint32_t action;
-
-    // Receive action.
-    bool res = invoke_recv_msg(fd, &action);
+    bool res;
 
-    if (!res || (action != INVOKER_MSG_EXIT))
+    if (action != INVOKER_MSG_EXIT)
     {
         // Boosted application process was killed somehow.
         // Let's give applauncherd process some time to cope 
@@ -451,11 +594,12 @@ static bool invoker_recv_exit(int fd, int* status)
     return res;
 }
 
-// Sends magic number / protocol version
+// Starts the launch request with magic number / protocol version,
+// following messages are collected and sent at once by invoker_send_end()
 static void invoker_send_magic(int fd, uint32_t options)
 {
-    // Send magic.
-    invoke_send_msg(fd, INVOKER_MSG_MAGIC | INVOKER_MSG_MAGIC_VERSION | options);
+    (void)fd;
+    invoke_frame_begin(INVOKER_MSG_MAGIC | INVOKER_MSG_MAGIC_VERSION | options);
 }
 
 // Sends the process name to be invoked.
@@ -505,69 +649,47 @@ static void invoker_send_ids(int fd, int uid, int gid)
     invoke_send_msg(fd, gid);
 }
 
-// Sends the environment variables
+// Sends the environment variables as one block of
+// nul terminated "name=value" strings
 static void invoker_send_env(int fd)
 {
     int i, n_vars;
+    uint32_t size = 0;
 
-    // Count environment variables.
-    for (n_vars = 0; environ[n_vars] != NULL; n_vars++) ;
+    // Count environment variables and their size.
+    for (n_vars = 0; environ[n_vars] != NULL; n_vars++)
+        size += strlen(environ[n_vars]) + 1;
 
-    invoke_send_msg(fd, INVOKER_MSG_ENV);
+    invoke_send_msg(fd, INVOKER_MSG_ENV_BLOCK);
     invoke_send_msg(fd, n_vars);
+    invoke_send_msg(fd, size);
 
     for (i = 0; i < n_vars; i++)
     {
-        invoke_send_str(fd, environ[i]);
+        invoke_send_data(fd, environ[i], strlen(environ[i]) + 1);
     }
 
     return;
 }
 
-// Sends I/O descriptors
+// Sends I/O descriptors, the descriptors themselves are attached to the frame
 static void invoker_send_io(int fd)
 {
-    struct msghdr msg;
-    struct cmsghdr *cmsg = NULL;
-    int io[3] = { 0, 1, 2 };
-    char buf[CMSG_SPACE(sizeof(io))];
-    struct iovec iov;
-    int dummy;
-
-    memset(&msg, 0, sizeof(struct msghdr));
-
-    iov.iov_base = &dummy;
-    iov.iov_len = 1;
-
-    msg.msg_iov = &iov;
-    msg.msg_iovlen = 1;
-    msg.msg_control = buf;
-    msg.msg_controllen = sizeof(buf);
-
-    cmsg = CMSG_FIRSTHDR(&msg);
-    cmsg->cmsg_len = CMSG_LEN(sizeof(io));
-    cmsg->cmsg_level = SOL_SOCKET;
-    cmsg->cmsg_type = SCM_RIGHTS;
-
-    memcpy(CMSG_DATA(cmsg), io, sizeof(io));
-
-    msg.msg_controllen = cmsg->cmsg_len;
-
     invoke_send_msg(fd, INVOKER_MSG_IO);
-    if (sendmsg(fd, &msg, 0) < 0)
-    {
-        warning("sendmsg failed in invoker_send_io: %s \n", strerror(errno));
-    }
-
-    return;
 }
 
-// Sends the END message
+// Sends the END message and with it the whole launch request
 static void invoker_send_end(int fd)
 {
+    int io[3] = { 0, 1, 2 };
+
     invoke_send_msg(fd, INVOKER_MSG_END);
+    invoke_send_frame(fd, io, 3);
+    timing_mark(INVOKER_TIMING_SEND);
+    APPMOTOR_PROBE1(invoker_send_end, fd);
     invoke_recv_ack(fd);
-
+    timing_mark(INVOKER_TIMING_ACK);
+    APPMOTOR_PROBE1(invoker_ack, fd);
 }
 
 // Prints the usage and exits with given status
@@ -595,7 +717,8 @@ static void usage(int status)
            "  -A, --auto-application Get application booster name from binary\n"
            "  -d, --delay SECS       After invoking sleep for SECS seconds\n"
            "                         (default %d).\n"
-           "  -r, --respawn SECS     After invoking respawn new booster after SECS seconds\n"
+           "  -r, --respawn SECS     After invoking respawn new booster after at most SECS\n"
+           "                         seconds, sooner if the system is idle\n"
            "                         (default %d, max %d).\n"
            "  -w, --wait-term        Wait for launched process to terminate (default).\n"
            "  -n, --no-wait          Do not wait for launched process to terminate.\n"
@@ -614,6 +737,9 @@ static void usage(int status)
            "                         If this is not defined, it's guessed from binary name.\n"
            "  -h, --help             Print this help.\n"
            "  -v, --verbose          Make invoker more verbose. Can be given several times.\n"
+           "  -m, --timing           Print how long the stages of the launch took in the\n"
+           "                         invoker, booster and daemon, with the page faults\n"
+           "                         and context switches of each stage.\n"
            "\n"
            "Example: %s --type=cutefish /usr/bin/helloworld\n"
            "\n",
@@ -683,7 +809,16 @@ static int wait_for_launched_process_to_exit(int socket_fd)
 
         // Check if we got exit status from the invoked application
         if (FD_ISSET(socket_fd, &readfds)) {
-            if (!invoker_recv_exit(socket_fd, &exit_status)) {
+            uint32_t action = 0;
+            invoke_recv_msg(socket_fd, &action);
+
+            // Launch timing is sent before the application starts
+            if (action == INVOKER_MSG_TIMING) {
+                invoker_recv_timing(socket_fd);
+                continue;
+            }
+
+            if (!invoker_recv_exit(socket_fd, action, &exit_status)) {
                 // connection to application was lost
                 exit_status = EXIT_FAILURE;
             } else {
@@ -789,14 +924,62 @@ static int invoke_remote(int socket_fd, const InvokeArgs *args)
     if (args->wait_term) {
         exit_status = wait_for_launched_process_to_exit(socket_fd),
             socket_fd = -1;
+    } else if (g_timing) {
+        // Booster closes the connection once it has sent the timing
+        uint32_t action = 0;
+        while (invoke_recv_msg(socket_fd, &action) && action == INVOKER_MSG_TIMING)
+            invoker_recv_timing(socket_fd);
     }
 
+    // Whatever was received if the application did not start
+    if (g_timing && !g_timing_printed)
+        timing_print(0);
+
     if (socket_fd != -1)
         close(socket_fd);
 
     return exit_status;
 }
 
+// Counts a launch without booster for the metrics of the daemon, if
+// the daemon has created its socket root in XDG_RUNTIME_DIR
+static void invoker_record_fallback(void)
+{
+    const char *runtimeDir = getenv("XDG_RUNTIME_DIR");
+    if (!runtimeDir || !*runtimeDir)
+        return;
+
+    char path[PATH_MAX];
+    int length = snprintf(path, sizeof path, "%s/mapplauncherd", runtimeDir);
+    if (length <= 0 || length >= (int)sizeof path)
+        return;
+
+    // Only a private directory of our own, nobody else may plant
+    // the counter there
+    struct stat st;
+    if (lstat(path, &st) == -1 || !S_ISDIR(st.st_mode) ||
+        st.st_uid != geteuid() || (st.st_mode & 0777) != 0700)
+        return;
+
+    length = snprintf(path, sizeof path, "%s/mapplauncherd/" INVOKER_FALLBACKS_FILE, runtimeDir);
+    if (length <= 0 || length >= (int)sizeof path)
+        return;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd == -1)
+        return;
+
+    uint64_t count = 0;
+    if (flock(fd, LOCK_EX) == 0) {
+        if (pread(fd, &count, sizeof count, 0) != sizeof count)
+            count = 0;
+        count++;
+        if (pwrite(fd, &count, sizeof count, 0) != sizeof count)
+            info("can't count fallback launch: %m\n");
+    }
+    close(fd);
+}
+
 static void invoke_fallback(const InvokeArgs *args)
 {
     // Connection with launcher is broken,
@@ -804,6 +987,8 @@ static void invoke_fallback(const InvokeArgs *args)
     warning("Connection with launcher process is broken. \n");
     error("Start application %s as a binary executable without launcher...\n", args->prog_name);
 
+    invoker_record_fallback();
+
     // Fork if wait_term not set
     if (!args->wait_term)
     {
@@ -874,6 +1059,8 @@ static int invoke(InvokeArgs *args)
     }
 
     if (fd != -1) {
+        timing_mark(INVOKER_TIMING_CONNECT);
+
         /* "normal" invoke through a socket connetion */
         status = invoke_remote(fd, args),
             fd = -1;
@@ -933,6 +1120,7 @@ int main(int argc, char *argv[])
         {"desktop-file",     required_argument, NULL, 'F'},
         {"id",               required_argument, NULL, 'I'},
         {"verbose",          no_argument,       NULL, 'v'},
+        {"timing",           no_argument,       NULL, 'm'},
         {0, 0, 0, 0}
     };
 
@@ -940,7 +1128,7 @@ int main(int argc, char *argv[])
     // The use of + for POSIXLY_CORRECT behavior is a GNU extension, but avoids polluting
     // the environment
     int opt;
-    while ((opt = getopt_long(argc, argv, "+hvcwnGDsoTd:t:a:Ar:S:L:F:I:", longopts, NULL)) != -1)
+    while ((opt = getopt_long(argc, argv, "+hvcwnGDsoTmd:t:a:Ar:S:L:F:I:", longopts, NULL)) != -1)
     {
         switch(opt)
         {
@@ -1016,6 +1204,11 @@ int main(int argc, char *argv[])
             args.sandboxing_id = strdup(optarg);
             break;
 
+        case 'm':
+            g_timing = true;
+            args.magic_options |= INVOKER_MSG_MAGIC_OPTION_TIMING;
+            break;
+
         case '?':
             usage(1);
         }
@@ -1023,6 +1216,9 @@ int main(int argc, char *argv[])
 
     // Option processing stops as soon as application name is encountered
 
+    if (g_timing)
+        timing_start();
+
     args.prog_argc = argc - optind;
     args.prog_argv = &argv[optind];
 
@@ -1034,6 +1230,7 @@ int main(int argc, char *argv[])
     // Force argv[0] of application to be the absolute path to allow the
     // application to find out its installation directory from there
     args.prog_argv[0] = search_program(args.prog_argv[0]);
+    timing_mark(INVOKER_TIMING_SEARCH);
 
     // Check if application exists
     struct stat file_stat;
@@ -25,11 +25,13 @@
 #include <fstream>
 #include <dirent.h>
 #include <string.h>
+#include <utility>
 
 AppData::AppData() :
     m_options(0),
     m_argc(0),
     m_argv(NULL),
+    m_arena(),
     m_appName(""),
     m_fileName(""),
     m_prio(0),
@@ -70,6 +72,11 @@ bool AppData::disableOutOfMemAdj() const
     return (m_options & INVOKER_MSG_MAGIC_OPTION_OOM_ADJ_DISABLE) != 0;
 }
 
+bool AppData::reportTiming() const
+{
+    return (m_options & INVOKER_MSG_MAGIC_OPTION_TIMING) != 0;
+}
+
 void AppData::setArgc(int newArgc)
 {
     (void)newArgc; // unused
@@ -84,30 +91,42 @@ int AppData::argc() const
 
 void AppData::setArgv(const char ** newArgv)
 {
-    for (int i = 0; i < m_argc; ++i)
-        free(m_argv[i]);
-    free(m_argv);
-    m_argc = 0;
-    m_argv = nullptr;
+    // Copy to a new arena first, newArgv may point to the current one
+    Arena arena;
+    char **argv = nullptr;
 
     if (newArgv) {
-        while (newArgv[m_argc])
+        int argc = 0;
+        while (newArgv[argc])
+            ++argc;
+        argv = (char **)arena.allocate((argc + 1) * sizeof *argv);
+        for (int i = 0; i < argc; ++i)
+            argv[i] = arena.strdup(newArgv[i]);
+        argv[argc] = nullptr;
+    }
+
+    setArgv(argv, std::move(arena));
+}
+
+void AppData::setArgv(char ** newArgv, Arena && arena)
+{
+    m_arena = std::move(arena);
+    m_argv = newArgv;
+    m_argc = 0;
+
+    if (m_argv) {
+        while (m_argv[m_argc])
             ++m_argc;
-        m_argv = (char **)calloc(m_argc + 1, sizeof *m_argv);
-        for (int i = 0; i < m_argc; ++i)
-            m_argv[i] = strdup(newArgv[i]);
-        m_argv[m_argc] = nullptr;
     }
 }
 
 void AppData::prependArgv(const char * arg)
 {
     char **oldArgv = m_argv;
-    m_argv = (char **)calloc(++m_argc + 1, sizeof *m_argv);
-    m_argv[0] = strdup(arg);
+    m_argv = (char **)m_arena.allocate((++m_argc + 1) * sizeof *m_argv);
+    m_argv[0] = m_arena.strdup(arg);
     for (int i = 1; i < m_argc + 1; ++i)
-        m_argv[i] = oldArgv[i-1];
-    free(oldArgv);
+        m_argv[i] = oldArgv ? oldArgv[i-1] : nullptr;
 }
 
 const char ** AppData::argv() const
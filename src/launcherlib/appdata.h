@@ -21,6 +21,7 @@
 #define APPDATA_H
 
 #include "launcherlib.h"
+#include "arena.h"
 #include <stdint.h>
 #include <sys/types.h>
 
@@ -63,15 +64,23 @@ public:
     //! Return whether or not disable default out of memory killing adjustments for application process 
     bool disableOutOfMemAdj() const;
 
+    //! Return whether or not the invoker wants to know how long the launch stages took
+    bool reportTiming() const;
+
     //! Set argument count
     void setArgc(int argc);
 
     //! Return argument count
     int argc() const;
 
-    //! Set address of the argument vector
+    //! Set address of the argument vector, the arguments are copied
     void setArgv(const char ** argv);
 
+    /*! \brief Take over an argument vector allocated from given arena.
+     * The arena is moved to AppData and released with the arguments.
+     */
+    void setArgv(char ** argv, Arena && arena);
+
     //! Prepend to argv
     void prependArgv(const char *arg);
 
@@ -138,6 +147,7 @@ private:
     uint32_t    m_options;
     int         m_argc;
     char      **m_argv;
+    Arena       m_arena;
     string      m_appName;
     string      m_fileName;
     int         m_prio;
@@ -0,0 +1,100 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#include "arena.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+namespace
+{
+    const size_t ALIGNMENT = alignof(std::max_align_t);
+
+    size_t align(size_t size)
+    {
+        return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    }
+}
+
+Arena::Arena(size_t blockSize) :
+    m_blocks(NULL),
+    m_blockSize(blockSize)
+{
+}
+
+Arena::Arena(Arena &&other) :
+    m_blocks(other.m_blocks),
+    m_blockSize(other.m_blockSize)
+{
+    other.m_blocks = NULL;
+}
+
+Arena & Arena::operator= (Arena &&other)
+{
+    if (this != &other) {
+        clear();
+        m_blocks = other.m_blocks;
+        m_blockSize = other.m_blockSize;
+        other.m_blocks = NULL;
+    }
+    return *this;
+}
+
+Arena::~Arena()
+{
+    clear();
+}
+
+void *Arena::allocate(size_t size)
+{
+    const size_t header = align(sizeof(Block));
+    size = align(size ? size : 1);
+
+    if (!m_blocks || m_blocks->size - m_blocks->used < size) {
+        // A large allocation gets a block of its own with the usual
+        // room left, so that the small ones after it still fit
+        size_t blockSize = size > m_blockSize ? size + m_blockSize : m_blockSize;
+        Block *block = static_cast<Block *>(malloc(header + blockSize));
+        if (!block)
+            throw std::bad_alloc();
+
+        block->next = m_blocks;
+        block->size = blockSize;
+        block->used = 0;
+        m_blocks = block;
+    }
+
+    char *data = reinterpret_cast<char *>(m_blocks) + header + m_blocks->used;
+    m_blocks->used += size;
+    return data;
+}
+
+char *Arena::strdup(const char *str)
+{
+    size_t size = strlen(str) + 1;
+    char *copy = static_cast<char *>(allocate(size));
+    memcpy(copy, str, size);
+    return copy;
+}
+
+void Arena::clear()
+{
+    while (m_blocks) {
+        Block *next = m_blocks->next;
+        free(m_blocks);
+        m_blocks = next;
+    }
+}
@@ -0,0 +1,88 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "launcherlib.h"
+
+#include <cstddef>
+
+/*!
+ * \class Arena
+ * \brief Memory of one launch request.
+ *
+ * Allocations are carved out of large blocks and released all at once
+ * when the arena is cleared or destroyed. Pointers stay valid until
+ * then, also when the arena grows or is moved to another owner. The
+ * Connection parses a launch request into an arena and AppData takes
+ * it over together with the argument vector pointing into it.
+ */
+class DECL_EXPORT Arena
+{
+public:
+
+    //! Create an empty arena, memory is allocated in blocks of at least blockSize
+    explicit Arena(size_t blockSize = DEFAULT_BLOCK_SIZE);
+
+    //! Move constructor, other is left empty
+    Arena(Arena &&other);
+
+    //! Release the current memory and take over the memory of other
+    Arena & operator= (Arena &&other);
+
+    //! Destructor
+    ~Arena();
+
+    //! Return size bytes suitably aligned for any type
+    void *allocate(size_t size);
+
+    //! Return a copy of str
+    char *strdup(const char *str);
+
+    //! Release all memory
+    void clear();
+
+    //! Default size of a block
+    static const size_t DEFAULT_BLOCK_SIZE = 4096;
+
+private:
+
+    //! Disable copy-constructor
+    Arena(const Arena & r);
+
+    //! Disable assignment operator
+    Arena & operator= (const Arena & r);
+
+    //! Header of a block, the memory follows it
+    struct Block
+    {
+        Block  *next;
+        size_t  size;
+        size_t  used;
+    };
+
+    //! Blocks, the one allocated from first
+    Block *m_blocks;
+
+    //! Minimum size of a block
+    size_t m_blockSize;
+
+#ifdef UNIT_TEST
+    friend class Ut_Arena;
+#endif
+};
+
+#endif // ARENA_H
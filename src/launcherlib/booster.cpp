@@ -22,11 +22,14 @@
 #include "booster.h"
 #include "daemon.h"
 #include "connection.h"
+#include "elfinfo.h"
 #include "singleinstance.h"
 #include "socketmanager.h"
 #include "logger.h"
+#include "probes.h"
 #include "report.h"
 
+#include <climits>
 #include <cstdlib>
 #include <dlfcn.h>
 #include <cerrno>
@@ -35,6 +38,7 @@
 #include <sys/user.h>
 #include <sys/prctl.h>
 #include <sys/resource.h>
+#include <time.h>
 #include <fcntl.h>
 #include <cstring>
 #include <sstream>
@@ -42,6 +46,7 @@
 #include <syslog.h>
 #include <dirent.h>
 #include <algorithm>
+#include <poll.h>
 
 #include <fstream>
 
@@ -67,12 +72,26 @@ Booster::Booster() :
     m_oldPriorityOk(false),
     m_spaceAvailable(0),
     m_boostedApplication("default"),
-    m_bootMode(false)
+    m_bootMode(false),
+    m_launchMissed(false),
+    m_warmupLevel(WarmupNone),
+    m_bootWarmupLevel(WarmupNone),
+    m_upgradeSocket(-1),
+    m_applicationModule(NULL),
+    m_applicationEntry(NULL),
+    m_timingFd(-1),
+    m_handshakeTime(0)
 {
 }
 
 Booster::~Booster()
 {
+    if (m_upgradeSocket != -1)
+        close(m_upgradeSocket);
+
+    if (m_timingFd != -1)
+        close(m_timingFd);
+
     delete m_connection;
     m_connection = NULL;
 
@@ -88,12 +107,8 @@ void Booster::initialize(int initialArgc, char ** initialArgv, int newBoosterLau
 
     setBoosterLauncherSocket(newBoosterLauncherSocket);
 
-    // Drop priority (nice = 10)
-    pushPriority(10);
-
-    // Preload stuff
-    if (!m_bootMode)
-        preload();
+    // Preload stuff, only partially in boot mode
+    warmUpAndReport(m_bootMode ? m_bootWarmupLevel : WarmupFull);
 
     // Rename process to temporary booster process name
     std::string temporaryProcessName = "booster [";
@@ -102,15 +117,22 @@ void Booster::initialize(int initialArgc, char ** initialArgv, int newBoosterLau
     const char * tempArgv[] = {temporaryProcessName.c_str()};
     renameProcess(initialArgc, initialArgv, 1, tempArgv);
 
-    // Restore priority
-    popPriority();
+    // If an invoker is already queued on the socket by the time this
+    // booster is ready, there was no spare booster waiting for it.
+    struct pollfd pfd = { socketFd, POLLIN, 0 };
+    m_launchMissed = poll(&pfd, 1, 0) > 0;
 
     while (true)
     {
         // Wait and read commands from the invoker
         Logger::logDebug("Booster: Wait for message from invoker");
-        if (!receiveDataFromInvoker(socketFd))
+        waitForInvoker(socketFd);
+        if (!receiveDataFromInvoker(socketFd)) {
+            // Another booster accepted the invoker first
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                continue;
             throw std::runtime_error("Booster: Couldn't read command\n");
+        }
 
         // Run process as single instance if requested
         if (m_appData->singleInstance())
@@ -152,9 +174,16 @@ void Booster::initialize(int initialArgc, char ** initialArgv, int newBoosterLau
         break;
     }
 
+    // No more warm-up requests once an application is being launched
+    if (m_upgradeSocket != -1) {
+        close(m_upgradeSocket);
+        m_upgradeSocket = -1;
+    }
+
     // Send parent process a message that it can create a new booster,
     // send pid of invoker, booster respawn value and invoker socket connection.
     sendDataToParent();
+    markLaunchStage(INVOKER_TIMING_PARENT);
 
     // Give the process the real application name now that it
     // has been read from invoker in receiveDataFromInvoker().
@@ -169,16 +198,148 @@ void Booster::initialize(int initialArgc, char ** initialArgv, int newBoosterLau
     prctl(PR_SET_PDEATHSIG, 0);
 }
 
+void Booster::initializeTemplate(int initialArgc, char ** initialArgv)
+{
+    // Rename process to template process name
+    std::string templateProcessName = "booster-template [";
+    templateProcessName += boosterType();
+    templateProcessName += "]";
+    const char * tempArgv[] = {templateProcessName.c_str()};
+    renameProcess(initialArgc, initialArgv, 1, tempArgv);
+
+    warmUpTo(WarmupLibraries);
+}
+
 bool Booster::bootMode() const
 {
     return m_bootMode;
 }
 
+void Booster::setBootWarmupLevel(WarmupLevel level)
+{
+    m_bootWarmupLevel = level;
+}
+
+Booster::WarmupLevel Booster::warmupLevel() const
+{
+    return m_warmupLevel;
+}
+
+void Booster::setUpgradeSocket(int upgradeSocket)
+{
+    if (m_upgradeSocket != -1)
+        close(m_upgradeSocket);
+    m_upgradeSocket = upgradeSocket;
+}
+
+bool Booster::warmUp(WarmupLevel level)
+{
+    switch (level) {
+    case WarmupLibraries:
+        return preloadTemplate();
+    case WarmupFull:
+        return preload();
+    default:
+        return true;
+    }
+}
+
+void Booster::warmUpTo(WarmupLevel level)
+{
+    if (m_warmupLevel >= level)
+        return;
+
+    // Drop priority (nice = 10)
+    pushPriority(10);
+
+    while (m_warmupLevel < level) {
+        WarmupLevel next = static_cast<WarmupLevel>(m_warmupLevel + 1);
+        Logger::logDebug("Booster: warming up to level %d", next);
+        if (!warmUp(next))
+            Logger::logWarning("Booster: warm-up level %d failed", next);
+        m_warmupLevel = next;
+    }
+
+    // Application specific boosters load the application last,
+    // so that it finds everything it needs already in place
+    if (m_warmupLevel == WarmupFull && !m_applicationBinary.empty() && !m_applicationModule)
+        preloadApplication();
+
+    // Restore priority
+    popPriority();
+}
+
+void Booster::waitForInvoker(int socketFd)
+{
+    while (m_upgradeSocket != -1) {
+        struct pollfd pfd[2] = {
+            { socketFd, POLLIN, 0 },
+            { m_upgradeSocket, POLLIN, 0 },
+        };
+        if (poll(pfd, 2, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            Logger::logWarning("Booster: poll failed: %s", strerror(errno));
+            return;
+        }
+
+        // Serving an invoker takes precedence over warming up
+        if (pfd[0].revents)
+            return;
+
+        if (pfd[1].revents)
+            readUpgradeRequest();
+    }
+
+    // Without upgrade socket there is only the invoker to wait for
+    struct pollfd pfd = { socketFd, POLLIN, 0 };
+    while (poll(&pfd, 1, -1) == -1 && errno == EINTR)
+        ;
+}
+
+void Booster::readUpgradeRequest()
+{
+    int level = WarmupNone;
+    ssize_t rc = recv(m_upgradeSocket, &level, sizeof level, MSG_DONTWAIT);
+    if (rc == -1 && (errno == EAGAIN || errno == EINTR))
+        return;
+
+    if (rc != sizeof level) {
+        // Parent went away, keep serving invokers at the current level
+        close(m_upgradeSocket);
+        m_upgradeSocket = -1;
+        return;
+    }
+
+    if (level > m_warmupLevel && level <= WarmupFull) {
+        Logger::logDebug("Booster: upgrading in place from level %d to %d", m_warmupLevel, level);
+        warmUpAndReport(static_cast<WarmupLevel>(level));
+    }
+}
+
+void Booster::warmUpAndReport(WarmupLevel level)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    warmUpTo(level);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (m_upgradeSocket == -1)
+        return;
+
+    // Parent shows the report in its status, losing it is harmless
+    WarmupReport report;
+    report.level = m_warmupLevel;
+    report.microseconds = (end.tv_sec - start.tv_sec) * 1000000 +
+                          (end.tv_nsec - start.tv_nsec) / 1000;
+    send(m_upgradeSocket, &report, sizeof report, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
 void Booster::sendDataToParent()
 {
     // Number of data items to be sent to
     // the parent (launcher) process
-    const unsigned int NUM_DATA_ITEMS = 2;
+    const unsigned int NUM_DATA_ITEMS = 7;
 
     struct iovec    iov[NUM_DATA_ITEMS];
     struct msghdr   msg;
@@ -189,6 +350,7 @@ void Booster::sendDataToParent()
     // waiting booster process and close write end
     // Send to the parent process pid of invoker for tracking
     pid_t pid = invokersPid();
+    APPMOTOR_PROBE2(booster_send_parent, pid, m_appData->fileName().c_str());
     iov[0].iov_base = &pid;
     iov[0].iov_len  = sizeof(pid_t);
 
@@ -197,6 +359,32 @@ void Booster::sendDataToParent()
     iov[1].iov_base = &delay;
     iov[1].iov_len  = sizeof(int);
 
+    // Send own pid so that the parent knows which of the
+    // spare boosters got used
+    pid_t boosterPid = getpid();
+    iov[2].iov_base = &boosterPid;
+    iov[2].iov_len  = sizeof(pid_t);
+
+    // Send whether the invoker had to wait for a booster
+    int missed = m_launchMissed;
+    iov[3].iov_base = &missed;
+    iov[3].iov_len  = sizeof(int);
+
+    // Send whether the invoker wants timing of the launch stages
+    int timing = m_appData->reportTiming();
+    iov[4].iov_base = &timing;
+    iov[4].iov_len  = sizeof(int);
+
+    // Send how long receiving the launch request took
+    unsigned int handshakeTime = m_handshakeTime;
+    iov[5].iov_base = &handshakeTime;
+    iov[5].iov_len  = sizeof(unsigned int);
+
+    // Send path of the binary for recording its launch profile
+    const string &fileName = m_appData->fileName();
+    iov[6].iov_base = const_cast<char *>(fileName.c_str());
+    iov[6].iov_len  = fileName.size() < PATH_MAX ? fileName.size() + 1 : 0;
+
     msg.msg_iov     = iov;
     msg.msg_iovlen  = NUM_DATA_ITEMS;
     msg.msg_name    = NULL;
@@ -218,13 +406,13 @@ void Booster::sendDataToParent()
         cmsg->cmsg_type    = SCM_RIGHTS;
         cmsg->cmsg_len     = CMSG_LEN(sizeof(int));
         memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
-        debug("send to daemon: pid=%d delay=%d fd=%d", (int)pid, delay, fd);
+        debug("send to daemon: pid=%d delay=%d fd=%d missed=%d", (int)pid, delay, fd, missed);
     }
     else
     {
         msg.msg_control    = NULL;
         msg.msg_controllen = 0;
-        debug("send to daemon: pid=%d delay=%d fd=NA", (int)pid, delay);
+        debug("send to daemon: pid=%d delay=%d fd=NA missed=%d", (int)pid, delay, missed);
     }
 
     if (sendmsg(boosterLauncherSocket(), &msg, 0) < 0)
@@ -246,15 +434,31 @@ bool Booster::receiveDataFromInvoker(int socketFd)
     // Setup the conversation channel with the invoker.
     m_connection = new Connection(socketFd);
 
+    if (m_timingFd != -1)
+    {
+        close(m_timingFd);
+        m_timingFd = -1;
+    }
+
     // Accept a new invocation.
     if (m_connection->accept(m_appData))
     {
+        m_launchTiming.start();
+
         // Receive application data from the invoker
         if (!m_connection->receiveApplicationData(m_appData))
         {
             m_connection->close();
             return false;
         }
+        m_handshakeTime = m_launchTiming.elapsed() / 1000;
+
+        // The connection itself may be closed before the application starts
+        if (m_appData->reportTiming())
+        {
+            m_timingFd = fcntl(m_connection->getFd(), F_DUPFD_CLOEXEC, 0);
+            markLaunchStage(INVOKER_TIMING_REQUEST);
+        }
 
         // Close the connection if exit status doesn't need
         // to be sent back to invoker
@@ -440,6 +644,8 @@ early:
 
 void Booster::setEnvironmentBeforeLaunch()
 {
+    APPMOTOR_PROBE1(booster_environment_start, m_appData->fileName().c_str());
+
     // Possibly restore process priority
     errno = 0;
     const int cur_prio = getpriority(PRIO_PROCESS, 0);
@@ -489,14 +695,24 @@ void Booster::setEnvironmentBeforeLaunch()
     }
 
     Logger::logDebug("Booster: launching process: '%s' ", m_appData->fileName().c_str());
+
+    APPMOTOR_PROBE1(booster_environment_end, m_appData->fileName().c_str());
+    markLaunchStage(INVOKER_TIMING_ENVIRONMENT);
 }
 
 int Booster::launchProcess()
 {
     setEnvironmentBeforeLaunch();
 
+    // The dynamic loader would return the stale preloaded object for a
+    // binary changed on disk, whether it was replaced or rewritten in
+    // place, and loading a second copy would run its constructors twice
+    if (applicationReplaced(m_appData->fileName()))
+        return execProcess();
+
     // Load the application and find out the address of main()
     loadMain();
+    markLaunchStage(INVOKER_TIMING_LOAD);
 
     // make booster specific initializations unless booster is in boot mode
     if (!m_bootMode)
@@ -509,9 +725,17 @@ int Booster::launchProcess()
     // Close syslog
     closelog();
 
+    markLaunchStage(INVOKER_TIMING_MAIN);
+    sendLaunchTiming();
+
     // Jump to main()
+    APPMOTOR_PROBE2(booster_main, m_appData->fileName().c_str(), m_appData->argc());
     const int retVal = m_appData->entry()(m_appData->argc(), const_cast<char **>(m_appData->argv()));
 
+    // The booster process is left with _exit(), which would
+    // discard output still buffered by the application
+    fflush(NULL);
+
 #ifdef WITH_COVERAGE
     __gcov_flush();
 #endif
@@ -521,6 +745,16 @@ int Booster::launchProcess()
 
 void* Booster::loadMain()
 {
+    // Application loaded already while warming up
+    if (applicationPreloaded(m_appData->fileName())) {
+        // Symbols were loaded local, promote them if wanted
+        if (m_appData->dlopenGlobal())
+            dlopen(m_appData->fileName().c_str(), RTLD_LAZY | RTLD_GLOBAL | RTLD_NOLOAD);
+
+        m_appData->setEntry(m_applicationEntry);
+        return m_applicationModule;
+    }
+
     // Setup flags for dlopen
 
     int dlopenFlags = RTLD_LAZY;
@@ -536,7 +770,9 @@ void* Booster::loadMain()
 #endif
 
     // Load the application as a library
+    APPMOTOR_PROBE2(booster_dlopen_start, m_appData->fileName().c_str(), dlopenFlags);
     void * module = dlopen(m_appData->fileName().c_str(), dlopenFlags);
+    APPMOTOR_PROBE2(booster_dlopen_end, m_appData->fileName().c_str(), module);
 
     if (!module)
         throw std::runtime_error(std::string("Booster: Loading invoked application failed: '") +
@@ -557,6 +793,119 @@ void* Booster::loadMain()
     return module;
 }
 
+void Booster::preloadApplication()
+{
+    if (!canLoadApplication(m_applicationBinary)) {
+        Logger::logDebug("Booster: not preloading '%s', it can't be loaded with dlopen",
+                         m_applicationBinary.c_str());
+        return;
+    }
+
+    // Binary must not change while it is being loaded
+    string identity = fileIdentity(m_applicationBinary);
+    void *module = dlopen(m_applicationBinary.c_str(), RTLD_LAZY | RTLD_LOCAL);
+    if (!module) {
+        Logger::logWarning("Booster: preloading '%s' failed: %s", m_applicationBinary.c_str(), dlerror());
+        return;
+    }
+
+    dlerror();
+    entry_t entry = reinterpret_cast<entry_t>(dlsym(module, "main"));
+    const char *error = dlerror();
+    if (error || !entry || identity.empty() || identity != fileIdentity(m_applicationBinary)) {
+        Logger::logWarning("Booster: preloading '%s' failed: %s", m_applicationBinary.c_str(),
+                           error ? error : "binary changed while loading");
+        // Not closed, constructors of the application have already run
+        return;
+    }
+
+    m_applicationModule = module;
+    m_applicationEntry = entry;
+    m_applicationIdentity = identity;
+    Logger::logDebug("Booster: preloaded '%s'", m_applicationBinary.c_str());
+}
+
+bool Booster::canLoadApplication(const string &fileName) const
+{
+    // glibc does not dlopen() executables flagged as PIE
+    ElfInfo elf(fileName);
+    return elf.isDynamic() && !elf.isPieExecutable() && elf.exportsFunction("main");
+}
+
+bool Booster::applicationPreloaded(const string &fileName) const
+{
+    return m_applicationModule && fileName == m_applicationBinary &&
+           fileIdentity(fileName) == m_applicationIdentity;
+}
+
+bool Booster::applicationReplaced(const string &fileName) const
+{
+    if (!m_applicationModule || fileName != m_applicationBinary ||
+        fileIdentity(fileName) == m_applicationIdentity)
+        return false;
+
+    // E.g. updated by the package manager after the booster started
+    Logger::logInfo("Booster: '%s' has changed on disk, starting it with exec()",
+                    fileName.c_str());
+    return true;
+}
+
+int Booster::execProcess()
+{
+    // Ensure a NULL-terminated argv
+    const int argc = m_appData->argc();
+    char ** dummyArgv = new char * [argc + 1];
+    for (int i = 0; i < argc; i++)
+        dummyArgv[i] = strdup(m_appData->argv()[i]);
+
+    dummyArgv[argc] = NULL;
+
+    markLaunchStage(INVOKER_TIMING_MAIN);
+    sendLaunchTiming();
+
+    // Exec the binary (execv returns only in case of an error).
+    APPMOTOR_PROBE2(booster_exec, m_appData->fileName().c_str(), argc);
+    execv(m_appData->fileName().c_str(), dummyArgv);
+
+    Logger::logError("Booster: exec of '%s' failed: %m", m_appData->fileName().c_str());
+
+    // Delete dummy argv if execv failed
+    for (int i = 0; i < argc; i++)
+        free(dummyArgv[i]);
+
+    delete [] dummyArgv;
+
+    return EXIT_FAILURE;
+}
+
+string Booster::fileIdentity(const string &path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) == -1)
+        return string();
+
+    std::ostringstream identity;
+    identity << st.st_dev << ':' << st.st_ino << ':' << st.st_size << ':'
+             << st.st_mtim.tv_sec << '.' << st.st_mtim.tv_nsec;
+    return identity.str();
+}
+
+void Booster::markLaunchStage(uint32_t stage)
+{
+    if (m_timingFd != -1)
+        m_launchTiming.mark(stage);
+}
+
+void Booster::sendLaunchTiming()
+{
+    if (m_timingFd == -1)
+        return;
+
+    m_launchTiming.send(m_timingFd);
+    close(m_timingFd);
+    m_timingFd = -1;
+}
+
 bool Booster::pushPriority(int nice)
 {
     errno = 0;
@@ -623,6 +972,16 @@ void Booster::setBoostedApplication(const string &application)
         m_boostedApplication = filtered;
 }
 
+void Booster::setApplicationBinary(const string &path)
+{
+    m_applicationBinary = path;
+}
+
+const string &Booster::applicationBinary() const
+{
+    return m_applicationBinary;
+}
+
 const string Booster::socketId() const
 {
     string id;
@@ -30,6 +30,7 @@
 using std::string;
 
 #include "appdata.h"
+#include "launchtiming.h"
 
 class Connection;
 class SocketManager;
@@ -52,6 +53,28 @@ class DECL_EXPORT Booster
 {
 public:
 
+    /*!
+     * \brief Amount of preloading done in a booster.
+     * Levels are reached in order, each one building on the previous.
+     */
+    enum WarmupLevel
+    {
+        WarmupNone,          //!< Nothing preloaded
+        WarmupLibraries,     //!< Libraries and plugins loaded, see preloadTemplate()
+        WarmupApplication,   //!< Application object created
+        WarmupQml,           //!< QML engine and common imports initialized
+        WarmupResources,     //!< Fonts, icons etc. cached
+        WarmupFull = WarmupResources
+    };
+
+    //! Sent to the parent on the upgrade socket whenever the booster is
+    //! ready to accept invokers after warming up
+    struct WarmupReport
+    {
+        int level;                  //!< WarmupLevel reached
+        unsigned int microseconds;  //!< Time the warm-up took
+    };
+
     //! Constructor
     Booster();
 
@@ -65,12 +88,22 @@ public:
      * \param boosterLauncherSocket socket connection to the parent process.
      * \param socketFd socket used to get commands from the invoker.
      * \param singleInstance Pointer to a valid SingleInstance object.
-     * \param bootMode Booster-specific preloads are not executed if true.
+     * \param bootMode Booster-specific preloads are done only up to the
+     *        boot warm-up level if true, see setBootWarmupLevel().
      */
     virtual void initialize(int initialArgc, char ** initialArgv, int boosterLauncherSocket,
                             int socketFd, SingleInstance * singleInstance,
                             bool bootMode);
 
+    /*!
+     * \brief Initializes a template process that forks warm boosters.
+     * Runs preloadTemplate() once. Boosters forked from the template
+     * do not run it again in initialize().
+     * \param initialArgc argc of the parent process.
+     * \param initialArgv argv of the parent process.
+     */
+    void initializeTemplate(int initialArgc, char ** initialArgv);
+
     /*!
      * \brief Run the application to be invoked.
      * By default, this method causes the application binary to be loaded
@@ -112,6 +145,14 @@ public:
     const string &boostedApplication() const;
     void setBoostedApplication(const string &application);
 
+    /*!
+     * \brief Set binary of the application this booster is specific to.
+     * The binary is loaded with dlopen() and its main() resolved when
+     * the booster is fully warmed up, if canLoadApplication() allows it.
+     */
+    void setApplicationBinary(const string &path);
+    const string &applicationBinary() const;
+
     const string socketId() const;
 
     //! Get invoker's pid
@@ -129,6 +170,21 @@ public:
     //! Return true, if in boot mode.
     bool bootMode() const;
 
+    //! Set warm-up level of boosters started in boot mode, WarmupNone by default
+    void setBootWarmupLevel(WarmupLevel level);
+
+    //! Return warm-up level reached so far
+    WarmupLevel warmupLevel() const;
+
+    /*!
+     * \brief Set socket for warm-up requests from the parent process.
+     * While waiting for an invoker, the booster reads WarmupLevel values
+     * (int) from the socket and warms up to the level in place. Every
+     * warm-up is answered with a WarmupReport. Booster takes the
+     * ownership of the socket.
+     */
+    void setUpgradeSocket(int upgradeSocket);
+
 protected:
 
     /*!
@@ -145,11 +201,34 @@ protected:
 
     /*!
      * \brief Preload libraries / initialize cache etc.
-     * Called from initialize if not in the boot mode.
+     * Called by the default warmUp() when WarmupFull is reached.
      * Re-implement in the custom Booster.
      */
     virtual bool preload() = 0;
 
+    /*!
+     * \brief Do the preloading of one warm-up level.
+     * Called for every level between the current and the wanted one,
+     * in order. By default WarmupLibraries runs preloadTemplate() and
+     * WarmupFull runs preload(). Re-implement to split the preloading
+     * of the custom Booster into levels.
+     */
+    virtual bool warmUp(WarmupLevel level);
+
+    /*!
+     * \brief Preload the fork-safe part of the booster state.
+     * Called once in the template process in template mode, and by the
+     * default warmUp() for WarmupLibraries otherwise. The template forks
+     * boosters without running pthread_atfork() handlers, so no other
+     * thread may be alive when this returns: threads used for loading
+     * must have been joined, see Preloader::load(), and loaded code
+     * must not leave threads running. Connections that can't be shared,
+     * e.g. to the display server, must not be opened either. Loading and
+     * relocating libraries and plugins is fine. Re-implement in the
+     * custom Booster.
+     */
+    virtual bool preloadTemplate() { return true; }
+
     /*!
      * \brief Wait for connection from invoker and read the input.
      * This method accepts a socket connection from the invoker
@@ -183,6 +262,21 @@ protected:
     //! Reset out-of-memory killer adjustment
     void resetOomAdj();
 
+    /*!
+     * \brief Return true if the binary can be loaded with dlopen().
+     * Used for the application binary of an application specific
+     * booster. By default true for shared objects that export main()
+     * and are not flagged as PIE executables. Re-implement if needed.
+     */
+    virtual bool canLoadApplication(const string &fileName) const;
+
+    //! Return true if the given binary has been loaded already with
+    //! main() resolved and has not changed on disk since then
+    bool applicationPreloaded(const string &fileName) const;
+
+    //! Run the application binary with exec(), return only on failure
+    int execProcess();
+
     //! Data structure representing the application to be invoked
     AppData* m_appData;
 
@@ -194,16 +288,45 @@ private:
     //! Disable assignment operator
     Booster & operator= (const Booster & r);
 
-    //! Send data to the parent process (invokers pid, respwan delay)
-    //! and signal that a new booster can be created.
+    //! Send data to the parent process (invokers pid, respwan delay,
+    //! own pid, pool miss, timing request) and signal that a new booster
+    //! can be created.
     void sendDataToParent();
 
     //! Helper method: load the library and find out address for "main".
     void* loadMain();
 
+    //! Load the application binary and resolve main() ahead of the launch
+    void preloadApplication();
+
+    //! Return true if the given binary has been loaded already but has
+    //! changed on disk since then
+    bool applicationReplaced(const string &fileName) const;
+
+    //! Return device, inode, size and mtime of a file as a string, empty on error
+    static string fileIdentity(const string &path);
+
+    //! Run warmUp() for the levels up to the given one with lowered priority
+    void warmUpTo(WarmupLevel level);
+
+    //! Wait for an invoker, handling warm-up requests meanwhile
+    void waitForInvoker(int socketFd);
+
+    //! Read a warm-up request from the upgrade socket and handle it
+    void readUpgradeRequest();
+
+    //! Warm up to the given level and report it on the upgrade socket
+    void warmUpAndReport(WarmupLevel level);
+
     //! Helper method: returns application name for to use for locking etc.
     std::string getFinalName(const std::string &name);
 
+    //! End a launch stage if the invoker asked for timing
+    void markLaunchStage(uint32_t stage);
+
+    //! Send the launch stages to the invoker, last thing before the application runs
+    void sendLaunchTiming();
+
     //! Socket connection to invoker
     Connection* m_connection;
 
@@ -226,6 +349,37 @@ private:
     //! True, if being run in boot mode.
     bool m_bootMode;
 
+    //! True, if an invoker was already waiting when this booster got ready
+    bool m_launchMissed;
+
+    //! Warm-up level reached so far
+    WarmupLevel m_warmupLevel;
+
+    //! Warm-up level used in boot mode
+    WarmupLevel m_bootWarmupLevel;
+
+    //! Socket for warm-up requests from the parent, -1 if none
+    int m_upgradeSocket;
+
+    //! Binary of the application this booster is specific to, empty if none
+    string m_applicationBinary;
+
+    //! Handle and main() of the preloaded application binary, NULL if not loaded
+    void *m_applicationModule;
+    entry_t m_applicationEntry;
+
+    //! fileIdentity() of the binary when it was loaded
+    string m_applicationIdentity;
+
+    //! Stages of the current launch
+    LaunchTiming m_launchTiming;
+
+    //! Invoker connection for sending the timing, -1 if not requested
+    int m_timingFd;
+
+    //! Microseconds from accepting the invoker until the request was received
+    unsigned int m_handshakeTime;
+
 #ifdef UNIT_TEST
     friend class Ut_Booster;
 #endif
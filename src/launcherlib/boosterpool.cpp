@@ -0,0 +1,117 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#include "boosterpool.h"
+
+#include <algorithm>
+
+/* Launches older than this do not affect the pool size */
+static const unsigned LAUNCH_RATE_WINDOW = 30 * 1000;
+
+/* Every this many launches within the rate window ask for one
+ * more spare booster on top of the minimum.
+ */
+static const int LAUNCHES_PER_EXTRA_BOOSTER = 2;
+
+BoosterPool::BoosterPool(int minSize, int maxSize) :
+    m_minSize(1),
+    m_maxSize(1),
+    m_hits(0),
+    m_misses(0)
+{
+    setLimits(minSize, maxSize);
+}
+
+void BoosterPool::setLimits(int minSize, int maxSize)
+{
+    m_minSize = std::max(minSize, 1);
+    m_maxSize = std::max(maxSize, m_minSize);
+}
+
+int BoosterPool::minSize() const
+{
+    return m_minSize;
+}
+
+int BoosterPool::maxSize() const
+{
+    return m_maxSize;
+}
+
+void BoosterPool::expireLaunches(unsigned now)
+{
+    /* Note: timestamps wrap around, only differences are meaningful */
+    while (!m_launches.empty() && now - m_launches.front() > LAUNCH_RATE_WINDOW)
+        m_launches.pop_front();
+}
+
+int BoosterPool::targetSize(unsigned now)
+{
+    expireLaunches(now);
+    int extra = (int)m_launches.size() / LAUNCHES_PER_EXTRA_BOOSTER;
+    return std::min(m_minSize + extra, m_maxSize);
+}
+
+int BoosterPool::size() const
+{
+    return (int)m_boosters.size();
+}
+
+bool BoosterPool::contains(pid_t pid) const
+{
+    return m_boosters.find(pid) != m_boosters.end();
+}
+
+void BoosterPool::add(pid_t pid)
+{
+    m_boosters.insert(pid);
+}
+
+bool BoosterPool::remove(pid_t pid)
+{
+    return m_boosters.erase(pid) > 0;
+}
+
+const set<pid_t> & BoosterPool::boosters() const
+{
+    return m_boosters;
+}
+
+void BoosterPool::recordLaunch(unsigned now, bool miss)
+{
+    if (miss)
+        ++m_misses;
+    else
+        ++m_hits;
+
+    m_launches.push_back(now);
+    expireLaunches(now);
+}
+
+int BoosterPool::recentLaunches(unsigned now)
+{
+    expireLaunches(now);
+    return (int)m_launches.size();
+}
+
+unsigned BoosterPool::hits() const
+{
+    return m_hits;
+}
+
+unsigned BoosterPool::misses() const
+{
+    return m_misses;
+}
@@ -0,0 +1,119 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifndef BOOSTERPOOL_H
+#define BOOSTERPOOL_H
+
+#include "launcherlib.h"
+
+#include <sys/types.h>
+
+#include <deque>
+#include <set>
+
+using std::deque;
+using std::set;
+
+/*!
+ * \class BoosterPool
+ * \brief Bookkeeping for spare boosters waiting for invokers.
+ *
+ * All boosters in the pool accept connections on the same listening
+ * socket. The pool keeps track of the spare booster pids, the hit / miss
+ * counters and the recent launch rate, which is used to decide how
+ * many spare boosters should be kept within the configured limits.
+ */
+class DECL_EXPORT BoosterPool
+{
+public:
+
+    /*!
+     * \brief Constructor
+     * \param minSize Number of spare boosters kept even when idle.
+     * \param maxSize Upper limit for spare boosters during launch bursts.
+     */
+    BoosterPool(int minSize = 1, int maxSize = 1);
+
+    //! Set pool size limits. maxSize is raised to minSize if needed.
+    void setLimits(int minSize, int maxSize);
+
+    //! Return lower size limit
+    int minSize() const;
+
+    //! Return upper size limit
+    int maxSize() const;
+
+    /*!
+     * \brief Return wanted number of spare boosters.
+     * \param now Monotonic timestamp in milliseconds.
+     */
+    int targetSize(unsigned now);
+
+    //! Return current number of spare boosters
+    int size() const;
+
+    //! Return true if pid is a spare booster
+    bool contains(pid_t pid) const;
+
+    //! Add a freshly forked spare booster
+    void add(pid_t pid);
+
+    //! Remove booster from the pool. Return true if it was a spare booster.
+    bool remove(pid_t pid);
+
+    //! Return pids of all spare boosters
+    const set<pid_t> & boosters() const;
+
+    /*!
+     * \brief Account a launch that consumed a spare booster.
+     * \param now Monotonic timestamp in milliseconds.
+     * \param miss True if the invoker had to wait for a booster.
+     */
+    void recordLaunch(unsigned now, bool miss);
+
+    /*!
+     * \brief Return number of launches within the launch rate window.
+     * \param now Monotonic timestamp in milliseconds.
+     */
+    int recentLaunches(unsigned now);
+
+    //! Return number of launches served by an already waiting booster
+    unsigned hits() const;
+
+    //! Return number of launches that had to wait for a booster
+    unsigned misses() const;
+
+private:
+
+    //! Drop launch timestamps older than the rate window
+    void expireLaunches(unsigned now);
+
+    int m_minSize;
+    int m_maxSize;
+    unsigned m_hits;
+    unsigned m_misses;
+
+    //! Pids of spare boosters
+    set<pid_t> m_boosters;
+
+    //! Timestamps of recent launches
+    deque<unsigned> m_launches;
+
+#ifdef UNIT_TEST
+    friend class Ut_BoosterPool;
+#endif
+};
+
+#endif // BOOSTERPOOL_H
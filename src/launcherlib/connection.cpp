@@ -21,6 +21,7 @@
 
 #include "connection.h"
 #include "logger.h"
+#include "probes.h"
 #include "report.h"
 
 #include <sys/socket.h>
@@ -30,7 +31,11 @@
 #include <cstdlib>
 #include <cerrno>
 #include <unistd.h>
+#include <algorithm>
+#include <new>
 #include <stdexcept>
+#include <unordered_map>
+#include <utility>
 #include <sys/syslog.h>
 
 Connection::Connection(int socketFd, bool testMode) :
@@ -44,7 +49,12 @@ Connection::Connection(int socketFd, bool testMode) :
         m_delay(0),
         m_sendPid(false),
         m_gid(0),
-        m_uid(0)
+        m_uid(0),
+        m_arena(),
+        m_framed(false),
+        m_frame(NULL),
+        m_frameSize(0),
+        m_framePos(0)
 {
     m_io[0] = -1;
     m_io[1] = -1;
@@ -66,12 +76,6 @@ Connection::~Connection()
             m_io[i] = -1;
         }
     }
-
-    for (int i = 0; i < m_argc; ++i)
-        delete[] m_argv[i];
-    free(m_argv);
-    m_argc = 0;
-    m_argv = nullptr;
 }
 
 
@@ -87,6 +91,11 @@ bool Connection::accept(AppData *appData)
     {
         m_fd = ::accept(m_curSocket, NULL, NULL);
 
+        // The listening socket is shared by all spare boosters and
+        // does not block, another booster may have been faster
+        if (m_fd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return false;
+
         if (m_fd < 0)
         {
             Logger::logError("Connection: Failed to accept a connection: %s\n", strerror(errno));
@@ -130,7 +139,17 @@ bool Connection::sendMsg(uint32_t msg)
 
 bool Connection::recvMsg(uint32_t *msg)
 {
-    if (!m_testMode)
+    if (m_framed)
+    {
+        if (!readFrame(msg, sizeof(*msg)))
+        {
+            *msg = 0;
+            return false;
+        }
+        Logger::logDebug("Connection: %s: %08x", __FUNCTION__, *msg);
+        return true;
+    }
+    else if (!m_testMode)
     {
         uint32_t buf = 0;
         int len = sizeof(buf);
@@ -170,19 +189,11 @@ char *Connection::recvStr()
             return NULL;
         }
 
-        char * str = new char[size];
-        if (!str)
-        {
-            Logger::logError("Connection: mallocing in %s", __FUNCTION__);
-            return NULL;
-        }
-
         // Get the string.
-        uint32_t ret = read(m_fd, str, size);
-        if (ret < size)
+        char *str = recvData(size);
+        if (!str)
         {
-            Logger::logError("Connection: getting string, got %u of %u bytes", ret, size);
-            delete [] str;
+            Logger::logError("Connection: getting string of %u bytes", size);
             return NULL;
         }
 
@@ -216,18 +227,35 @@ bool Connection::sendExitValue(int value)
 uint32_t Connection::receiveMagic()
 {
     uint32_t magic = 0;
+    bool haveIO = false;
 
-    // Receive the magic.
-    recvMsg(&magic);
+    // Receive the magic. The I/O descriptors of a framed request
+    // are attached to it.
+    if (m_testMode)
+        recvMsg(&magic);
+    else if (!recvWithIO(&magic, sizeof(magic), &haveIO))
+        return -1;
 
     if ((magic & INVOKER_MSG_MASK) == INVOKER_MSG_MAGIC)
     {
-        if (!((magic & INVOKER_MSG_MAGIC_VERSION_MASK) == INVOKER_MSG_MAGIC_VERSION))
+        uint32_t version = magic & INVOKER_MSG_MAGIC_VERSION_MASK;
+        if (version == INVOKER_MSG_MAGIC_VERSION)
+        {
+            m_framed = true;
+        }
+        else if (version != INVOKER_MSG_MAGIC_VERSION_V3)
         {
             Logger::logError("Connection: receiving bad magic version (%08x)\n", magic);
             return -1;
         }
     }
+
+    if (haveIO && !m_framed)
+    {
+        Logger::logError("Connection: unexpected descriptors with magic (%08x)\n", magic);
+        return -1;
+    }
+
     m_sendPid  = magic & INVOKER_MSG_MAGIC_OPTION_WAIT;
 
     return magic & INVOKER_MSG_MAGIC_OPTION_MASK;
@@ -252,9 +280,7 @@ string Connection::receiveAppName()
         return string();
     }
 
-    string appName(name);
-    delete [] name;
-    return appName;
+    return string(name);
 }
 
 bool Connection::receiveExec()
@@ -264,7 +290,7 @@ bool Connection::receiveExec()
         return false;
 
     m_fileName = filename;
-    delete [] filename;
+
     return true;
 }
 
@@ -289,25 +315,20 @@ bool Connection::receiveIDs()
 
 bool Connection::receiveArgs()
 {
-    const uint32_t argMax = 1024;
-
-    // Clear current args
-    for (int i = 0; i < m_argc; ++i)
-        delete[] m_argv[i];
-    free(m_argv);
+    // Clear current args, their memory is released with the arena
     m_argc = 0;
     m_argv = nullptr;
 
     // Get argc
     uint32_t argc = 0;
     recvMsg(&argc);
-    if (argc < 1 || argc > argMax) {
+    if (argc < 1 || argc > INVOKER_MSG_ARGS_MAX) {
         Logger::logError("Connection: invalid number of parameters %d", m_argc);
         return false;
     }
 
     m_argc = argc;
-    m_argv = (char **)calloc(m_argc + 1, sizeof *m_argv);
+    m_argv = (char **)m_arena.allocate((m_argc + 1) * sizeof *m_argv);
     for (int i = 0; i < m_argc; ++i) {
         if (!(m_argv[i] = recvStr())) {
             m_argc = i;
@@ -328,54 +349,166 @@ bool Connection::receiveEnv()
     // Get number of environment variables.
     uint32_t n_vars = 0;
     recvMsg(&n_vars);
-    if (n_vars > 0 && n_vars < MAX_VARS)
+    if (n_vars == 0 || n_vars >= MAX_VARS)
+    {
+        Logger::logError("Connection: invalid environment variable count %d", n_vars);
+        return false;
+    }
+
+    // Get environment variables.
+    vector<char *> vars;
+    for (uint32_t i = 0; i < n_vars; i++)
     {
-        // Get environment variables
-        for (uint32_t i = 0; i < n_vars; i++)
+        char *var = recvStr();
+        if (var == NULL)
         {
-            char *var = recvStr();
-            if (var == NULL)
-            {
-                Logger::logError("Connection: receiving environ[%i]", i);
-                return false;
-            }
-            char *val = strchr(var, '=');
-            if (val) {
-                *val++ = 0;
-                const char *cur = getenv(var);
-                /* Note: DBUS_SESSION_BUS_ADDRESS is a special case. If we
-                 * are running in sandbox, we already have non-standard path
-                 * that firejail has placed in env.
-                 */
-                if (!cur || strcmp(var, "DBUS_SESSION_BUS_ADDRESS")) {
-                    if (!cur || strcmp(cur, val)) {
-                        info("ENV: $%s: %s -> %s", var, cur ?: "n/a", val);
-                        setenv(var, val, true);
-                    }
-                }
-            }
-            delete [] var;
+            Logger::logError("Connection: receiving environ[%i]", i);
+            return false;
         }
+        vars.push_back(var);
     }
-    else
+
+    int changed = applyEnvironment(vars);
+    info("ENV: %d of %u variables changed", changed, n_vars);
+    return true;
+}
+
+bool Connection::receiveEnvBlock()
+{
+    const uint32_t MAX_VARS = 1024;
+
+    uint32_t n_vars = 0;
+    uint32_t size = 0;
+    recvMsg(&n_vars);
+    recvMsg(&size);
+    if (n_vars == 0 || n_vars >= MAX_VARS || size == 0 || size > INVOKER_MSG_FRAME_MAX)
     {
-        Logger::logError("Connection: invalid environment variable count %d", n_vars);
+        Logger::logError("Connection: invalid environment of %u variables in %u bytes", n_vars, size);
+        return false;
+    }
+
+    char *block = recvData(size);
+    if (!block || block[size - 1] != '\0')
+    {
+        Logger::logError("Connection: receiving environment block");
+        return false;
+    }
+
+    vector<char *> vars;
+    vars.reserve(n_vars);
+    for (char *var = block; var < block + size; var += strlen(var) + 1)
+        vars.push_back(var);
+
+    if (vars.size() != n_vars)
+    {
+        Logger::logError("Connection: environment block has %u variables, expected %u",
+                         (unsigned)vars.size(), n_vars);
         return false;
     }
 
+    int changed = applyEnvironment(vars);
+    info("ENV: %d of %u variables changed", changed, n_vars);
     return true;
 }
 
+int Connection::applyEnvironment(const vector<char *> &vars)
+{
+    // Index the current environment by name, so that merging is a
+    // single pass instead of a getenv() and setenv() scan per variable
+    vector<char *> env;
+    std::unordered_map<string, size_t> index;
+    for (char **cur = environ; *cur; ++cur)
+    {
+        const char *val = strchr(*cur, '=');
+        if (val)
+            index[string(*cur, val - *cur)] = env.size();
+        env.push_back(*cur);
+    }
+
+    int changed = 0;
+    for (vector<char *>::const_iterator it = vars.begin(); it != vars.end(); ++it)
+    {
+        char *var = *it;
+        const char *val = strchr(var, '=');
+        if (!val)
+            continue;
+
+        string name(var, val - var);
+        std::unordered_map<string, size_t>::const_iterator cur = index.find(name);
+        if (cur == index.end())
+        {
+            Logger::logDebug("ENV: $%s: n/a -> %s", name.c_str(), val + 1);
+            index[name] = env.size();
+            env.push_back(strdup(var));
+            changed++;
+            continue;
+        }
+
+        /* Note: DBUS_SESSION_BUS_ADDRESS is a special case. If we
+         * are running in sandbox, we already have non-standard path
+         * that firejail has placed in env.
+         */
+        const char *curVal = env[cur->second] + name.size() + 1;
+        if (name == "DBUS_SESSION_BUS_ADDRESS" || strcmp(curVal, val + 1) == 0)
+            continue;
+
+        Logger::logDebug("ENV: $%s: %s -> %s", name.c_str(), curVal, val + 1);
+        env[cur->second] = strdup(var);
+        changed++;
+    }
+
+    if (changed == 0)
+        return 0;
+
+    // Install the merged environment at once. The previous array and
+    // replaced strings are not freed, they may still be referenced.
+    char **merged = static_cast<char **>(malloc((env.size() + 1) * sizeof(char *)));
+    if (!merged)
+        throw std::bad_alloc();
+    std::copy(env.begin(), env.end(), merged);
+    merged[env.size()] = NULL;
+    environ = merged;
+
+    return changed;
+}
+
 bool Connection::receiveIO()
 {
+    // Descriptors of a framed request have been received with the magic
+    if (m_framed)
+    {
+        if (m_io[0] == -1)
+        {
+            Logger::logWarning("Connection: no descriptors attached to the request");
+            return false;
+        }
+        return true;
+    }
+
     int dummy = 0;
+    bool haveIO = false;
+    if (!recvWithIO(&dummy, 1, &haveIO))
+        return false;
+
+    if (!haveIO)
+    {
+        Logger::logWarning("Connection: invalid cmsg in invoked_get_io");
+        return false;
+    }
+
+    return true;
+}
+
+bool Connection::recvWithIO(void *data, size_t size, bool *haveIO)
+{
+    *haveIO = false;
 
     struct iovec iov;
-    iov.iov_base = &dummy;
-    iov.iov_len = 1;
+    iov.iov_base = data;
+    iov.iov_len = size;
 
     char buf[CMSG_SPACE(sizeof(m_io))];
-    
+
     struct msghdr msg;
     memset(&msg, 0, sizeof(msg));
     msg.msg_iov        = &iov;
@@ -383,36 +516,109 @@ bool Connection::receiveIO()
     msg.msg_control    = buf;
     msg.msg_controllen = sizeof(buf);
 
-    struct cmsghdr *cmsg;
-    cmsg             = CMSG_FIRSTHDR(&msg);
-    cmsg->cmsg_len   = CMSG_LEN(sizeof(m_io));
-    cmsg->cmsg_level = SOL_SOCKET;
-    cmsg->cmsg_type  = SCM_RIGHTS;
+    ssize_t ret = recvmsg(m_fd, &msg, 0);
+    if (ret < 0)
+    {
+        Logger::logWarning("Connection: recvmsg failed in %s: %s", __FUNCTION__, strerror(errno));
+        return false;
+    }
+
+    if (msg.msg_flags)
+    {
+        Logger::logWarning("Connection: unexpected msg flags in %s", __FUNCTION__);
+        return false;
+    }
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg)
+    {
+        if (cmsg->cmsg_len != CMSG_LEN(sizeof(m_io)) ||
+            cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        {
+            Logger::logWarning("Connection: invalid cmsg in %s", __FUNCTION__);
+            return false;
+        }
 
-    memcpy(CMSG_DATA(cmsg), m_io, sizeof(m_io));
+        for (int i = 0; i < IO_DESCRIPTOR_COUNT; i++)
+        {
+            if (m_io[i] != -1)
+                ::close(m_io[i]);
+        }
+        memcpy(m_io, CMSG_DATA(cmsg), sizeof(m_io));
+        *haveIO = true;
+    }
 
-    if (recvmsg(m_fd, &msg, 0) < 0)
+    if ((size_t)ret < size)
     {
-        Logger::logWarning("Connection: recvmsg failed in invoked_get_io: %s", strerror(errno));
+        Logger::logError("Connection: can't read data from connecton in %s", __FUNCTION__);
         return false;
     }
 
-    if (msg.msg_flags)
+    return true;
+}
+
+bool Connection::receiveFrame()
+{
+    uint32_t size = 0;
+    if (recv(m_fd, &size, sizeof(size), MSG_WAITALL) != sizeof(size))
     {
-        Logger::logWarning("Connection: unexpected msg flags in invoked_get_io");
+        Logger::logError("Connection: can't read frame size: %s", strerror(errno));
         return false;
     }
 
-    cmsg = CMSG_FIRSTHDR(&msg);
-    if (cmsg == NULL || cmsg->cmsg_len != CMSG_LEN(sizeof(m_io)) ||
-        cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+    if (size > INVOKER_MSG_FRAME_MAX)
     {
-        Logger::logWarning("Connection: invalid cmsg in invoked_get_io");
+        Logger::logError("Connection: frame of %u bytes is too large", size);
         return false;
     }
 
-    memcpy(m_io, CMSG_DATA(cmsg), sizeof(m_io));
+    // One read for the whole request, messages are then parsed from
+    // memory and strings are used in place. The arena leaves room for
+    // the argument vector after the frame.
+    m_frame = static_cast<char *>(m_arena.allocate(size));
+    m_frameSize = size;
+    m_framePos = 0;
+    if (size > 0 && recv(m_fd, m_frame, size, MSG_WAITALL) != (ssize_t)size)
+    {
+        Logger::logError("Connection: can't read frame of %u bytes: %s", size, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+char *Connection::recvData(size_t size)
+{
+    if (m_framed)
+    {
+        if (size > m_frameSize - m_framePos)
+        {
+            Logger::logError("Connection: unexpected end of frame");
+            return NULL;
+        }
+
+        char *data = m_frame + m_framePos;
+        m_framePos += size;
+        return data;
+    }
+
+    char *data = static_cast<char *>(m_arena.allocate(size));
+    if (recv(m_fd, data, size, MSG_WAITALL) != (ssize_t)size)
+        return NULL;
+
+    return data;
+}
 
+bool Connection::readFrame(void *data, size_t size)
+{
+    if (size > m_frameSize - m_framePos)
+    {
+        Logger::logError("Connection: unexpected end of frame");
+        return false;
+    }
+
+    memcpy(data, m_frame + m_framePos, size);
+    m_framePos += size;
     return true;
 }
 
@@ -445,6 +651,11 @@ bool Connection::receiveActions()
                 return false;
             break;
 
+        case INVOKER_MSG_ENV_BLOCK:
+            if (!receiveEnvBlock())
+                return false;
+            break;
+
         case INVOKER_MSG_PRIO:
             if (!receivePriority())
                 return false;
@@ -474,6 +685,11 @@ bool Connection::receiveActions()
             return false;
 
         case INVOKER_MSG_END:
+            if (m_framed && m_framePos != m_frameSize)
+            {
+                Logger::logError("Connection: data after end of request\n");
+                return false;
+            }
             if (!sendMsg(INVOKER_MSG_ACK))
                 return false;
             if (m_sendPid && !sendPid(getpid()))
@@ -497,6 +713,13 @@ bool Connection::receiveApplicationData(AppData* appData)
         return false;
     }
 
+    // Read the rest of a framed request at once
+    if (m_framed && !receiveFrame())
+    {
+        Logger::logError("Connection: receiving request failed\n");
+        return false;
+    }
+
     // Read application name
     appData->setAppName(receiveAppName());
     if (appData->appName().empty())
@@ -506,13 +729,21 @@ bool Connection::receiveApplicationData(AppData* appData)
     }
 
     // Read application parameters
-    if (receiveActions())
+    APPMOTOR_PROBE1(connection_receive_start, appData->appName().c_str());
+    const bool received = receiveActions();
+    APPMOTOR_PROBE2(connection_receive_end, appData->appName().c_str(), received);
+    if (received)
     {
         appData->setFileName(m_fileName);
         appData->setPriority(m_priority);
         appData->setDelay(m_delay);
         appData->setArgc(m_argc);
-        appData->setArgv((const char **)m_argv);
+        // The arguments stay where they were received
+        appData->setArgv(m_argv, std::move(m_arena));
+        m_argc = 0;
+        m_argv = nullptr;
+        m_frame = NULL;
+        m_frameSize = m_framePos = 0;
         appData->setIODescriptors(vector<int>(m_io, m_io + IO_DESCRIPTOR_COUNT));
         appData->setIDs(m_uid, m_gid);
     }
@@ -23,6 +23,7 @@
 
 #include "launcherlib.h"
 #include "appdata.h"
+#include "arena.h"
 #include "protocol.h"
 
 #include <stdint.h>
@@ -30,6 +31,10 @@
 
 using std::string;
 
+#include <vector>
+
+using std::vector;
+
 #define IO_DESCRIPTOR_COUNT 3
 
 /*!
@@ -118,9 +123,32 @@ private:
     //! Receive environment
     bool receiveEnv();
 
+    //! Receive environment sent as one block
+    bool receiveEnvBlock();
+
+    /*! \brief Merge "name=value" strings into the environment.
+     * Added and changed variables are copied.
+     * \return Number of variables that were added or changed.
+     */
+    int applyEnvironment(const vector<char *> &vars);
+
     //! Receive I/O descriptors
     bool receiveIO();
 
+    //! Receive the rest of a framed (version 4) launch request
+    bool receiveFrame();
+
+    /*! \brief Receive size bytes with I/O descriptors possibly attached.
+     * \param haveIO Set to true if descriptors were received to m_io.
+     */
+    bool recvWithIO(void *data, size_t size, bool *haveIO);
+
+    //! Take size bytes from the received frame
+    bool readFrame(void *data, size_t size);
+
+    //! Receive size bytes, in place from the frame or from the socket to the arena
+    char *recvData(size_t size);
+
     //! Receive userId and GroupId
     bool receiveIDs();
 
@@ -139,7 +167,8 @@ private:
     //! Receive a message from a socket. This is a virtual to help unit testing.
     virtual bool recvMsg(uint32_t *msg);
 
-    //! Receive a string. This is a virtual to help unit testing.
+    //! Receive a string allocated from the arena of the request.
+    //! This is a virtual to help unit testing.
     virtual char *recvStr();
 
     //! Run in test mode, if true
@@ -161,6 +190,15 @@ private:
     gid_t    m_gid;
     uid_t    m_uid;
 
+    //! Memory of the request, handed over to AppData with the arguments
+    Arena    m_arena;
+
+    //! True if the request is framed, messages are then read from m_frame
+    bool     m_framed;
+    char    *m_frame;
+    size_t   m_frameSize;
+    size_t   m_framePos;
+
 
 #ifdef UNIT_TEST
     friend class Ut_Connection;
@@ -24,10 +24,21 @@
 #include "report.h"
 #include "connection.h"
 #include "booster.h"
+#include "boosterpool.h"
+#include "launchmetrics.h"
+#include "launchprofile.h"
+#include "launchtiming.h"
+#include "prefetcher.h"
+#include "respawnscheduler.h"
 #include "singleinstance.h"
 #include "socketmanager.h"
+#include "probes.h"
+#include "protocol.h"
+#include "trace.h"
 
 #include <deque>
+#include <algorithm>
+#include <climits>
 #include <cstdlib>
 #include <cerrno>
 #include <sys/capability.h>
@@ -49,92 +60,78 @@
 #include <unistd.h>
 #include <poll.h>
 #include <getopt.h>
+#include <sys/epoll.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sched.h>
 
 #include "coverage.h"
 
-/* Setting VERBOSE_SIGNALS to non-zero value logs receiving of
- * async-signals - which is useful only when actively debugging
- * booster / invoker interoperation.
- */
-#define VERBOSE_SIGNALS 01
-
-
 // Environment
 extern char ** environ;
 
 Daemon * Daemon::m_instance = NULL;
 const int Daemon::m_boosterSleepTime = 2;
 
-static void write_dontcare(int fd, const void *data, size_t size)
+/* Maximum number of events handled per epoll_wait() call */
+static const int MAX_EPOLL_EVENTS = 16;
+
+/* Control socket limits: pending connections, connected clients and
+ * length of a request line */
+static const int CONTROL_BACKLOG = 4;
+static const size_t CONTROL_MAX_CLIENTS = 8;
+static const size_t CONTROL_MAX_REQUEST = 256;
+
+/* Epoll event data holds the event source in the upper half and
+ * an associated identifier (e.g. booster pid or booster type index)
+ * in the lower half.
+ * Invoker sockets are identified by booster pid rather than fd so
+ * that events for an fd closed and reused within the same batch of
+ * events can be recognized as stale.
+ */
+enum EventSource
 {
-    ssize_t rc = write(fd, data, size);
-    if (rc == -1)
-        Logger::logWarning("write to fd=%d failed: %m", fd);
-    else if ((size_t)rc != size)
-        Logger::logWarning("write to fd=%d failed", fd);
-}
-
-#if VERBOSE_SIGNALS
-static char *addstr(char *pos, char *end, const char *str)
+    EVENT_BOOSTER_SOCKET = 1,
+    EVENT_SIGNAL_FD,
+    EVENT_INVOKER_SOCKET,
+    EVENT_TIMER,
+    EVENT_TERMINATION_SOCKET,
+    EVENT_TERMINATION_PROCESS,
+    EVENT_CHILD_PROCESS,
+    EVENT_LAUNCH_SOCKET,
+    EVENT_TEMPLATE_SOCKET,
+    EVENT_UPGRADE_SOCKET,
+    EVENT_CONTROL_SOCKET,
+    EVENT_CONTROL_CLIENT,
+    EVENT_CONTROL_RESPONSE,
+    EVENT_PROFILE_RECORDER,
+};
+
+static uint64_t event_data(EventSource source, uint32_t id)
 {
-    while (pos < end && *str)
-        *pos++ = *str++;
-    return pos;
+    return ((uint64_t)source << 32) | id;
 }
-static char *addnum(char *pos, char *end, int num)
+
+static EventSource event_source(uint64_t data)
 {
-    char stk[64];
-    int sp = sizeof stk;
-    bool neg = (num < 0);
-    unsigned mag = (unsigned)(neg ? -num : num);
-    stk[--sp] = 0;
-    do {
-        stk[--sp] = '0' + mag % 10;
-    } while (mag /= 10);
-    if (neg)
-        stk[--sp] = '-';
-    return addstr(pos, end, &stk[sp]);
+    return (EventSource)(data >> 32);
 }
-#endif
 
-static void write_to_signal_pipe(int sig)
+static uint32_t event_id(uint64_t data)
 {
-#if VERBOSE_SIGNALS
-    char m[256];
-    char *p = m;
-    char *e = m + sizeof m - 1;
-    p = addstr(p, e, "*** signal=");
-    p = addnum(p, e, sig);
-    p = addstr(p, e, " pid=");
-    p = addnum(p, e, getpid());
-    p = addstr(p, e, "\n");
-    if (write(STDERR_FILENO, m, p - m) < 0) {
-        // dontcare
-    }
-#endif
-
-    char v = (char)sig;
-    if (write(Daemon::instance()->sigPipeFd(), &v, 1) != 1) {
-        /* If we can't write to internal signal forwarding
-         * pipe, we might as well quit */
-        const char m[] = "*** signal pipe write failure - terminating\n";
-        if (write(STDERR_FILENO, m, sizeof m - 1) == -1) {
-            // dontcare
-        }
-        _exit(EXIT_FAILURE);
-    }
+    return (uint32_t)data;
 }
 
-static int read_from_signal_pipe(int fd)
+static void write_dontcare(int fd, const void *data, size_t size)
 {
-    char sig = 0;
-    if (read(fd, &sig, 1) != 1) {
-        /* If we can't read from internal signal forwarding
-         * pipe, we might as well quit */
-        Logger::logError("signal pipe read failure - terminating\n");
-        exit(EXIT_FAILURE);
-    }
-    return sig;
+    ssize_t rc = write(fd, data, size);
+    if (rc == -1)
+        Logger::logWarning("write to fd=%d failed: %m", fd);
+    else if ((size_t)rc != size)
+        Logger::logWarning("write to fd=%d failed", fd);
 }
 
 static unsigned timestamp(void)
@@ -154,170 +151,187 @@ static unsigned timestamp(void)
             (unsigned)(ts.tv_nsec / (1000 * 1000u)));
 }
 
-static bool shutdown_socket(int socket_fd)
-{
-    bool disconnected = false;
-
-    /* Close transmit end from our side, then wait
-     * for peer to receive EOF and close the receive
-     * end too.
-     */
-
-    debug("trying to disconnect booster socket...\n");
-
-    unsigned started = timestamp();
-    unsigned timeout = 5000;
+/* Time allowed for invoker to close its end of the socket
+ * after the exit status has been sent */
+static const unsigned INVOKER_DISCONNECT_TIMEOUT = 5 * 1000;
 
-    if (shutdown(socket_fd, SHUT_WR) == -1) {
-        warning("socket shutdown failed: %m\n");
-        goto EXIT;
-    }
+/* Time allowed for a process to exit after SIGTERM / SIGKILL */
+static const unsigned PROCESS_EXIT_TIMEOUT = 10 * 1000;
 
-    for (;;) {
-        unsigned elapsed = timestamp() - started;
-        if (elapsed >= timeout)
-            break;
+/* Upper limit for postponing the replacement of a spare booster
+ * that exited, the lower limit is Daemon::m_boosterSleepTime */
+static const unsigned BOOSTER_RESPAWN_MAX_DELAY = 10 * 1000;
 
-        struct pollfd pfd = {
-            .fd = socket_fd,
-            .events = POLLIN,
-            .revents = 0,
-        };
+/* Time allowed for the template process to fork a booster */
+static const unsigned TEMPLATE_FORK_TIMEOUT = 1000;
 
-        debug("waiting for booster socket input...\n");
-        int rc = poll(&pfd, 1, (int)(timeout - elapsed));
+/* Time allowed for the template process to finish preloading */
+static const unsigned TEMPLATE_START_TIMEOUT = 15 * 1000;
 
-        if (rc == 0)
-            break;
+/* Boosters are forked directly for this long after the template failed */
+static const unsigned TEMPLATE_RETRY_DELAY = 60 * 1000;
 
-        if (rc == -1) {
-            if (errno == EINTR || errno == EAGAIN)
-                continue;
-            warning("socket poll failed: %m\n");
-            goto EXIT;
-        }
+/* Exit polling interval for processes without a pidfd */
+static const unsigned PROCESS_POLL_INTERVAL = 1000;
 
-        char buf[256];
-        rc = recv(socket_fd, buf, sizeof buf, MSG_DONTWAIT);
-        if (rc == 0) {
-            /* EOF -> peer closed the socket */
-            disconnected = true;
-            goto EXIT;
-        }
+/* Number of exited processes whose trace files are kept */
+static const size_t TRACE_KEEP_EXITED = 16;
 
-        if (rc == -1) {
-            warning("socket read failed: %m\n");
-            goto EXIT;
-        }
-    }
-    warning("socket poll timeout\n");
+/* Result of a launch profile recording, sent by the recorder process */
+struct ProfileResult
+{
+    int recorded;               /* profile was recorded and saved */
+    int replayed;               /* there was a previous profile */
+    unsigned long pages;        /* pages in the new profile */
+    unsigned long hits;         /* of them in the previous profile */
+    unsigned long prefetched;   /* pages in the previous profile */
+};
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
 
-EXIT:
-    if (disconnected)
-        debug("booster socket was succesfully disconnected\n");
-    else
-        warning("could not disconnect booster socket\n");
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal 424
+#endif
 
-    return disconnected;
+static int pidfd_open_compat(pid_t pid)
+{
+    return (int)syscall(SYS_pidfd_open, pid, 0);
 }
 
-static void kill_process(const char *label, pid_t pid)
+static int pidfd_send_signal_compat(int pidfd, int sig)
 {
-    if (pid == -1) {
-        warning("%s pid is not known, can't kill it", label);
-        goto EXIT;
-    }
-
-    warning("sending SIGTERM to %s (pid=%d)", label, (int)pid);
-
-    if (kill(pid, SIGTERM) == -1)
-        goto FAIL;
-
-    for (int i = 0; i < 10; ++i) {
-        sleep(1);
-        /* We use this function for both boosters and invokers.
-         * Boosters are child processes and we must use wait*()
-         * to reap them. But invokers are not descendants of
-         * booster daemon, so ECHILD failures are expected too.
-         */
-        int status = 0;
-        if (waitpid(pid, &status, WNOHANG) == -1 && errno != ECHILD)
-            warning("%s pid=%d) waitpid error: %m", label, (int)pid);
-        if (kill(pid, 0) == -1)
-            goto FAIL;
-    }
-
-    warning("sending SIGKILL to %s (pid=%d)", label, (int)pid);
-
-    if (kill(pid, SIGKILL) == -1)
-        goto FAIL;
+    return (int)syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0);
+}
 
-    for (int i = 0; i < 10; ++i) {
-        sleep(1);
-        int status = 0;
-        if (waitpid(pid, &status, WNOHANG) == -1 && errno != ECHILD)
-            warning("%s pid=%d) waitpid error: %m", label, (int)pid);
-        if (kill(pid, 0) == -1)
-            goto FAIL;
-    }
+/* Duplicate pidfd for an owner with a separate lifetime */
+static int dup_pidfd(int pidFd)
+{
+    return pidFd == -1 ? -1 : fcntl(pidFd, F_DUPFD_CLOEXEC, 0);
+}
 
-    warning("%s (pid=%d) did not exit", label, (int)pid);
-    goto EXIT;
+#ifndef SO_PEERPIDFD
+#define SO_PEERPIDFD 77
+#endif
 
-FAIL:
-    if (errno == ESRCH)
-        debug("%s (pid=%d) has exited", label, (int)pid);
-    else
-        warning("%s (pid=%d) kill failed: %m", label, (int)pid);
+/* Get pidfd of the process at the other end of a unix socket.
+ * Falls back to opening the pidfd by pid on kernels without
+ * SO_PEERPIDFD, which is racy only if the peer has already exited.
+ */
+static int peer_pidfd(int socketFd, pid_t pid)
+{
+    int pidFd = -1;
+    socklen_t len = sizeof pidFd;
+    if (socketFd != -1 && getsockopt(socketFd, SOL_SOCKET, SO_PEERPIDFD, &pidFd, &len) == 0)
+        return pidFd;
+    return pid > 0 ? pidfd_open_compat(pid) : -1;
+}
 
-EXIT:
-    return;
+/* Fork a child whose parent is the parent of the caller. Boosters
+ * forked by the template process are this way children of the
+ * daemon, which reaps them and passes exit status to invokers.
+ *
+ * Note: unlike fork(), this does not run pthread_atfork() handlers,
+ * so the template process must have no other threads when it forks.
+ */
+static pid_t clone_parent()
+{
+    return (pid_t)syscall(SYS_clone, CLONE_PARENT | SIGCHLD, NULL, NULL, NULL, NULL);
 }
 
-static void close_invoker(pid_t invoker_pid, int socket_fd, int exit_status)
+// Return path of an executable in PATH, empty if not found
+static string findInPath(const string &name)
 {
-    if (socket_fd != -1) {
-        Logger::logWarning("Daemon: sending exit(%d) to invoker(%d)\n",
-                           exit_status, (int)invoker_pid);
-        uint32_t msg = INVOKER_MSG_EXIT;
-        uint32_t dta = exit_status;
-        write_dontcare(socket_fd, &msg, sizeof msg);
-        write_dontcare(socket_fd, &dta, sizeof dta);
+    const char *path = getenv("PATH");
+    std::istringstream directories(path ? path : "/usr/local/bin:/usr/bin:/bin");
+    string directory;
+    while (std::getline(directories, directory, ':')) {
+        if (directory.empty() || directory[0] != '/')
+            continue;
+
+        string candidate = directory + '/' + name;
+        if (access(candidate.c_str(), X_OK) == 0)
+            return candidate;
+    }
+    return string();
+}
 
-        if (shutdown_socket(socket_fd))
-            invoker_pid = -1;
+/* Names of Booster::WarmupLevel values for --boot-level */
+static const char * const WARMUP_LEVEL_NAMES[] = {
+    "none",
+    "libraries",
+    "application",
+    "qml",
+    "full",
+};
 
-        close(socket_fd),
-            socket_fd = -1;
+static int parseWarmupLevel(const char *name)
+{
+    for (size_t i = 0; i < sizeof WARMUP_LEVEL_NAMES / sizeof *WARMUP_LEVEL_NAMES; ++i) {
+        if (!strcmp(name, WARMUP_LEVEL_NAMES[i]))
+            return (int)i;
     }
-
-    if (invoker_pid != -1)
-        kill_process("invoker", invoker_pid);
+    return -1;
 }
 
+/* Signals handled in the main loop via signal fd */
+static const int HANDLED_SIGNALS[] = {
+    SIGCHLD, // reap zombies
+    SIGINT,  // exit launcher
+    SIGTERM, // exit launcher
+    SIGUSR1, // enter normal mode from boot mode
+    SIGUSR2, // enter boot mode (same as --boot-mode)
+    SIGPIPE, // broken invoker's pipe
+    SIGHUP,  // re-exec
+};
+
 Daemon::Daemon(int & argc, char * argv[]) :
     m_daemon(false),
     m_debugMode(false),
     m_bootMode(false),
-    m_boosterPid(0),
+    m_bootWarmupLevel(Booster::WarmupNone),
+    m_childrenWithoutPidFd(0),
+    m_poolMinSize(1),
+    m_poolMaxSize(3),
+    m_listenBacklog(SOMAXCONN),
+    m_useTemplate(false),
+    m_profileDelay(0),
+    m_traceRecords(0),
+    m_signalFd(-1),
+    m_epollFd(-1),
+    m_timerFd(-1),
+    m_nextTerminationId(0),
+    m_exiting(false),
+    m_startTime(timestamp()),
+    m_pid(getpid()),
+    m_nextControlClientId(0),
     m_socketManager(new SocketManager),
+    m_metrics(new LaunchMetrics),
     m_singleInstance(new SingleInstance),
-    m_notifySystemd(false),
-    m_booster(0)
+    m_notifySystemd(false)
 {
     // Open the log
     Logger::openLog(argc > 0 ? argv[0] : "booster");
     Logger::logDebug("starting..");
 
-    // Install signal handlers. The original handlers are saved
-    // in the daemon instance so that they can be restored in boosters.
-    setUnixSignalHandler(SIGCHLD, write_to_signal_pipe); // reap zombies
-    setUnixSignalHandler(SIGINT,  write_to_signal_pipe); // exit launcher
-    setUnixSignalHandler(SIGTERM, write_to_signal_pipe); // exit launcher
-    setUnixSignalHandler(SIGUSR1, write_to_signal_pipe); // enter normal mode from boot mode
-    setUnixSignalHandler(SIGUSR2, write_to_signal_pipe); // enter boot mode (same as --boot-mode)
-    setUnixSignalHandler(SIGPIPE, write_to_signal_pipe); // broken invoker's pipe
-    setUnixSignalHandler(SIGHUP,  write_to_signal_pipe); // re-exec
+    // Block handled signals so that they are delivered only via the
+    // signal fd. The original mask is saved in the daemon instance so
+    // that it can be restored in boosters.
+    sigset_t signals;
+    sigemptyset(&signals);
+    for (size_t i = 0; i < sizeof HANDLED_SIGNALS / sizeof *HANDLED_SIGNALS; ++i)
+        sigaddset(&signals, HANDLED_SIGNALS[i]);
+
+    if (sigprocmask(SIG_BLOCK, &signals, &m_originalSigMask) == -1)
+    {
+        throw std::runtime_error("Daemon: Blocking Unix signals failed!\n");
+    }
+
+    if ((m_signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC)) == -1)
+    {
+        throw std::runtime_error("Daemon: Creating a signal fd failed!\n");
+    }
 
     if (!Daemon::m_instance)
     {
@@ -340,10 +354,23 @@ Daemon::Daemon(int & argc, char * argv[]) :
         throw std::runtime_error("Daemon: Creating a socket pair for boosters failed!\n");
     }
 
-    if (pipe(m_sigPipeFd) == -1)
+    if ((m_epollFd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+    {
+        throw std::runtime_error("Daemon: Creating an epoll instance failed!\n");
+    }
+
+    if ((m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) == -1)
     {
-        throw std::runtime_error("Daemon: Creating a pipe for Unix signals failed!\n");
+        throw std::runtime_error("Daemon: Creating a timer failed!\n");
     }
+
+    watchFd(m_boosterLauncherSocket[0], event_data(EVENT_BOOSTER_SOCKET, 0));
+    watchFd(m_signalFd, event_data(EVENT_SIGNAL_FD, 0));
+    watchFd(m_timerFd, event_data(EVENT_TIMER, 0));
+
+    // Every waiting invoker keeps a socket open in the daemon,
+    // allow as many of those as the hard limit permits.
+    raiseFileLimit();
 }
 
 Daemon * Daemon::instance()
@@ -351,12 +378,44 @@ Daemon * Daemon::instance()
     return Daemon::m_instance;
 }
 
-void Daemon::run(Booster *booster)
+void Daemon::addBooster(Booster *booster)
 {
-    m_booster = booster;
+    for (BoosterTypeVector::const_iterator it = m_boosterTypes.begin(); it != m_boosterTypes.end(); ++it)
+    {
+        if (it->booster->boosterType() == booster->boosterType())
+            throw std::runtime_error("Daemon: Booster type registered twice!\n");
+    }
 
     if (!m_boostedApplication.empty())
-        m_booster->setBoostedApplication(m_boostedApplication);
+        booster->setBoostedApplication(m_boostedApplication);
+    if (!m_applicationBinary.empty())
+        booster->setApplicationBinary(m_applicationBinary);
+
+    booster->setBootWarmupLevel(static_cast<Booster::WarmupLevel>(m_bootWarmupLevel));
+
+    BoosterType type;
+    type.booster = booster;
+    type.pool = new BoosterPool(m_poolMinSize, m_poolMaxSize);
+    type.respawnScheduler = new RespawnScheduler;
+    type.watchingLaunchSocket = false;
+    type.templatePid = -1;
+    type.templateSocket = -1;
+    type.templateReady = false;
+    type.templateForking = false;
+    type.templateUpgradeSocket = -1;
+    type.templateDeadline = 0;
+    type.templateRetry = 0;
+    type.lastWarmupTime = 0;
+    m_boosterTypes.push_back(type);
+}
+
+void Daemon::run(Booster *booster)
+{
+    if (booster)
+        addBooster(booster);
+
+    if (m_boosterTypes.empty())
+        throw std::runtime_error("Daemon: No booster types to run!\n");
 
     // Make sure that LD_BIND_NOW does not prevent dynamic linker to
     // use lazy binding in later dlopen() calls.
@@ -365,19 +424,31 @@ void Daemon::run(Booster *booster)
     // dlopen single-instance
     loadSingleInstancePlugin();
 
-    // Create socket for the booster
-    Logger::logDebug("Daemon: initing socket: %s", booster->boosterType().c_str());
-    m_socketManager->initSocket(booster->socketId());
+    // Create sockets for the boosters
+    for (BoosterTypeVector::const_iterator it = m_boosterTypes.begin(); it != m_boosterTypes.end(); ++it)
+    {
+        Logger::logDebug("Daemon: initing socket: %s", it->booster->boosterType().c_str());
+        m_socketManager->initSocket(it->booster->socketId(), m_listenBacklog);
+    }
+
+    initControlSocket();
 
     // Daemonize if desired
     if (m_daemon)
     {
         daemonize();
+        m_pid = getpid();
     }
 
+    openTrace();
+
     // Fork each booster for the first time
-    Logger::logDebug("Daemon: forking booster: %s", booster->boosterType().c_str());
-    forkBooster();
+    for (uint32_t type = 0; type < m_boosterTypes.size(); ++type)
+    {
+        Logger::logDebug("Daemon: forking booster: %s",
+                         m_boosterTypes[type].booster->boosterType().c_str());
+        fillBoosterPool(type);
+    }
 
     // Notify systemd that init is done
     if (m_notifySystemd) {
@@ -388,175 +459,745 @@ void Daemon::run(Booster *booster)
     // Main loop
     while (true)
     {
-        // Variables used by the select call
-        fd_set rfds;
-        int ndfs = 0;
-
-        // Init data for select
-        FD_ZERO(&rfds);
-
-        FD_SET(m_boosterLauncherSocket[0], &rfds);
-        ndfs = std::max(ndfs, m_boosterLauncherSocket[0]);
+        struct epoll_event events[MAX_EPOLL_EVENTS];
 
-        FD_SET(m_sigPipeFd[0], &rfds);
-        ndfs = std::max(ndfs, m_sigPipeFd[0]);
-
-        /* Listen to invoker EOFs */
-        for (auto iter = m_boosterPidToInvokerFd.begin(); iter != m_boosterPidToInvokerFd.end(); ++iter) {
-            int fd = iter->second;
-            if (fd != -1) {
-                FD_SET(fd, &rfds);
-                ndfs = std::max(ndfs, fd);
-            }
+        // Wait for something appearing in the pipes.
+        int count = epoll_wait(m_epollFd, events, MAX_EPOLL_EVENTS, -1);
+        if (count == -1)
+        {
+            if (errno != EINTR)
+                Logger::logError("Daemon: epoll_wait failed: %s\n", strerror(errno));
+            continue;
         }
 
-        // Wait for something appearing in the pipes.
-        if (select(ndfs + 1, &rfds, NULL, NULL, NULL) > 0)
+        Logger::logDebug("Daemon: epoll_wait done.");
+
+        for (int i = 0; i < count; ++i)
         {
-            Logger::logDebug("Daemon: select done.");
+            uint64_t data = events[i].data.u64;
 
-            // Check if a booster died
-            if (FD_ISSET(m_boosterLauncherSocket[0], &rfds))
+            switch (event_source(data))
             {
-                Logger::logDebug("Daemon: FD_ISSET(m_boosterLauncherSocket[0])");
+            case EVENT_BOOSTER_SOCKET:
+                // Check if a booster died
+                Logger::logDebug("Daemon: event on m_boosterLauncherSocket[0]");
                 readFromBoosterSocket(m_boosterLauncherSocket[0]);
+                break;
+
+            case EVENT_SIGNAL_FD:
+                // Check if we got SIGCHLD, SIGTERM, SIGUSR1 or SIGUSR2
+                Logger::logDebug("Daemon: event on m_signalFd");
+                readFromSignalFd();
+                break;
+
+            case EVENT_INVOKER_SOCKET:
+                handleInvokerDisconnect(event_id(data));
+                break;
+
+            case EVENT_TIMER:
+                handleTimer();
+                break;
+
+            case EVENT_TERMINATION_SOCKET:
+                handleTerminationSocket(event_id(data));
+                break;
+
+            case EVENT_TERMINATION_PROCESS:
+                handleTerminationProcess(event_id(data));
+                break;
+
+            case EVENT_CHILD_PROCESS:
+                handleChildProcess(event_id(data));
+                break;
+
+            case EVENT_TEMPLATE_SOCKET:
+                handleTemplateSocket(event_id(data));
+                break;
+
+            case EVENT_LAUNCH_SOCKET:
+                // An invoker is waiting and there is no spare booster
+                if (m_boosterTypes[event_id(data)].watchingLaunchSocket)
+                    startBoosters(event_id(data), "invoker waiting");
+                break;
+
+            case EVENT_UPGRADE_SOCKET:
+                handleUpgradeSocket(event_id(data));
+                break;
+
+            case EVENT_CONTROL_SOCKET:
+                acceptControlClients();
+                break;
+
+            case EVENT_CONTROL_CLIENT:
+                readControlClient(event_id(data));
+                break;
+
+            case EVENT_CONTROL_RESPONSE:
+                writeControlClient(event_id(data));
+                break;
+
+            case EVENT_PROFILE_RECORDER:
+                handleProfileRecorder(event_id(data));
+                break;
+
+            default:
+                break;
             }
+        }
+    }
+}
 
-            // Check if we got SIGCHLD, SIGTERM, SIGUSR1 or SIGUSR2
-            if (FD_ISSET(m_sigPipeFd[0], &rfds))
+void Daemon::readFromSignalFd()
+{
+    // Several signals can be pending, read until the fd is drained
+    for (;;) {
+        struct signalfd_siginfo info;
+        ssize_t rc = read(m_signalFd, &info, sizeof info);
+        if (rc == -1 && errno == EINTR)
+            continue;
+        if (rc == -1 && errno == EAGAIN)
+            break;
+        if (rc != sizeof info) {
+            /* If we can't read from the signal fd,
+             * we might as well quit */
+            Logger::logError("signal fd read failure - terminating\n");
+            exit(EXIT_FAILURE);
+        }
+        Logger::logDebug("Daemon: signal=%u pid=%u", info.ssi_signo, info.ssi_pid);
+        handleSignal(info.ssi_signo);
+    }
+}
+
+void Daemon::handleSignal(int signal)
+{
+    switch (signal)
+    {
+    case SIGCHLD:
+        Logger::logDebug("Daemon: SIGCHLD received.");
+        // Children with a pidfd are reaped when it becomes readable
+        if (m_childrenWithoutPidFd > 0)
+            reapZombies();
+        break;
+
+    case SIGINT:
+    case SIGTERM: {
+        Logger::logDebug("Daemon: SIGINT / SIGTERM received.");
+
+        // FIXME: Legacy pid file path -> see daemonize()
+        const std::string pidFilePath = m_socketManager->socketRootPath() +
+                m_boosterTypes.front().booster->boosterType() + ".pid";
+        FILE * const pidFile = fopen(pidFilePath.c_str(), "r");
+        if (pidFile)
+        {
+            pid_t filePid;
+            if (fscanf(pidFile, "%d\n", &filePid) == 1 && filePid == getpid())
             {
-                Logger::logDebug("Daemon: FD_ISSET(m_sigPipeFd[0])");
-                int dataReceived = read_from_signal_pipe(m_sigPipeFd[0]);
-
-                switch (dataReceived)
-                {
-                case SIGCHLD:
-                    Logger::logDebug("Daemon: SIGCHLD received.");
-                    reapZombies();
-                    break;
-
-                case SIGINT:
-                case SIGTERM: {
-                    Logger::logDebug("Daemon: SIGINT / SIGTERM received.");
-
-                    // FIXME: Legacy pid file path -> see daemonize()
-                    const std::string pidFilePath = m_socketManager->socketRootPath() + m_booster->boosterType() + ".pid";
-                    FILE * const pidFile = fopen(pidFilePath.c_str(), "r");
-                    if (pidFile)
-                    {
-                        pid_t filePid;
-                        if (fscanf(pidFile, "%d\n", &filePid) == 1 && filePid == getpid())
-                        {
-                            unlink(pidFilePath.c_str());
-                        }
-                        fclose(pidFile);
-                    }
-
-                    for (;;) {
-                        PidVect::iterator iter(m_children.begin());
-                        if (iter == m_children.end())
-                            break;
-                        pid_t booster_pid = *iter;
-                        m_children.erase(iter);
-
-                        /* Get and remove booster socket  fd */
-                        int socket_fd = -1;
-                        FdMap::iterator fdIter = m_boosterPidToInvokerFd.find(booster_pid);
-                        if (fdIter != m_boosterPidToInvokerFd.end()) {
-                            socket_fd = (*fdIter).second;
-                            m_boosterPidToInvokerFd.erase(fdIter);
-                        }
-                        /* Get and remove invoker pid */
-                        pid_t invoker_pid = -1;
-                        PidMap::iterator pidIter = m_boosterPidToInvokerPid.find(booster_pid);
-                        if (pidIter != m_boosterPidToInvokerPid.end()) {
-                            invoker_pid = (*pidIter).second;
-                            m_boosterPidToInvokerPid.erase(pidIter);
-                        }
-
-                        /* Normally boosters are stopped on shutdown / user switch,
-                         * and even then it should happen after applications have
-                         * already been stopped.
-                         */
-                        warning("terminating: booster:%d invoker:%d socket:%d",
-                                (int)booster_pid, (int)invoker_pid, socket_fd);
-
-                        /* Terminate invoker */
-                        close_invoker(invoker_pid, socket_fd, EXIT_FAILURE);
-
-                        /* Terminate booster */
-                        kill_process("booster", booster_pid);
-                    }
-
-                    Logger::logDebug("booster exit");
-                    exit(EXIT_SUCCESS);
-                    break;
-                }
-
-                case SIGUSR1:
-                    Logger::logDebug("Daemon: SIGUSR1 received.");
-                    enterNormalMode();
-                    break;
-
-                case SIGUSR2:
-                    Logger::logDebug("Daemon: SIGUSR2 received.");
-                    enterBootMode();
-                    break;
-
-                case SIGPIPE:
-                    Logger::logDebug("Daemon: SIGPIPE received.");
-                    break;
-
-                default:
-                    break;
-                }
-                continue;
+                unlink(pidFilePath.c_str());
             }
+            fclose(pidFile);
+        }
 
-            /* Handle closed booster sockets */
-            for (auto iter = m_boosterPidToInvokerFd.begin(); iter != m_boosterPidToInvokerFd.end();) {
-                int socket_fd = iter->second;
-                if (socket_fd != -1 && FD_ISSET(socket_fd, &rfds)) {
-                    /* Note: bookkeeping must be updated first to avoid
-                     *       any ringing due to socket closes / child
-                     *       process exits.
-                     */
-                    pid_t booster_pid = iter->first;
-                    iter = m_boosterPidToInvokerFd.erase(iter);
-
-                    pid_t invoker_pid = -1;
-                    PidMap::iterator pidIter = m_boosterPidToInvokerPid.find(booster_pid);
-                    if (pidIter != m_boosterPidToInvokerPid.end()) {
-                        invoker_pid = pidIter->second;
-                        m_boosterPidToInvokerPid.erase(pidIter);
-                    }
-
-                    /* Note that it is slightly unexpected if we get here
-                     * as it means invoker exited rather than application.
-                     */
-                    warning("terminating: booster:%d invoker:%d socket:%d",
-                            (int)booster_pid, (int)invoker_pid, socket_fd);
-
-                    /* Terminate invoker */
-                    close_invoker(invoker_pid, socket_fd, EXIT_FAILURE);
-
-                    /* Terminate booster */
-                    kill_process("booster", booster_pid);
-                } else {
-                    ++iter;
-                }
-            }
+        if (m_exiting) {
+            Logger::logDebug("Daemon: already exiting");
+            break;
+        }
+
+        for (ChildMap::iterator iter = m_children.begin(); iter != m_children.end(); ++iter) {
+            Child &child = iter->second;
+
+            /* Normally boosters are stopped on shutdown / user switch,
+             * and even then it should happen after applications have
+             * already been stopped.
+             */
+            warning("terminating: booster:%d invoker:%d socket:%d",
+                    (int)child.pid, (int)child.invokerPid, child.invokerFd);
+
+            /* Terminate invoker */
+            closeInvoker(child, EXIT_FAILURE);
+
+            /* Terminate booster, the child record is released when it is reaped */
+            terminateProcess(child.pid == m_boosterTypes[child.type].templatePid ? "template" : "booster",
+                             child.pid, dup_pidfd(child.pidFd));
+        }
+
+        /* Exit once all terminations have finished, see finishTermination() */
+        m_exiting = true;
+        if (m_terminations.empty()) {
+            Logger::logDebug("booster exit");
+            exit(EXIT_SUCCESS);
+        }
+        break;
+    }
+
+    case SIGUSR1:
+        Logger::logDebug("Daemon: SIGUSR1 received.");
+        enterNormalMode();
+        break;
+
+    case SIGUSR2:
+        Logger::logDebug("Daemon: SIGUSR2 received.");
+        enterBootMode();
+        break;
+
+    case SIGPIPE:
+        Logger::logDebug("Daemon: SIGPIPE received.");
+        break;
+
+    default:
+        break;
+    }
+}
+
+void Daemon::handleInvokerDisconnect(pid_t booster_pid)
+{
+    ChildMap::iterator it = m_children.find(booster_pid);
+    if (it == m_children.end() || it->second.invokerFd == -1) {
+        /* Stale event: socket was already closed while
+         * handling an earlier event of the same batch.
+         */
+        return;
+    }
+    Child &child = it->second;
+
+    /* Note that it is slightly unexpected if we get here
+     * as it means invoker exited rather than application.
+     */
+    warning("terminating: booster:%d invoker:%d socket:%d",
+            (int)child.pid, (int)child.invokerPid, child.invokerFd);
+
+    /* Terminate invoker */
+    closeInvoker(child, EXIT_FAILURE);
+
+    /* Terminate booster */
+    terminateProcess("booster", child.pid, dup_pidfd(child.pidFd));
+}
+
+void Daemon::closeInvoker(Child &child, int exitStatus)
+{
+    /* Note: bookkeeping must be updated first to avoid
+     *       any ringing due to socket closes / child
+     *       process exits.
+     */
+    pid_t invokerPid = child.invokerPid;
+    int invokerPidFd = child.invokerPidFd;
+    int socketFd = child.invokerFd;
+    child.invokerPid = -1;
+    child.invokerPidFd = -1;
+    child.invokerFd = -1;
+
+    if (socketFd == -1) {
+        if (invokerPid != -1)
+            terminateProcess("invoker", invokerPid, invokerPidFd);
+        else if (invokerPidFd != -1)
+            close(invokerPidFd);
+        return;
+    }
+
+    unwatchFd(socketFd);
+
+    Logger::logWarning("Daemon: sending exit(%d) to invoker(%d)\n",
+                       exitStatus, (int)invokerPid);
+    uint32_t msg = INVOKER_MSG_EXIT;
+    uint32_t dta = exitStatus;
+    write_dontcare(socketFd, &msg, sizeof msg);
+    write_dontcare(socketFd, &dta, sizeof dta);
+
+    /* Close transmit end from our side, then wait for peer
+     * to receive EOF and close the receive end too. Invoker
+     * needs to be killed only if that does not happen.
+     */
+    debug("trying to disconnect booster socket...\n");
+    if (shutdown(socketFd, SHUT_WR) == -1) {
+        warning("socket shutdown failed: %m\n");
+        warning("could not disconnect booster socket\n");
+        close(socketFd);
+        if (invokerPid != -1)
+            terminateProcess("invoker", invokerPid, invokerPidFd);
+        else if (invokerPidFd != -1)
+            close(invokerPidFd);
+        return;
+    }
+
+    uint32_t id = m_nextTerminationId++;
+    Termination &termination = m_terminations[id];
+    termination.label = "invoker";
+    termination.pid = invokerPid;
+    termination.pidFd = invokerPidFd;
+    termination.socketFd = socketFd;
+    termination.stage = Termination::Disconnecting;
+    termination.deadline = timestamp() + INVOKER_DISCONNECT_TIMEOUT;
+
+    watchFd(socketFd, event_data(EVENT_TERMINATION_SOCKET, id));
+    if (invokerPidFd != -1)
+        watchFd(invokerPidFd, event_data(EVENT_TERMINATION_PROCESS, id));
+    armTimer();
+}
+
+void Daemon::terminateProcess(const char *label, pid_t pid, int pidFd)
+{
+    if (pid == -1) {
+        warning("%s pid is not known, can't kill it", label);
+        if (pidFd != -1)
+            close(pidFd);
+        return;
+    }
+
+    uint32_t id = m_nextTerminationId++;
+    Termination &termination = m_terminations[id];
+    termination.label = label;
+    termination.pid = pid;
+    termination.pidFd = pidFd;
+    if (pidFd != -1)
+        watchFd(pidFd, event_data(EVENT_TERMINATION_PROCESS, id));
+    termination.socketFd = -1;
+    termination.stage = Termination::Terminating;
+    termination.deadline = 0;
+
+    startKilling(id, SIGTERM);
+}
+
+void Daemon::startKilling(uint32_t id, int signal)
+{
+    TerminationMap::iterator it = m_terminations.find(id);
+    if (it == m_terminations.end())
+        return;
+    Termination &termination = it->second;
+
+    if (termination.pid == -1) {
+        finishTermination(id);
+        return;
+    }
+
+    /* Pidfd makes signaling immune to pid reuse and gives
+     * an exit notification also for non-child processes.
+     * It is normally obtained when the process is first seen,
+     * opening it only now is a fallback.
+     */
+    if (termination.pidFd == -1) {
+        termination.pidFd = pidfd_open_compat(termination.pid);
+        if (termination.pidFd != -1) {
+            watchFd(termination.pidFd, event_data(EVENT_TERMINATION_PROCESS, id));
+        } else if (errno == ESRCH) {
+            debug("%s (pid=%d) has exited", termination.label, (int)termination.pid);
+            finishTermination(id);
+            return;
         }
     }
+
+    warning("sending %s to %s (pid=%d)", signal == SIGKILL ? "SIGKILL" : "SIGTERM",
+            termination.label, (int)termination.pid);
+
+    int rc = (termination.pidFd != -1
+              ? pidfd_send_signal_compat(termination.pidFd, signal)
+              : kill(termination.pid, signal));
+    if (rc == -1) {
+        if (errno == ESRCH)
+            debug("%s (pid=%d) has exited", termination.label, (int)termination.pid);
+        else
+            warning("%s (pid=%d) kill failed: %m", termination.label, (int)termination.pid);
+        finishTermination(id);
+        return;
+    }
+
+    termination.stage = (signal == SIGKILL) ? Termination::Killing : Termination::Terminating;
+    termination.deadline = timestamp() + PROCESS_EXIT_TIMEOUT;
+    armTimer();
+}
+
+void Daemon::finishTermination(uint32_t id)
+{
+    TerminationMap::iterator it = m_terminations.find(id);
+    if (it == m_terminations.end())
+        return;
+
+    Termination &termination = it->second;
+    if (termination.socketFd != -1) {
+        unwatchFd(termination.socketFd);
+        close(termination.socketFd);
+    }
+    if (termination.pidFd != -1) {
+        unwatchFd(termination.pidFd);
+        close(termination.pidFd);
+    }
+    m_terminations.erase(it);
+
+    armTimer();
+
+    if (m_exiting && m_terminations.empty()) {
+        Logger::logDebug("booster exit");
+        exit(EXIT_SUCCESS);
+    }
+}
+
+void Daemon::handleTerminationSocket(uint32_t id)
+{
+    TerminationMap::iterator it = m_terminations.find(id);
+    if (it == m_terminations.end())
+        return;
+    Termination &termination = it->second;
+
+    char buf[256];
+    ssize_t rc = recv(termination.socketFd, buf, sizeof buf, MSG_DONTWAIT);
+    if (rc > 0 || (rc == -1 && (errno == EINTR || errno == EAGAIN)))
+        return;
+
+    unwatchFd(termination.socketFd);
+    close(termination.socketFd);
+    termination.socketFd = -1;
+
+    if (rc == 0) {
+        /* EOF -> peer closed the socket */
+        debug("booster socket was succesfully disconnected\n");
+        finishTermination(id);
+    } else {
+        warning("socket read failed: %m\n");
+        warning("could not disconnect booster socket\n");
+        startKilling(id, SIGTERM);
+    }
+}
+
+void Daemon::handleTerminationProcess(uint32_t id)
+{
+    TerminationMap::iterator it = m_terminations.find(id);
+    if (it == m_terminations.end())
+        return;
+
+    debug("%s (pid=%d) has exited", it->second.label, (int)it->second.pid);
+    finishTermination(id);
+}
+
+void Daemon::handleTimer()
+{
+    uint64_t expirations = 0;
+    if (read(m_timerFd, &expirations, sizeof expirations) == -1 && errno != EAGAIN)
+        Logger::logWarning("Daemon: timer read failed: %s\n", strerror(errno));
+
+    unsigned now = timestamp();
+
+    vector<uint32_t> expired;
+    vector<uint32_t> exited;
+    for (TerminationMap::iterator it = m_terminations.begin(); it != m_terminations.end(); ++it) {
+        const Termination &termination = it->second;
+        if ((int)(now - termination.deadline) >= 0)
+            expired.push_back(it->first);
+        else if (termination.stage != Termination::Disconnecting && termination.pidFd == -1 &&
+                 kill(termination.pid, 0) == -1 && errno == ESRCH)
+            exited.push_back(it->first);
+    }
+
+    for (size_t i = 0; i < exited.size(); ++i) {
+        debug("%s (pid=%d) has exited", m_terminations[exited[i]].label,
+              (int)m_terminations[exited[i]].pid);
+        finishTermination(exited[i]);
+    }
+
+    for (size_t i = 0; i < expired.size(); ++i) {
+        TerminationMap::iterator it = m_terminations.find(expired[i]);
+        if (it == m_terminations.end())
+            continue;
+        Termination &termination = it->second;
+
+        switch (termination.stage) {
+        case Termination::Disconnecting:
+            warning("socket poll timeout\n");
+            warning("could not disconnect booster socket\n");
+            unwatchFd(termination.socketFd);
+            close(termination.socketFd);
+            termination.socketFd = -1;
+            startKilling(expired[i], SIGTERM);
+            break;
+
+        case Termination::Terminating:
+            startKilling(expired[i], SIGKILL);
+            break;
+
+        case Termination::Killing:
+            warning("%s (pid=%d) did not exit", termination.label, (int)termination.pid);
+            finishTermination(expired[i]);
+            break;
+        }
+    }
+
+    for (uint32_t type = 0; type < m_boosterTypes.size(); ++type) {
+        BoosterType &boosterType = m_boosterTypes[type];
+        if (boosterType.templatePid != -1 &&
+            (!boosterType.templateReady || boosterType.templateForking) &&
+            (int)(now - boosterType.templateDeadline) >= 0) {
+            if (boosterType.templateReady)
+                Logger::logWarning("Daemon: booster template of type '%s' is not responding",
+                                   boosterType.booster->boosterType().c_str());
+            else
+                Logger::logWarning("Daemon: booster template of type '%s' did not get ready in time",
+                                   boosterType.booster->boosterType().c_str());
+            templateFailed(type);
+
+            // Boosters might have been waiting for the template
+            fillBoosterPool(type);
+        }
+
+        checkRespawn(type);
+    }
+
+    recordProfiles(now);
+
+    armTimer();
+}
+
+void Daemon::recordProfiles(unsigned now)
+{
+    for (PendingProfileVector::iterator it = m_pendingProfiles.begin(); it != m_pendingProfiles.end(); ) {
+        if ((int)(now - it->deadline) < 0) {
+            ++it;
+            continue;
+        }
+
+        startProfileRecorder(it->pid, it->fileName);
+        it = m_pendingProfiles.erase(it);
+    }
+}
+
+void Daemon::startProfileRecorder(pid_t appPid, const string &fileName)
+{
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        Logger::logWarning("Daemon: could not record launch profile of %s: %m", fileName.c_str());
+        return;
+    }
+
+    // Reading the page tables and the files of a large application takes
+    // a while, the recorder process keeps it out of the event loop. It is
+    // a grandchild, so that only the intermediate child, which exits right
+    // away, is waited for here and the recorder never needs to be reaped.
+    pid_t pid = fork();
+    if (pid == -1) {
+        Logger::logWarning("Daemon: could not record launch profile of %s: %m", fileName.c_str());
+        close(fds[0]);
+        close(fds[1]);
+        return;
+    }
+
+    if (pid == 0 && fork() == 0) {
+        close(fds[0]);
+
+        ProfileResult result;
+        memset(&result, 0, sizeof result);
+
+        LaunchProfile previous(fileName);
+        result.replayed = previous.load();
+
+        LaunchProfile profile(fileName);
+        result.recorded = profile.record(appPid) && profile.save();
+        result.pages = profile.pages();
+        result.hits = profile.commonPages(previous);
+        result.prefetched = previous.pages();
+
+        ssize_t rc = write(fds[1], &result, sizeof result);
+        _exit(rc == sizeof result ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    if (pid == 0)
+        _exit(EXIT_SUCCESS);
+
+    close(fds[1]);
+    while (waitpid(pid, NULL, 0) == -1 && errno == EINTR)
+        ;
+
+    ProfileRecorder &recorder = m_profileRecorders[fds[0]];
+    recorder.appPid = appPid;
+    recorder.fileName = fileName;
+    watchFd(fds[0], event_data(EVENT_PROFILE_RECORDER, fds[0]));
+}
+
+void Daemon::handleProfileRecorder(int fd)
+{
+    ProfileRecorderMap::iterator it = m_profileRecorders.find(fd);
+    if (it == m_profileRecorders.end())
+        return;
+
+    const ProfileRecorder &recorder = it->second;
+    ProfileResult result;
+    ssize_t rc;
+    while ((rc = read(fd, &result, sizeof result)) == -1 && errno == EINTR)
+        ;
+
+    if (rc != sizeof result || !result.recorded) {
+        Logger::logWarning("Daemon: could not record launch profile of %s (pid=%d)",
+                           recorder.fileName.c_str(), (int)recorder.appPid);
+    } else if (result.replayed) {
+        // Hits are pages of the working set that the previous profile prefetched
+        Logger::logInfo("Daemon: launch profile of %s: %lu pages, prefetch hit rate %lu%% "
+                        "(%lu of %lu prefetched pages used)", recorder.fileName.c_str(), result.pages,
+                        result.pages ? result.hits * 100 / result.pages : 0, result.hits,
+                        result.prefetched);
+    } else {
+        Logger::logInfo("Daemon: launch profile of %s: %lu pages, no previous profile",
+                        recorder.fileName.c_str(), result.pages);
+    }
+
+    // The recorder exits right after writing the result
+    unwatchFd(fd);
+    close(fd);
+    m_profileRecorders.erase(it);
+}
+
+void Daemon::openTrace()
+{
+    if (!m_traceRecords)
+        return;
+
+    const string directory = m_socketManager->socketRootPath() + "trace";
+    if (trace_open(directory.c_str(), m_traceRecords) == -1) {
+        Logger::logWarning("Daemon: Failed to open trace in %s: %s\n",
+                           directory.c_str(), strerror(errno));
+        return;
+    }
+
+    // Traces of processes of earlier runs are not needed anymore
+    trace_prune();
+    Logger::logInfo("Daemon: tracing to %s", directory.c_str());
+}
+
+void Daemon::keepTrace(pid_t pid)
+{
+    m_exitedTraces.push_back(pid);
+    if (m_exitedTraces.size() > TRACE_KEEP_EXITED) {
+        trace_remove(m_exitedTraces.front());
+        m_exitedTraces.erase(m_exitedTraces.begin());
+    }
+}
+
+void Daemon::armTimer()
+{
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof spec);
+
+    unsigned now = timestamp();
+    unsigned timeout = UINT_MAX;
+
+    for (TerminationMap::iterator it = m_terminations.begin(); it != m_terminations.end(); ++it) {
+        const Termination &termination = it->second;
+        int left = (int)(termination.deadline - now);
+        timeout = std::min(timeout, (unsigned)std::max(left, 0));
+        if (termination.stage != Termination::Disconnecting && termination.pidFd == -1)
+            timeout = std::min(timeout, PROCESS_POLL_INTERVAL);
+    }
+
+    for (BoosterTypeVector::const_iterator it = m_boosterTypes.begin(); it != m_boosterTypes.end(); ++it) {
+        if (it->respawnScheduler->isPending()) {
+            int left = (int)(it->respawnScheduler->nextCheck() - now);
+            timeout = std::min(timeout, (unsigned)std::max(left, 0));
+        }
+
+        if (it->templatePid != -1 && (!it->templateReady || it->templateForking)) {
+            int left = (int)(it->templateDeadline - now);
+            timeout = std::min(timeout, (unsigned)std::max(left, 0));
+        }
+    }
+
+    for (PendingProfileVector::const_iterator it = m_pendingProfiles.begin(); it != m_pendingProfiles.end(); ++it) {
+        int left = (int)(it->deadline - now);
+        timeout = std::min(timeout, (unsigned)std::max(left, 0));
+    }
+
+    if (timeout != UINT_MAX) {
+        /* Zero would disarm the timer */
+        timeout = std::max(timeout, 1u);
+        spec.it_value.tv_sec = timeout / 1000;
+        spec.it_value.tv_nsec = (timeout % 1000) * 1000 * 1000;
+    }
+
+    if (timerfd_settime(m_timerFd, 0, &spec, NULL) == -1)
+        Logger::logError("Daemon: Failed to arm timer: %s\n", strerror(errno));
+}
+
+void Daemon::watchFd(int fd, uint64_t data)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof event);
+    event.events = EPOLLIN;
+    event.data.u64 = data;
+
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &event) == -1)
+        Logger::logError("Daemon: Failed to watch fd=%d: %s\n", fd, strerror(errno));
+}
+
+void Daemon::watchFdOutput(int fd, uint64_t data)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof event);
+    event.events = EPOLLOUT;
+    event.data.u64 = data;
+
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_MOD, fd, &event) == -1)
+        Logger::logError("Daemon: Failed to watch fd=%d for writing: %s\n", fd, strerror(errno));
+}
+
+void Daemon::unwatchFd(int fd)
+{
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, NULL) == -1)
+        Logger::logWarning("Daemon: Failed to unwatch fd=%d: %s\n", fd, strerror(errno));
+}
+
+void Daemon::storeInvoker(pid_t boosterPid, pid_t invokerPid, int socketFd)
+{
+    ChildMap::iterator it = m_children.find(boosterPid);
+    if (it == m_children.end()) {
+        if (socketFd != -1)
+            close(socketFd);
+        return;
+    }
+    Child &child = it->second;
+
+    child.invokerPid = invokerPid > 0 ? invokerPid : -1;
+    child.invokerPidFd = peer_pidfd(socketFd, child.invokerPid);
+    child.invokerFd = socketFd;
+    if (socketFd != -1)
+        watchFd(socketFd, event_data(EVENT_INVOKER_SOCKET, boosterPid));
+}
+
+void Daemon::raiseFileLimit()
+{
+    if (getrlimit(RLIMIT_NOFILE, &m_originalFileLimit) == -1) {
+        Logger::logWarning("Daemon: Failed to get file limit: %s\n", strerror(errno));
+        m_originalFileLimit.rlim_cur = m_originalFileLimit.rlim_max = RLIM_INFINITY;
+        return;
+    }
+
+    struct rlimit limit = m_originalFileLimit;
+    limit.rlim_cur = limit.rlim_max;
+    if (limit.rlim_cur != m_originalFileLimit.rlim_cur && setrlimit(RLIMIT_NOFILE, &limit) == -1)
+        Logger::logWarning("Daemon: Failed to raise file limit: %s\n", strerror(errno));
+}
+
+void Daemon::restoreFileLimit()
+{
+    if (m_originalFileLimit.rlim_cur != RLIM_INFINITY &&
+        setrlimit(RLIMIT_NOFILE, &m_originalFileLimit) == -1)
+        Logger::logWarning("Daemon: Failed to restore file limit: %s\n", strerror(errno));
 }
 
 void Daemon::readFromBoosterSocket(int fd)
+{
+    while (readBoosterMessage(fd))
+        ;
+}
+
+bool Daemon::readBoosterMessage(int fd)
 {
     pid_t invokerPid = 0;
     int delay = 0;
+    pid_t boosterPid = 0;
+    int missed = 0;
+    int timing = 0;
+    unsigned int handshakeTime = 0;
     int socketFd = -1;
+    char fileName[PATH_MAX];
+
+    // Handling the report is a stage of the launch, see --timing
+    LaunchTiming launchTiming;
+    launchTiming.start();
 
-    struct iovec iov[2];
+    struct iovec iov[7];
     char buf[CMSG_SPACE(sizeof socketFd)];
     struct msghdr msg;
     struct cmsghdr *cmsg;
@@ -569,19 +1210,39 @@ void Daemon::readFromBoosterSocket(int fd)
     iov[0].iov_len = sizeof invokerPid;
     iov[1].iov_base = &delay;
     iov[1].iov_len = sizeof delay;
+    iov[2].iov_base = &boosterPid;
+    iov[2].iov_len = sizeof boosterPid;
+    iov[3].iov_base = &missed;
+    iov[3].iov_len = sizeof missed;
+    iov[4].iov_base = &timing;
+    iov[4].iov_len = sizeof timing;
+    iov[5].iov_base = &handshakeTime;
+    iov[5].iov_len = sizeof handshakeTime;
+    iov[6].iov_base = fileName;
+    iov[6].iov_len = sizeof fileName;
 
     msg.msg_iov        = iov;
-    msg.msg_iovlen     = 2;
+    msg.msg_iovlen     = 7;
     msg.msg_name       = NULL;
     msg.msg_namelen    = 0;
     msg.msg_control    = buf;
     msg.msg_controllen = sizeof buf;
 
-    if (recvmsg(fd, &msg, 0) == -1) {
+    ssize_t length = recvmsg(fd, &msg, MSG_DONTWAIT);
+    if (length == -1) {
+        if (errno == EAGAIN || errno == EINTR)
+            return false;
         Logger::logError("Daemon: Critical error communicating with booster. Exiting applauncherd.\n");
         exit(EXIT_FAILURE);
     }
 
+    // Path of the launched binary follows the fixed size fields
+    size_t fixedLength = sizeof invokerPid + sizeof delay + sizeof boosterPid + sizeof missed +
+                         sizeof timing + sizeof handshakeTime;
+    size_t nameLength = (size_t)length > fixedLength ? length - fixedLength : 0;
+    if (nameLength > 0 && fileName[nameLength - 1] != '\0')
+        nameLength = 0;
+
     for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
         if (cmsg->cmsg_level == SOL_SOCKET &&
             cmsg->cmsg_type == SCM_RIGHTS &&
@@ -590,18 +1251,52 @@ void Daemon::readFromBoosterSocket(int fd)
         }
     }
 
-    Logger::logDebug("Daemon: booster=%d invoker=%d socket=%d delay=%d\n",
-                     m_boosterPid, invokerPid, socketFd, delay);
+    Logger::logDebug("Daemon: booster=%d invoker=%d socket=%d delay=%d missed=%d\n",
+                     boosterPid, invokerPid, socketFd, delay, missed);
+
+    ChildMap::iterator it = m_children.find(boosterPid);
+    if (boosterPid <= 0 || it == m_children.end()) {
+        Logger::logWarning("Daemon: message from unknown booster (pid=%d)\n", boosterPid);
+        if (socketFd != -1)
+            close(socketFd);
+        return true;
+    }
+    uint32_t type = it->second.type;
+    BoosterPool *pool = m_boosterTypes[type].pool;
 
-    if (m_boosterPid > 0) {
+    if (pool->remove(boosterPid)) {
         /* We were expecting booster details => update bookkeeping */
-        if (socketFd != -1) {
-            // Store booster pid - invoker socket pair
-            m_boosterPidToInvokerFd[m_boosterPid] = socketFd, socketFd = -1;
+        // The booster loads the binary right after reporting it, get the
+        // disk IO of a cold launch going before the bookkeeping below
+        if (nameLength > 1)
+            Prefetcher::start(fileName);
+
+        closeUpgradeSocket(it->second);
+        int invokerFd = socketFd;
+        storeInvoker(boosterPid, invokerPid, socketFd), socketFd = -1;
+        pool->recordLaunch(timestamp(), missed);
+
+        if (nameLength > 1)
+            it->second.binary = fileName;
+
+        const string &typeName = m_boosterTypes[type].booster->boosterType();
+        m_metrics->recordLaunch(typeName, nameLength > 1 ? fileName : "", missed);
+        m_metrics->record(typeName, LaunchMetrics::Handshake, handshakeTime);
+        reportPoolStatus(type);
+
+        // The invoker connection is passed only if it waits for the exit status
+        if (timing && invokerFd != -1) {
+            launchTiming.mark(INVOKER_TIMING_DAEMON);
+            launchTiming.send(invokerFd);
         }
-        if (invokerPid > 0) {
-            // Store booster pid - invoker pid pair
-            m_boosterPidToInvokerPid[m_boosterPid] = invokerPid;
+
+        if (m_profileDelay > 0 && nameLength > 1) {
+            PendingProfile profile;
+            profile.pid = boosterPid;
+            profile.fileName = fileName;
+            profile.deadline = timestamp() + m_profileDelay;
+            m_pendingProfiles.push_back(profile);
+            armTimer();
         }
     }
 
@@ -611,226 +1306,800 @@ void Daemon::readFromBoosterSocket(int fd)
         close(socketFd);
     }
 
-    // 2nd param guarantees some time for the just launched application
+    // Param guarantees some time for the just launched application
     // to start up before forking new booster. Not doing this would
     // slow down the start-up significantly on single core CPUs.
+    // The delay is an upper limit, see RespawnScheduler.
+
+    fillBoosterPool(type, 0, std::max(delay, 0) * 1000u);
+    return true;
+}
+
+void Daemon::killProcess(pid_t pid, int signal)
+{
+    ChildMap::iterator it = m_children.find(pid);
+    if (it != m_children.end())
+    {
+        Logger::logWarning("Daemon: Killing pid %d with %d", pid, signal);
+        int pidFd = it->second.pidFd;
+        if ((pidFd != -1 ? pidfd_send_signal_compat(pidFd, signal) : kill(pid, signal)) != 0)
+        {
+            Logger::logError("Daemon: Failed to kill %d: %s\n",
+                             pid, strerror(errno));
+        }
+    }
+}
+
+void Daemon::loadSingleInstancePlugin()
+{
+    void * handle = dlopen(SINGLE_INSTANCE_PATH, RTLD_NOW);
+    if (!handle)
+    {
+        Logger::logWarning("Daemon: dlopening single-instance failed: %s", dlerror());
+    }
+    else
+    {
+        if (m_singleInstance->validateAndRegisterPlugin(handle))
+        {
+            Logger::logDebug("Daemon: single-instance plugin loaded.'");
+        }
+        else
+        {
+            Logger::logWarning("Daemon: Invalid single-instance plugin: '%s'",
+                               SINGLE_INSTANCE_PATH);
+        }
+    }
+}
+
+void Daemon::dropCapabilities()
+{
+    cap_t caps = cap_init();
+
+    if (!caps || cap_set_proc(caps) == -1) {
+        Logger::logError("Daemon: Failed to drop capabilities");
+    }
+
+    if (caps) {
+        cap_free(caps);
+    }
+}
+
+bool Daemon::forkBooster(uint32_t type)
+{
+    BoosterType &boosterType = m_boosterTypes[type];
+
+    // Use an already warm template process if possible
+    if (m_useTemplate && !m_bootMode && templateAvailable(type)) {
+        // Boosters are forked when the template is ready, one at a time
+        if (!boosterType.templateReady || boosterType.templateForking)
+            return false;
+        if (forkFromTemplate(type))
+            return true;
+    }
+
+    int upgradeSocket[2];
+    createUpgradeSocket(upgradeSocket);
+
+    // Fork a new process
+    pid_t newPid = fork();
+
+    if (newPid == -1)
+        throw std::runtime_error("Daemon: Forking while invoking");
+
+    if (newPid == 0) /* Child process */
+    {
+        prepareChild();
+        if (upgradeSocket[0] != -1)
+            close(upgradeSocket[0]);
+
+        // Will get this signal if applauncherd dies
+        prctl(PR_SET_PDEATHSIG, SIGHUP);
+
+        runBooster(type, upgradeSocket[1]);
+    }
+    else /* Parent process */
+    {
+        if (upgradeSocket[1] != -1)
+            close(upgradeSocket[1]);
+
+        APPMOTOR_PROBE3(daemon_fork_booster, boosterType.booster->boosterType().c_str(), newPid, 0);
+
+        // Store the pid so that we can reap it later
+        addChild(newPid, type);
+        storeUpgradeSocket(newPid, upgradeSocket[0]);
+
+        // Track the new spare booster so that we know which
+        // booster to restart when a booster exits.
+        boosterType.pool->add(newPid);
+    }
+
+    return true;
+}
+
+void Daemon::prepareChild()
+{
+    // Will be reopened with new identity when/if
+    // there is something to report
+    Logger::closeLog();
+
+    // The inherited trace mapping belongs to the daemon
+    trace_reopen();
+
+    // Restore signal mask
+    restoreUnixSignals();
+
+    // Close unused read end of the booster socket
+    close(m_boosterLauncherSocket[0]);
+
+    // Close signal fd
+    close(m_signalFd);
+
+    // Close the event loop, the booster has no use for it
+    close(m_epollFd);
+    close(m_timerFd);
+
+    // Close connections to the template processes
+    for (BoosterTypeVector::const_iterator it = m_boosterTypes.begin(); it != m_boosterTypes.end(); ++it)
+    {
+        if (it->templateSocket != -1)
+            close(it->templateSocket);
+        if (it->templateUpgradeSocket != -1)
+            close(it->templateUpgradeSocket);
+    }
+
+    // Close descriptors of pending terminations
+    for (TerminationMap::iterator t = m_terminations.begin(); t != m_terminations.end(); ++t)
+    {
+        if (t->second.socketFd != -1)
+            close(t->second.socketFd);
+        if (t->second.pidFd != -1)
+            close(t->second.pidFd);
+    }
+
+    // Close the result pipes of profile recorders
+    for (ProfileRecorderMap::iterator r = m_profileRecorders.begin(); r != m_profileRecorders.end(); ++r)
+        close(r->first);
+
+    // Close the control socket and its clients
+    m_socketManager->closeSocket(controlSocketId());
+    for (ControlClientMap::iterator c = m_controlClients.begin(); c != m_controlClients.end(); ++c)
+        close(c->second.fd);
+
+    // Do not pass the raised file limit on to applications
+    restoreFileLimit();
+
+    // Close descriptors of other children and their invokers
+    for (ChildMap::iterator c = m_children.begin(); c != m_children.end(); ++c)
+    {
+        if (c->second.pidFd != -1)
+            close(c->second.pidFd);
+        if (c->second.invokerPidFd != -1)
+            close(c->second.invokerPidFd);
+        if (c->second.invokerFd != -1)
+            close(c->second.invokerFd);
+        if (c->second.upgradeFd != -1)
+            close(c->second.upgradeFd);
+    }
+}
+
+void Daemon::createUpgradeSocket(int sv[2])
+{
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+        Logger::logWarning("Daemon: Creating an upgrade socket failed: %s\n", strerror(errno));
+        sv[0] = sv[1] = -1;
+    }
+}
+
+void Daemon::closeUpgradeSocket(Child &child)
+{
+    if (child.upgradeFd != -1) {
+        unwatchFd(child.upgradeFd);
+        close(child.upgradeFd);
+        child.upgradeFd = -1;
+    }
+}
+
+void Daemon::storeUpgradeSocket(pid_t pid, int upgradeFd)
+{
+    m_children[pid].upgradeFd = upgradeFd;
+    if (upgradeFd != -1)
+        watchFd(upgradeFd, event_data(EVENT_UPGRADE_SOCKET, pid));
+}
+
+void Daemon::handleUpgradeSocket(pid_t pid)
+{
+    ChildMap::iterator it = m_children.find(pid);
+    if (it == m_children.end() || it->second.upgradeFd == -1)
+        return;
+
+    Child &child = it->second;
+    for (;;) {
+        Booster::WarmupReport report;
+        ssize_t rc = recv(child.upgradeFd, &report, sizeof report, MSG_DONTWAIT);
+        if (rc == -1 && errno == EINTR)
+            continue;
+        if (rc == -1 && errno == EAGAIN)
+            break;
+        if (rc != sizeof report) {
+            // Booster has been launched or exited
+            closeUpgradeSocket(child);
+            break;
+        }
+
+        const string &typeName = m_boosterTypes[child.type].booster->boosterType();
+        if (child.warmupLevel < 0)
+            m_metrics->record(typeName, LaunchMetrics::BoosterReady, (timestamp() - child.started) * 1000ull);
+        m_metrics->record(typeName, LaunchMetrics::Warmup, report.microseconds);
+
+        child.warmupLevel = report.level;
+        child.warmupTime += report.microseconds / 1000;
+        m_boosterTypes[child.type].lastWarmupTime = child.warmupTime;
+        Logger::logDebug("Daemon: booster %d ready at level %d after %u ms",
+                         pid, report.level, child.warmupTime);
+    }
+}
+
+void Daemon::runBooster(uint32_t type, int upgradeFd)
+{
+    Booster *booster = m_boosterTypes[type].booster;
+    booster->setUpgradeSocket(upgradeFd);
+
+    // Set session id
+    if (setsid() < 0)
+        Logger::logError("Daemon: Couldn't set session id\n");
+
+    Logger::logDebug("Daemon: Running a new Booster of type '%s'", booster->boosterType().c_str());
+
+    closeOtherSockets(type);
+
+    // Initialize and wait for commands from invoker
+    try {
+        booster->initialize(m_initialArgc, m_initialArgv, m_boosterLauncherSocket[1],
+                            m_socketManager->findSocket(booster->socketId()),
+                            m_singleInstance, m_bootMode);
+    } catch (const std::runtime_error &e) {
+        Logger::logError("Booster: Failed to initialize: %s\n", e.what());
+        delete booster;
+        _exit(EXIT_FAILURE);
+    }
+
+    m_instance = NULL;
+
+    // No need for capabilities anymore
+    dropCapabilities();
+
+    // Run the current Booster
+    int retval = booster->run(m_socketManager);
+
+    // Finish
+    delete booster;
+
+    // _exit() instead of exit() to avoid situation when destructors
+    // for static objects may be run incorrectly
+    _exit(retval);
+}
+
+void Daemon::closeOtherSockets(uint32_t type)
+{
+    for (uint32_t other = 0; other < m_boosterTypes.size(); ++other)
+    {
+        if (other != type)
+            m_socketManager->closeSocket(m_boosterTypes[other].booster->socketId());
+    }
+}
+
+void Daemon::startTemplate(uint32_t type)
+{
+    BoosterType &boosterType = m_boosterTypes[type];
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+        Logger::logError("Daemon: Creating a socket pair for the template failed: %s\n",
+                         strerror(errno));
+        return;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        Logger::logError("Daemon: Forking the template failed: %s\n", strerror(errno));
+        close(sv[0]);
+        close(sv[1]);
+        return;
+    }
+
+    if (pid == 0) /* Child process */
+    {
+        prepareChild();
+        close(sv[0]);
+
+        // Will get this signal if applauncherd dies
+        prctl(PR_SET_PDEATHSIG, SIGHUP);
+
+        runTemplate(type, sv[1]);
+    }
+
+    close(sv[1]);
+    boosterType.templateSocket = sv[0];
+    boosterType.templatePid = pid;
+    boosterType.templateReady = false;
+    boosterType.templateDeadline = timestamp() + TEMPLATE_START_TIMEOUT;
+    addChild(pid, type);
+
+    // Wait for the template to report that it is ready
+    watchFd(boosterType.templateSocket, event_data(EVENT_TEMPLATE_SOCKET, type));
+    armTimer();
+
+    Logger::logInfo("Daemon: started booster template of type '%s' (pid=%d)",
+                    boosterType.booster->boosterType().c_str(), pid);
+}
+
+void Daemon::stopTemplate(uint32_t type)
+{
+    BoosterType &boosterType = m_boosterTypes[type];
+    if (boosterType.templatePid == -1)
+        return;
+
+    // Template exits when the socket is closed and is reaped as usual
+    if (!boosterType.templateReady || boosterType.templateForking)
+        unwatchFd(boosterType.templateSocket);
+    close(boosterType.templateSocket);
+    if (boosterType.templateUpgradeSocket != -1)
+        close(boosterType.templateUpgradeSocket);
+    boosterType.templateSocket = -1;
+    boosterType.templateUpgradeSocket = -1;
+    boosterType.templatePid = -1;
+    boosterType.templateReady = false;
+    boosterType.templateForking = false;
+}
+
+void Daemon::stopTemplates()
+{
+    for (uint32_t type = 0; type < m_boosterTypes.size(); ++type)
+        stopTemplate(type);
+}
+
+void Daemon::runTemplate(uint32_t type, int fd)
+{
+    if (setsid() < 0)
+        Logger::logError("Daemon: Couldn't set session id\n");
+
+    closeOtherSockets(type);
+
+    m_boosterTypes[type].booster->initializeTemplate(m_initialArgc, m_initialArgv);
+
+    // Tell the daemon that warm boosters can be requested
+    pid_t pid = 0;
+    if (send(fd, &pid, sizeof pid, MSG_NOSIGNAL) != sizeof pid)
+        _exit(EXIT_FAILURE);
+
+    for (;;) {
+        // Request carries the upgrade socket of the booster, if any
+        char request = 0;
+        int upgradeFd = -1;
+        struct iovec iov = { &request, sizeof request };
+        char buf[CMSG_SPACE(sizeof upgradeFd)];
+        struct msghdr msg;
+        memset(buf, 0, sizeof buf);
+        memset(&msg, 0, sizeof msg);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = buf;
+        msg.msg_controllen = sizeof buf;
+
+        ssize_t rc = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        if (rc == -1 && errno == EINTR)
+            continue;
+        if (rc != sizeof request) {
+            // Daemon closed the socket or exited
+            _exit(rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+            cmsg->cmsg_len >= CMSG_LEN(sizeof upgradeFd))
+            memcpy(&upgradeFd, CMSG_DATA(cmsg), sizeof upgradeFd);
+
+        pid = clone_parent();
+        if (pid == 0) {
+            close(fd);
+            trace_reopen();
+
+            // Parent is applauncherd, not the template
+            prctl(PR_SET_PDEATHSIG, SIGHUP);
+
+            runBooster(type, upgradeFd);
+        }
+
+        if (upgradeFd != -1)
+            close(upgradeFd);
+
+        if (pid == -1)
+            Logger::logError("Daemon: Template failed to fork a booster: %s\n", strerror(errno));
 
-    forkBooster(delay);
+        if (send(fd, &pid, sizeof pid, MSG_NOSIGNAL) != sizeof pid)
+            _exit(EXIT_FAILURE);
+    }
 }
 
-void Daemon::killProcess(pid_t pid, int signal) const
+bool Daemon::templateAvailable(uint32_t type)
 {
-    if (pid > 0)
-    {
-        Logger::logWarning("Daemon: Killing pid %d with %d", pid, signal);
-        if (kill(pid, signal) != 0)
-        {
-            Logger::logError("Daemon: Failed to kill %d: %s\n",
-                             pid, strerror(errno));
-        }
+    BoosterType &boosterType = m_boosterTypes[type];
+    if (boosterType.templatePid == -1) {
+        // Do not keep restarting a failing template
+        if (boosterType.templateRetry && (int)(timestamp() - boosterType.templateRetry) < 0)
+            return false;
+        boosterType.templateRetry = 0;
+        startTemplate(type);
     }
+    return boosterType.templatePid != -1;
 }
 
-void Daemon::loadSingleInstancePlugin()
+void Daemon::templateFailed(uint32_t type)
 {
-    void * handle = dlopen(SINGLE_INSTANCE_PATH, RTLD_NOW);
-    if (!handle)
-    {
-        Logger::logWarning("Daemon: dlopening single-instance failed: %s", dlerror());
-    }
-    else
-    {
-        if (m_singleInstance->validateAndRegisterPlugin(handle))
-        {
-            Logger::logDebug("Daemon: single-instance plugin loaded.'");
-        }
-        else
-        {
-            Logger::logWarning("Daemon: Invalid single-instance plugin: '%s'",
-                               SINGLE_INSTANCE_PATH);
-        }
-    }
+    BoosterType &boosterType = m_boosterTypes[type];
+    pid_t pid = boosterType.templatePid;
+    int pidFd = -1;
+    ChildMap::iterator it = m_children.find(pid);
+    if (it != m_children.end())
+        pidFd = dup_pidfd(it->second.pidFd);
+
+    stopTemplate(type);
+    boosterType.templateRetry = timestamp() + TEMPLATE_RETRY_DELAY;
+    m_metrics->recordTemplateFallback(boosterType.booster->boosterType());
+    Logger::logWarning("Daemon: booster template of type '%s' failed, forking boosters directly",
+                       boosterType.booster->boosterType().c_str());
+
+    if (pid != -1 && it != m_children.end())
+        terminateProcess("template", pid, pidFd);
+    else if (pidFd != -1)
+        close(pidFd);
 }
 
-void Daemon::dropCapabilities()
+void Daemon::handleTemplateSocket(uint32_t type)
 {
-    cap_t caps = cap_init();
+    BoosterType &boosterType = m_boosterTypes[type];
+    if (boosterType.templatePid == -1)
+        return;
 
-    if (!caps || cap_set_proc(caps) == -1) {
-        Logger::logError("Daemon: Failed to drop capabilities");
+    if (boosterType.templateForking) {
+        handleTemplateFork(type);
+        return;
     }
 
-    if (caps) {
-        cap_free(caps);
+    if (boosterType.templateReady)
+        return;
+
+    pid_t pid = -1;
+    ssize_t rc = recv(boosterType.templateSocket, &pid, sizeof pid, MSG_DONTWAIT);
+    if (rc == -1 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (rc != sizeof pid || pid != 0) {
+        templateFailed(type);
+
+        // Boosters might have been waiting for the template
+        fillBoosterPool(type);
+        return;
     }
+
+    unwatchFd(boosterType.templateSocket);
+    boosterType.templateReady = true;
+    Logger::logInfo("Daemon: booster template of type '%s' (pid=%d) is ready",
+                    boosterType.booster->boosterType().c_str(), boosterType.templatePid);
+    armTimer();
+
+    fillBoosterPool(type);
 }
 
-void Daemon::forkBooster(int sleepTime)
+bool Daemon::forkFromTemplate(uint32_t type)
 {
-    if (!m_booster) {
-        // Critical error unknown booster type. Exiting applauncherd.
-        _exit(EXIT_FAILURE);
+    BoosterType &boosterType = m_boosterTypes[type];
+
+    int upgradeSocket[2];
+    createUpgradeSocket(upgradeSocket);
+
+    // Pass the booster end of the upgrade socket with the request
+    char request = 0;
+    struct iovec iov = { &request, sizeof request };
+    char buf[CMSG_SPACE(sizeof upgradeSocket[1])];
+    struct msghdr msg;
+    memset(buf, 0, sizeof buf);
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (upgradeSocket[1] != -1) {
+        msg.msg_control = buf;
+        msg.msg_controllen = sizeof buf;
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof upgradeSocket[1]);
+        memcpy(CMSG_DATA(cmsg), &upgradeSocket[1], sizeof upgradeSocket[1]);
     }
 
-    // Invalidate current booster pid
-    m_boosterPid = 0;
+    bool sent = sendmsg(boosterType.templateSocket, &msg, MSG_NOSIGNAL) == sizeof request;
+    if (upgradeSocket[1] != -1)
+        close(upgradeSocket[1]);
 
-    // Fork a new process
-    pid_t newPid = fork();
+    if (!sent) {
+        Logger::logWarning("Daemon: booster template is not responding");
+        if (upgradeSocket[0] != -1)
+            close(upgradeSocket[0]);
+        templateFailed(type);
+        return false;
+    }
 
-    if (newPid == -1)
-        throw std::runtime_error("Daemon: Forking while invoking");
+    // The reply with the pid of the booster is handled in the event loop
+    boosterType.templateForking = true;
+    boosterType.templateUpgradeSocket = upgradeSocket[0];
+    boosterType.templateDeadline = timestamp() + TEMPLATE_FORK_TIMEOUT;
+    watchFd(boosterType.templateSocket, event_data(EVENT_TEMPLATE_SOCKET, type));
+    armTimer();
+    return true;
+}
 
-    if (newPid == 0) /* Child process */
-    {
-        // Will be reopened with new identity when/if
-        // there is something to report
-        Logger::closeLog();
+void Daemon::handleTemplateFork(uint32_t type)
+{
+    BoosterType &boosterType = m_boosterTypes[type];
+
+    pid_t pid = -1;
+    ssize_t rc = recv(boosterType.templateSocket, &pid, sizeof pid, MSG_DONTWAIT);
+    if (rc == -1 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (rc != sizeof pid || pid <= 0) {
+        Logger::logWarning("Daemon: booster template is not responding");
+        templateFailed(type);
+        fillBoosterPool(type);
+        return;
+    }
 
-        // Restore used signal handlers
-        restoreUnixSignalHandlers();
+    unwatchFd(boosterType.templateSocket);
+    boosterType.templateForking = false;
+    armTimer();
 
-        // Will get this signal if applauncherd dies
-        prctl(PR_SET_PDEATHSIG, SIGHUP);
+    APPMOTOR_PROBE3(daemon_fork_booster, boosterType.booster->boosterType().c_str(), pid, 1);
 
-        // Close unused read end of the booster socket
-        close(m_boosterLauncherSocket[0]);
+    // The booster is a child of the daemon, see clone_parent()
+    addChild(pid, type);
+    storeUpgradeSocket(pid, boosterType.templateUpgradeSocket);
+    boosterType.templateUpgradeSocket = -1;
+    boosterType.pool->add(pid);
 
-        // Close signal pipe
-        close(m_sigPipeFd[0]);
-        close(m_sigPipeFd[1]);
+    // Request the next one if the pool is still short of boosters
+    fillBoosterPool(type);
+}
 
-        // Close socket file descriptors
-        FdMap::iterator i(m_boosterPidToInvokerFd.begin());
-        while (i != m_boosterPidToInvokerFd.end())
-        {
-            if ((*i).second != -1) {
-                close((*i).second);
-                (*i).second = -1;
-            }
-            i++;
-        }
-        // Set session id
-        if (setsid() < 0)
-            Logger::logError("Daemon: Couldn't set session id\n");
-
-        // Guarantee some time for the just launched application to
-        // start up before initializing new booster if needed.
-        // Not done if in the boot mode.
-        if (!m_bootMode && sleepTime) {
-            Logger::logDebug("allow time for application startup - sleep(%ds)...\n", sleepTime);
-            sleep(sleepTime);
-        }
+void Daemon::fillBoosterPool(uint32_t type, unsigned minDelay, unsigned maxDelay)
+{
+    BoosterType &boosterType = m_boosterTypes[type];
+
+    // No new boosters while shutting down
+    if (m_exiting)
+        return;
+
+    if (boosterType.pool->size() >= boosterType.pool->targetSize(timestamp()))
+        return;
+
+    // Guarantee some time for the just launched application to
+    // start up before initializing new boosters if needed.
+    // Not done if in the boot mode.
+    if (!m_bootMode && maxDelay > 0) {
+        boosterType.respawnScheduler->schedule(timestamp(), minDelay, maxDelay);
+        checkRespawn(type);
+        armTimer();
+    } else {
+        startBoosters(type, "no delay");
+    }
+}
 
-        Logger::logDebug("Daemon: Running a new Booster of type '%s'", m_booster->boosterType().c_str());
+void Daemon::checkRespawn(uint32_t type)
+{
+    BoosterType &boosterType = m_boosterTypes[type];
+    RespawnScheduler *scheduler = boosterType.respawnScheduler;
+    if (!scheduler->isPending())
+        return;
+
+    unsigned now = timestamp();
+    if (scheduler->isDue(now, boosterType.pool->recentLaunches(now))) {
+        bool limit = scheduler->elapsed(now) >= scheduler->maxDelay();
+        startBoosters(type, limit ? "limit reached" : "low load");
+        return;
+    }
 
-        // Initialize and wait for commands from invoker
-        try {
-            m_booster->initialize(m_initialArgc, m_initialArgv, m_boosterLauncherSocket[1],
-                                  m_socketManager->findSocket(m_booster->socketId()),
-                                  m_singleInstance, m_bootMode);
-        } catch (const std::runtime_error &e) {
-            Logger::logError("Booster: Failed to initialize: %s\n", e.what());
-            delete m_booster;
-            _exit(EXIT_FAILURE);
+    // Do not let an invoker wait for the delay to pass
+    if (boosterType.pool->size() == 0 && !boosterType.watchingLaunchSocket) {
+        int fd = m_socketManager->findSocket(boosterType.booster->socketId());
+        if (fd != -1) {
+            watchFd(fd, event_data(EVENT_LAUNCH_SOCKET, type));
+            boosterType.watchingLaunchSocket = true;
         }
+    }
+}
 
-        m_instance = NULL;
+void Daemon::startBoosters(uint32_t type, const char *reason)
+{
+    BoosterType &boosterType = m_boosterTypes[type];
+    RespawnScheduler *scheduler = boosterType.respawnScheduler;
+    unsigned now = timestamp();
+
+    // No new boosters while shutting down
+    if (m_exiting)
+        return;
+
+    if (scheduler->isPending()) {
+        Logger::logInfo("Daemon: %s booster respawn delay: %u ms (limit %u ms, %s, cpu=%d%% io=%d%%)",
+                        boosterType.booster->boosterType().c_str(),
+                        scheduler->elapsed(now), scheduler->maxDelay(), reason,
+                        scheduler->cpuPressure(), scheduler->ioPressure());
+        m_metrics->record(boosterType.booster->boosterType(), LaunchMetrics::RespawnDelay,
+                          scheduler->elapsed(now) * 1000ull);
+        scheduler->cancel();
+    }
 
-        // No need for capabilities anymore
-        dropCapabilities();
+    if (boosterType.watchingLaunchSocket) {
+        unwatchFd(m_socketManager->findSocket(boosterType.booster->socketId()));
+        boosterType.watchingLaunchSocket = false;
+    }
 
-        // Run the current Booster
-        int retval = m_booster->run(m_socketManager);
+    int target = boosterType.pool->targetSize(now);
+    while (boosterType.pool->size() < target && forkBooster(type))
+        ;
+}
 
-        // Finish
-        delete m_booster;
+void Daemon::reportPoolStatus(uint32_t type)
+{
+    const BoosterType &boosterType = m_boosterTypes[type];
+    const BoosterPool *pool = boosterType.pool;
+    Logger::logInfo("Daemon: %s booster pool: spare=%d min=%d max=%d hits=%u misses=%u",
+                    boosterType.booster->boosterType().c_str(),
+                    pool->size(), pool->minSize(), pool->maxSize(),
+                    pool->hits(), pool->misses());
 
-        // _exit() instead of exit() to avoid situation when destructors
-        // for static objects may be run incorrectly
-        _exit(retval);
+    if (m_notifySystemd) {
+        // Status line covers every hosted booster type
+        std::ostringstream status;
+        status << "STATUS=booster pools:";
+        for (BoosterTypeVector::const_iterator it = m_boosterTypes.begin(); it != m_boosterTypes.end(); ++it) {
+            status << (it == m_boosterTypes.begin() ? " " : "; ")
+                   << it->booster->boosterType()
+                   << " spare=" << it->pool->size()
+                   << " min=" << it->pool->minSize()
+                   << " max=" << it->pool->maxSize()
+                   << " hits=" << it->pool->hits()
+                   << " misses=" << it->pool->misses()
+                   << ' ' << m_metrics->summary(it->booster->boosterType());
+        }
+        sd_notify(0, status.str().c_str());
     }
-    else /* Parent process */
-    {
-        // Store the pid so that we can reap it later
-        m_children.push_back(newPid);
+}
 
-        // Set current process ID globally to the given booster type
-        // so that we now which booster to restart when booster exits.
-        m_boosterPid = newPid;
+void Daemon::addChild(pid_t pid, uint32_t type)
+{
+    Child &child = m_children[pid];
+    child.pid = pid;
+    child.type = type;
+    child.pidFd = pidfd_open_compat(pid);
+    child.invokerPid = -1;
+    child.invokerPidFd = -1;
+    child.invokerFd = -1;
+    child.upgradeFd = -1;
+    child.started = timestamp();
+    child.warmupLevel = -1;
+    child.warmupTime = 0;
+
+    if (child.pidFd != -1) {
+        watchFd(child.pidFd, event_data(EVENT_CHILD_PROCESS, pid));
+    } else {
+        // Without a pidfd the child is reaped on SIGCHLD
+        Logger::logDebug("Daemon: no pidfd for pid=%d: %s", pid, strerror(errno));
+        ++m_childrenWithoutPidFd;
     }
 }
 
+void Daemon::handleChildProcess(pid_t pid)
+{
+    // The pidfd keeps the pid reserved until the child has been
+    // reaped, so waiting for this exact pid can not hit another
+    // process. Stale events of already reaped children find nothing.
+    ChildMap::iterator it = m_children.find(pid);
+    if (it == m_children.end())
+        return;
+
+    int status = 0;
+    if (waitpid(pid, &status, WNOHANG) == pid)
+        childExited(pid, status);
+}
+
 void Daemon::reapZombies()
 {
-    // Loop through all child pid's and wait for them with WNOHANG.
-    PidVect::iterator i(m_children.begin());
-    while (i != m_children.end())
+    // Reap all exited children. Used for children that could
+    // not be given a pidfd, children that have one are handled
+    // here too if they happen to exit at the same time.
+    for (;;)
     {
-        // Check if the pid had exited and become a zombie
         int status = 0;
-        pid_t pid = waitpid(*i, &status, WNOHANG);
-        if (pid > 0)
+        pid_t pid = waitpid(-1, &status, WNOHANG);
+        if (pid <= 0)
+            break;
+
+        if (m_children.find(pid) == m_children.end())
         {
-            // The pid had exited. Remove it from the pid vector.
-            i = m_children.erase(i);
-
-            // Find out what happened
-            int exit_status = EXIT_FAILURE;
-            int signal_no = 0;
-
-            if (WIFSIGNALED(status)) {
-                signal_no = WTERMSIG(status);
-                Logger::logWarning("boosted process (pid=%d) signal(%s)\n",
-                                   pid, strsignal(signal_no));
-            } else if (WIFEXITED(status)) {
-                exit_status = WEXITSTATUS(status);
-                if (exit_status != EXIT_SUCCESS)
-                    Logger::logWarning("Boosted process (pid=%d) exit(%d)\n",
-                                       pid, exit_status);
-                else
-                    Logger::logDebug("Boosted process (pid=%d) exit(%d)\n",
-                                     pid, exit_status);
-            }
+            Logger::logWarning("unexpected child exit pid=%d status=0x%x\n", pid, status);
+            continue;
+        }
 
-            /* Get and remove booster socket fd */
-            int socket_fd = -1;
-            FdMap::iterator fdIter = m_boosterPidToInvokerFd.find(pid);
-            if (fdIter != m_boosterPidToInvokerFd.end()) {
-                socket_fd = (*fdIter).second;
-                m_boosterPidToInvokerFd.erase(fdIter);
-            }
+        childExited(pid, status);
+    }
+}
 
-            /* Get and remove invoker pid */
-            pid_t invoker_pid = -1;
-            PidMap::iterator pidIter = m_boosterPidToInvokerPid.find(pid);
-            if (pidIter != m_boosterPidToInvokerPid.end()) {
-                invoker_pid = (*pidIter).second;
-                m_boosterPidToInvokerPid.erase(pidIter);
-            }
+void Daemon::childExited(pid_t pid, int status)
+{
+    APPMOTOR_PROBE2(daemon_child_exit, pid, status);
+
+    // A booster reports the launch before starting the application,
+    // make sure the report has been processed before its exit is.
+    readFromBoosterSocket(m_boosterLauncherSocket[0]);
+
+    ChildMap::iterator it = m_children.find(pid);
+    if (it == m_children.end())
+        return;
+    Child &child = it->second;
+    uint32_t type = child.type;
+
+    // Find out what happened
+    int exit_status = EXIT_FAILURE;
+    int signal_no = 0;
+
+    if (WIFSIGNALED(status)) {
+        signal_no = WTERMSIG(status);
+        Logger::logWarning("boosted process (pid=%d) signal(%s)\n",
+                           pid, strsignal(signal_no));
+    } else if (WIFEXITED(status)) {
+        exit_status = WEXITSTATUS(status);
+        if (exit_status != EXIT_SUCCESS)
+            Logger::logWarning("Boosted process (pid=%d) exit(%d)\n",
+                               pid, exit_status);
+        else
+            Logger::logDebug("Boosted process (pid=%d) exit(%d)\n",
+                             pid, exit_status);
+    }
 
-            /* Terminate invoker associated with the booster */
-            close_invoker(invoker_pid, socket_fd, exit_status);
+    if (trace_enabled())
+        keepTrace(pid);
 
-            // Check if pid belongs to a booster and restart the dead booster if needed
-            if (pid == m_boosterPid)
-            {
-                forkBooster(m_boosterSleepTime);
-            }
-        }
+    /* Terminate invoker associated with the booster */
+    closeInvoker(child, exit_status);
+    closeUpgradeSocket(child);
+
+    /* The mappings of the process are gone with it */
+    for (PendingProfileVector::iterator profile = m_pendingProfiles.begin(); profile != m_pendingProfiles.end(); ) {
+        if (profile->pid == pid)
+            profile = m_pendingProfiles.erase(profile);
         else
-        {
-            i++;
-        }
+            ++profile;
     }
 
-    /* Handle stray child exits */
-    for (;;) {
-        int status = 0;
-        pid_t pid = waitpid(-1, &status, WNOHANG);
-        if (pid <= 0)
-            break;
-        Logger::logWarning("unexpected child exit pid=%d status=0x%x\n", pid, status);
+    /* The pid has exited. Remove it from the child table. */
+    if (child.pidFd != -1) {
+        unwatchFd(child.pidFd);
+        close(child.pidFd);
+    } else {
+        --m_childrenWithoutPidFd;
+    }
+    m_children.erase(it);
+
+    if (pid == m_boosterTypes[type].templatePid)
+    {
+        Logger::logWarning("Daemon: booster template (pid=%d) exited", pid);
+        templateFailed(type);
+
+        // Boosters might have been waiting for the template
+        fillBoosterPool(type);
+    }
+
+    // Check if pid belongs to a spare booster and restart the dead booster if needed
+    if (m_boosterTypes[type].pool->remove(pid))
+    {
+        fillBoosterPool(type, m_boosterSleepTime * 1000u, BOOSTER_RESPAWN_MAX_DELAY);
     }
 }
 
@@ -868,10 +2137,10 @@ void Daemon::daemonize()
          */
 #if 0
         // Path that takes also application name into account
-        const std::string pidFilePath = m_socketManager->socketRootPath() + m_booster->socketId() + ".pid";
+        const std::string pidFilePath = m_socketManager->socketRootPath() + m_boosterTypes.front().booster->socketId() + ".pid";
 #else
-        // Legacy path
-        const std::string pidFilePath = m_socketManager->socketRootPath() + m_booster->boosterType() + ".pid";
+        // Legacy path, named after the first booster type
+        const std::string pidFilePath = m_socketManager->socketRootPath() + m_boosterTypes.front().booster->boosterType() + ".pid";
 #endif
         FILE * const pidFile = fopen(pidFilePath.c_str(), "w");
         if (pidFile)
@@ -932,6 +2201,14 @@ void Daemon::parseArgs(int argc, char **argv)
         { "daemon",           no_argument,       NULL, 'd' },
         { "systemd",          no_argument,       NULL, 'n' },
         { "application",      required_argument, NULL, 'a' },
+        { "pool-min",         required_argument, NULL, 'm' },
+        { "pool-max",         required_argument, NULL, 'M' },
+        { "listen-backlog",   required_argument, NULL, 'L' },
+        { "template",         no_argument,       NULL, 'T' },
+        { "boot-level",       required_argument, NULL, 'l' },
+        { "record-profiles",  required_argument, NULL, 'r' },
+        { "application-binary", required_argument, NULL, 'B' },
+        { "trace",            optional_argument, NULL, 't' },
         { 0, 0, 0, 0}
     };
     static const char shortopts[] =
@@ -942,6 +2219,14 @@ void Daemon::parseArgs(int argc, char **argv)
         "d"  // --daemon
         "n"  // --systemd
         "a:" // --application=<APP>
+        "m:" // --pool-min=<COUNT>
+        "M:" // --pool-max=<COUNT>
+        "L:" // --listen-backlog=<COUNT>
+        "T"  // --template
+        "l:" // --boot-level=<LEVEL>
+        "r:" // --record-profiles=<SECONDS>
+        "B:" // --application-binary=<PATH>
+        "t::" // --trace[=<RECORDS>]
         ;
     for (;;) {
         int opt = getopt_long(argc, argv, shortopts, longopts, NULL);
@@ -968,6 +2253,36 @@ void Daemon::parseArgs(int argc, char **argv)
         case 'a':
             m_boostedApplication = optarg;
             break;
+        case 'm':
+            m_poolMinSize = atoi(optarg);
+            break;
+        case 'M':
+            m_poolMaxSize = atoi(optarg);
+            break;
+        case 'L':
+            m_listenBacklog = atoi(optarg);
+            if (m_listenBacklog < 1)
+                usage(*argv, EXIT_FAILURE);
+            break;
+        case 'T':
+            m_useTemplate = true;
+            break;
+        case 'l':
+            m_bootWarmupLevel = parseWarmupLevel(optarg);
+            if (m_bootWarmupLevel < 0)
+                usage(*argv, EXIT_FAILURE);
+            break;
+        case 'r':
+            m_profileDelay = std::max(atoi(optarg), 0) * 1000u;
+            break;
+        case 'B':
+            m_applicationBinary = optarg;
+            break;
+        case 't':
+            m_traceRecords = optarg ? std::max(atoi(optarg), 0) : TRACE_DEFAULT_RECORDS;
+            if (!m_traceRecords)
+                usage(*argv, EXIT_FAILURE);
+            break;
         default:
         case '?':
             usage(*argv, EXIT_FAILURE);
@@ -975,6 +2290,11 @@ void Daemon::parseArgs(int argc, char **argv)
     }
     if (optind < argc)
         usage(*argv, EXIT_FAILURE);
+
+    if (m_applicationBinary.empty() && !m_boostedApplication.empty())
+        m_applicationBinary = findInPath(m_boostedApplication);
+    if (!m_applicationBinary.empty())
+        Logger::logInfo("Daemon: boosters preload application binary '%s'", m_applicationBinary.c_str());
 }
 
 // Prints the usage and exits with given status
@@ -991,8 +2311,8 @@ void Daemon::usage(const char *name, int status)
            "Options:\n"
            "  -b, --boot-mode\n"
            "                   Start %s in the boot mode. This means that\n"
-           "                   boosters will not initialize caches and booster\n"
-           "                   respawn delay is set to zero.\n"
+           "                   boosters preload only up to the boot level and\n"
+           "                   booster respawn delay is set to zero.\n"
            "                   Normal mode is restored by sending SIGUSR1\n"
            "                   to the launcher.\n"
            "                   Boot mode can be activated also by sending SIGUSR2\n"
@@ -1001,6 +2321,36 @@ void Daemon::usage(const char *name, int status)
            "                   Run as %s a daemon.\n"
            "  -a, --application=<application>\n"
            "                   Run as application specific booster.\n"
+           "  -B, --application-binary=<path>\n"
+           "                   Binary that application specific boosters load\n"
+           "                   in advance, by default <application> in PATH.\n"
+           "  -m, --pool-min=<count>\n"
+           "                   Number of spare boosters kept waiting for\n"
+           "                   invokers even when idle (default 1).\n"
+           "  -M, --pool-max=<count>\n"
+           "                   Number of spare boosters kept waiting for\n"
+           "                   invokers during launch bursts (default 3).\n"
+           "  -L, --listen-backlog=<count>\n"
+           "                   Number of invokers that can wait for a booster\n"
+           "                   to accept their connection (default and upper\n"
+           "                   limit net.core.somaxconn).\n"
+           "  -T, --template\n"
+           "                   Fork boosters from a template process that has\n"
+           "                   already done the fork-safe part of preloading.\n"
+           "  -l, --boot-level=<level>\n"
+           "                   How far boosters preload in the boot mode: none\n"
+           "                   (default), libraries, application, qml or full.\n"
+           "                   On SIGUSR1 spare boosters finish preloading\n"
+           "                   in place.\n"
+           "  -r, --record-profiles=<seconds>\n"
+           "                   Record which pages of mapped files applications\n"
+           "                   use in their first seconds. Recorded profiles are\n"
+           "                   prefetched on later launches of the same binary.\n"
+           "  -t, --trace[=<records>]\n"
+           "                   Record all log messages of the daemon, boosters\n"
+           "                   and boosted applications in binary form in a\n"
+           "                   ring of <records> messages (default 4096) per\n"
+           "                   process, see cutefish-appmotor-trace.\n"
            "  -n, --systemd\n"
            "                   Notify systemd when initialization is done\n"
            "  -h, --help\n"
@@ -1015,19 +2365,17 @@ void Daemon::usage(const char *name, int status)
     exit(status);
 }
 
-int Daemon::sigPipeFd() const
-{
-    return m_sigPipeFd[1];
-}
-
 void Daemon::enterNormalMode()
 {
     if (m_bootMode)
     {
         m_bootMode = false;
 
-        // Kill current boosters
-        killBoosters();
+        // Let current boosters finish their preloading
+        upgradeBoosters(Booster::WarmupFull);
+
+        // Template is started with preloading when needed
+        stopTemplates();
 
         Logger::logInfo("Daemon: Exited boot mode.");
     }
@@ -1046,6 +2394,9 @@ void Daemon::enterBootMode()
         // Kill current boosters
         killBoosters();
 
+        // No preloading in boot mode
+        stopTemplates();
+
         Logger::logInfo("Daemon: Entered boot mode.");
     }
     else
@@ -1056,46 +2407,482 @@ void Daemon::enterBootMode()
 
 void Daemon::killBoosters()
 {
-    if (m_boosterPid > 0)
-        killProcess(m_boosterPid, SIGTERM);
+    for (BoosterTypeVector::const_iterator type = m_boosterTypes.begin(); type != m_boosterTypes.end(); ++type)
+    {
+        const set<pid_t> &boosters = type->pool->boosters();
+        for (set<pid_t>::const_iterator it = boosters.begin(); it != boosters.end(); ++it)
+            killProcess(*it, SIGTERM);
+    }
 
-    // NOTE!!: m_boosterPid must not be cleared
-    // in order to automatically start new boosters.
+    // NOTE!!: Pool entries must not be cleared here in order
+    // to automatically start new boosters when the old ones are reaped.
 }
 
-void Daemon::setUnixSignalHandler(int signum, sighandler_t handler)
+void Daemon::upgradeBoosters(int level)
 {
-    // needs to be undone in instance
-    m_originalSigHandlers[signum] = SIG_DFL;
+    int upgraded = 0;
 
-    struct sigaction sig;
-    memset(&sig, 0, sizeof(sig));
-    sig.sa_flags = SA_RESTART;
-    sig.sa_handler = handler;
-    if (sigaction(signum, &sig, NULL) == -1)
-        warning("trap(%s): %m", strsignal(signum));
-    else
-        debug("trap(%s): ok", strsignal(signum));
+    for (BoosterTypeVector::const_iterator type = m_boosterTypes.begin(); type != m_boosterTypes.end(); ++type)
+    {
+        const set<pid_t> &boosters = type->pool->boosters();
+        for (set<pid_t>::const_iterator it = boosters.begin(); it != boosters.end(); ++it)
+        {
+            ChildMap::iterator child = m_children.find(*it);
+            if (child != m_children.end() && child->second.upgradeFd != -1 &&
+                send(child->second.upgradeFd, &level, sizeof level, MSG_DONTWAIT | MSG_NOSIGNAL) == sizeof level)
+            {
+                ++upgraded;
+                continue;
+            }
+
+            // Replaced when reaped, see childExited()
+            killProcess(*it, SIGTERM);
+        }
+    }
+
+    Logger::logInfo("Daemon: upgraded %d boosters in place", upgraded);
 }
 
-void Daemon::restoreUnixSignalHandlers()
+string Daemon::controlSocketId() const
 {
-    for (SigHandlerMap::iterator it = m_originalSigHandlers.begin(); it != m_originalSigHandlers.end(); it++ )
-    {
-        int signum = it->first;
-        if (signal(signum, SIG_DFL) == SIG_ERR)
-            warning("untrap(%s): %m", strsignal(signum));
+    return '_' + m_boosterTypes.front().booster->boostedApplication() + "/control";
+}
+
+void Daemon::initControlSocket()
+{
+    // The daemon works without it, only runtime control is lost
+    try {
+        m_socketManager->initSocket(controlSocketId(), CONTROL_BACKLOG);
+    } catch (const std::runtime_error &e) {
+        Logger::logWarning("Daemon: no control socket: %s", e.what());
+        return;
+    }
+
+    watchFd(m_socketManager->findSocket(controlSocketId()), event_data(EVENT_CONTROL_SOCKET, 0));
+}
+
+void Daemon::acceptControlClients()
+{
+    int socketFd = m_socketManager->findSocket(controlSocketId());
+
+    for (;;) {
+        int fd = accept4(socketFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN)
+                Logger::logWarning("Daemon: accepting control client failed: %s", strerror(errno));
+            return;
+        }
+
+        // Only the user running the daemon can control it
+        struct ucred cred;
+        socklen_t credLen = sizeof cred;
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &credLen) == -1 ||
+            (cred.uid != getuid() && cred.uid != 0)) {
+            Logger::logWarning("Daemon: control client of another user rejected");
+            close(fd);
+            continue;
+        }
+
+        if (m_controlClients.size() >= CONTROL_MAX_CLIENTS) {
+            Logger::logWarning("Daemon: too many control clients");
+            close(fd);
+            continue;
+        }
+
+        uint32_t id = m_nextControlClientId++;
+        m_controlClients[id].fd = fd;
+        m_controlClients[id].sent = 0;
+        watchFd(fd, event_data(EVENT_CONTROL_CLIENT, id));
+    }
+}
+
+void Daemon::readControlClient(uint32_t id)
+{
+    ControlClientMap::iterator it = m_controlClients.find(id);
+    if (it == m_controlClients.end())
+        return;
+
+    ControlClient &client = it->second;
+    char buf[256];
+    ssize_t rc = recv(client.fd, buf, sizeof buf, 0);
+    if (rc == -1 && (errno == EINTR || errno == EAGAIN))
+        return;
+
+    if (rc > 0)
+        client.request.append(buf, rc);
+
+    // Request is one line, also complete if the client shuts down writing
+    string::size_type end = client.request.find('\n');
+    if (end == string::npos && rc > 0 && client.request.size() <= CONTROL_MAX_REQUEST)
+        return;
+
+    string response;
+    if (end == string::npos && client.request.size() > CONTROL_MAX_REQUEST) {
+        response = "error: request too long\n";
+    } else if (end != string::npos || (rc == 0 && !client.request.empty())) {
+        string request = client.request.substr(0, end);
+
+        // Reading the memory of every child takes a while with many
+        // applications running, a worker process answers these requests
+        string command;
+        std::istringstream(request) >> command;
+        if (command == "memory" || command == "metrics") {
+            forkControlWorker(id, request);
+            return;
+        }
+
+        response = handleControlRequest(request);
+    }
+
+    if (response.empty()) {
+        closeControlClient(id);
+        return;
+    }
+
+    // A large response does not fit in the socket buffer, the rest is
+    // sent whenever the client has read enough of it
+    client.response = response;
+    watchFdOutput(client.fd, event_data(EVENT_CONTROL_RESPONSE, id));
+    writeControlClient(id);
+}
+
+void Daemon::forkControlWorker(uint32_t id, const string &request)
+{
+    ControlClient &client = m_controlClients[id];
+
+    // The worker is a grandchild, so that the daemon only waits for the
+    // intermediate child, which exits right away, and never reaps it
+    pid_t pid = fork();
+    if (pid == -1) {
+        Logger::logWarning("Daemon: could not fork control worker: %s", strerror(errno));
+        client.response = "error: cannot fork worker\n";
+        watchFdOutput(client.fd, event_data(EVENT_CONTROL_RESPONSE, id));
+        writeControlClient(id);
+        return;
+    }
+
+    if (pid == 0) {
+        if (fork() == 0) {
+            restoreUnixSignals();
+
+            // Other clients must see the daemon closing their connections
+            for (ControlClientMap::iterator it = m_controlClients.begin(); it != m_controlClients.end(); ++it) {
+                if (it->first != id)
+                    close(it->second.fd);
+            }
+
+            string response = handleControlRequest(request);
+
+            fcntl(client.fd, F_SETFL, 0);
+            string::size_type sent = 0;
+            while (sent < response.size()) {
+                ssize_t rc = send(client.fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+                if (rc == -1 && errno == EINTR)
+                    continue;
+                if (rc == -1)
+                    _exit(EXIT_FAILURE);
+                sent += rc;
+            }
+        }
+        _exit(EXIT_SUCCESS);
+    }
+
+    while (waitpid(pid, NULL, 0) == -1 && errno == EINTR)
+        ;
+
+    // The worker has its own copy of the connection
+    closeControlClient(id);
+}
+
+void Daemon::writeControlClient(uint32_t id)
+{
+    ControlClientMap::iterator it = m_controlClients.find(id);
+    if (it == m_controlClients.end())
+        return;
+
+    ControlClient &client = it->second;
+    while (client.sent < client.response.size()) {
+        ssize_t rc = send(client.fd, client.response.data() + client.sent,
+                          client.response.size() - client.sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (rc == -1 && errno == EINTR)
+            continue;
+        if (rc == -1 && errno == EAGAIN)
+            return;
+        if (rc == -1) {
+            Logger::logWarning("Daemon: control response not sent completely: %s", strerror(errno));
+            break;
+        }
+        client.sent += rc;
+    }
+
+    closeControlClient(id);
+}
+
+void Daemon::closeControlClient(uint32_t id)
+{
+    ControlClientMap::iterator it = m_controlClients.find(id);
+    if (it == m_controlClients.end())
+        return;
+
+    unwatchFd(it->second.fd);
+    close(it->second.fd);
+    m_controlClients.erase(it);
+}
+
+string Daemon::handleControlRequest(const string &request)
+{
+    std::istringstream words(request);
+    string command;
+    words >> command;
+
+    Logger::logInfo("Daemon: control request '%s'", request.c_str());
+
+    if (command == "status") {
+        return "ok\n" + controlStatus();
+    } else if (command == "metrics") {
+        return "ok\n" + controlMetrics();
+    } else if (command == "memory") {
+        return "ok\n" + controlMemory();
+    } else if (command == "children") {
+        return "ok\n" + controlChildren();
+    } else if (command == "warmup") {
+        string name("full");
+        words >> name;
+        int level = parseWarmupLevel(name.c_str());
+        if (level < 0)
+            return "error: unknown warm-up level " + name + "\n";
+        if (m_bootMode && level > m_bootWarmupLevel)
+            return "error: boot mode, use normal-mode\n";
+        upgradeBoosters(level);
+        return "ok\n";
+    } else if (command == "pool") {
+        int minSize = -1;
+        int maxSize = -1;
+        if (!(words >> minSize >> maxSize) || minSize < 0 || maxSize < minSize || maxSize < 1)
+            return "error: usage: pool <min> <max>\n";
+        resizeBoosterPools(minSize, maxSize);
+        return "ok\n";
+    } else if (command == "boot-mode") {
+        enterBootMode();
+        return "ok\n";
+    } else if (command == "normal-mode") {
+        enterNormalMode();
+        return "ok\n";
+    }
+
+    return "error: unknown command " + command + "\n";
+}
+
+string Daemon::controlStatus()
+{
+    unsigned now = timestamp();
+    std::ostringstream status;
+    status << "daemon"
+           << " pid=" << getpid()
+           << " uptime-s=" << (now - m_startTime) / 1000
+           << " mode=" << (m_bootMode ? "boot" : "normal")
+           << " template=" << (m_useTemplate ? "yes" : "no")
+           << " children=" << m_children.size()
+           << " terminations=" << m_terminations.size()
+           << '\n';
+
+    for (BoosterTypeVector::const_iterator it = m_boosterTypes.begin(); it != m_boosterTypes.end(); ++it) {
+        BoosterPool *pool = it->pool;
+
+        int ready = 0;
+        const set<pid_t> &boosters = pool->boosters();
+        for (set<pid_t>::const_iterator b = boosters.begin(); b != boosters.end(); ++b) {
+            ChildMap::const_iterator child = m_children.find(*b);
+            if (child != m_children.end() && child->second.warmupLevel >= 0)
+                ++ready;
+        }
+
+        status << "booster"
+               << " type=" << it->booster->boosterType()
+               << " spare=" << pool->size()
+               << " ready=" << ready
+               << " target=" << pool->targetSize(now)
+               << " min=" << pool->minSize()
+               << " max=" << pool->maxSize()
+               << " waiting=" << m_socketManager->pendingConnections(it->booster->socketId())
+               << " hits=" << pool->hits()
+               << " misses=" << pool->misses()
+               << " last-warmup-ms=" << it->lastWarmupTime
+               << " template-pid=" << it->templatePid
+               << '\n';
+    }
+
+    return status.str();
+}
+
+string Daemon::controlChildren()
+{
+    unsigned now = timestamp();
+    std::ostringstream children;
+    for (ChildMap::const_iterator it = m_children.begin(); it != m_children.end(); ++it) {
+        const Child &child = it->second;
+        const BoosterType &type = m_boosterTypes[child.type];
+
+        children << "child"
+                 << " pid=" << child.pid
+                 << " type=" << type.booster->boosterType()
+                 << " state=" << childState(child)
+                 << " level=" << (child.warmupLevel >= 0 ? WARMUP_LEVEL_NAMES[child.warmupLevel] : "-")
+                 << " warmup-ms=" << child.warmupTime
+                 << " age-s=" << (now - child.started) / 1000
+                 << " invoker=" << child.invokerPid
+                 << " binary=" << (child.binary.empty() ? "-" : child.binary)
+                 << '\n';
+    }
+
+    return children.str();
+}
+
+const char *Daemon::childState(const Child &child) const
+{
+    const BoosterType &type = m_boosterTypes[child.type];
+    if (child.pid == type.templatePid)
+        return "template";
+    if (type.pool->contains(child.pid))
+        return child.warmupLevel >= 0 ? "spare" : "starting";
+    return "application";
+}
+
+// Return memory usage as control response fields
+static string memoryFields(const MemoryUsage &usage)
+{
+    std::ostringstream fields;
+    fields << " rss-kb=" << usage.rss
+           << " pss-kb=" << usage.pss
+           << " uss-kb=" << usage.uss()
+           << " shared-clean-kb=" << usage.sharedClean
+           << " shared-dirty-kb=" << usage.sharedDirty
+           << " private-clean-kb=" << usage.privateClean
+           << " private-dirty-kb=" << usage.privateDirty
+           << " swap-kb=" << usage.swap;
+    return fields.str();
+}
+
+Daemon::MemoryUsageMap Daemon::readMemoryUsage(string *processLines)
+{
+    MemoryUsageMap usageMap;
+    std::ostringstream lines;
+
+    MemoryUsage usage;
+    if (usage.read(m_pid)) {
+        usageMap["daemon"].add(usage);
+        lines << "process pid=" << m_pid << " group=daemon" << memoryFields(usage) << '\n';
+    }
+
+    for (ChildMap::const_iterator it = m_children.begin(); it != m_children.end(); ++it) {
+        const Child &child = it->second;
+        if (!usage.read(child.pid))
+            continue;
+
+        // Applications are grouped by binary name, others by state and booster type
+        string group = childState(child);
+        if (group == "application")
+            group = child.binary.empty() ? "unknown" : child.binary.substr(child.binary.rfind('/') + 1);
         else
-            debug("untrap(%s): ok", strsignal(signum));
+            group = (group == "template" ? "template:" : "booster:") +
+                    m_boosterTypes[child.type].booster->boosterType();
+
+        usageMap[group].add(usage);
+        lines << "process pid=" << child.pid << " group=" << group << memoryFields(usage) << '\n';
+    }
+
+    if (processLines)
+        *processLines = lines.str();
+    return usageMap;
+}
+
+string Daemon::controlMemory()
+{
+    string response;
+    MemoryUsageMap usageMap = readMemoryUsage(&response);
+
+    MemoryUsage total;
+    std::ostringstream groups;
+    for (MemoryUsageMap::const_iterator it = usageMap.begin(); it != usageMap.end(); ++it) {
+        total.add(it->second);
+        groups << "group name=" << it->first << " processes=" << it->second.processes
+               << memoryFields(it->second) << '\n';
+    }
+
+    // Pages counted in RSS of several processes are only counted once in
+    // their PSS sum, the difference is what sharing saves
+    groups << "total processes=" << total.processes << memoryFields(total)
+           << " shared-saving-kb=" << total.rss - total.pss << '\n';
+
+    return response + groups.str();
+}
+
+string Daemon::controlMetrics()
+{
+    // Invokers count the launches they had to do without a booster,
+    // see invoker_record_fallback()
+    string path = m_socketManager->socketRootPath() + INVOKER_FALLBACKS_FILE;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        m_metrics->setInvokerFallbacks(0);
+    } else {
+        // Answered by a worker process, see forkControlWorker(), which
+        // can wait for an invoker that is counting right now
+        if (flock(fd, LOCK_SH) == 0) {
+            uint64_t count = 0;
+            if (pread(fd, &count, sizeof count, 0) != sizeof count)
+                count = 0;
+            m_metrics->setInvokerFallbacks(count);
+            flock(fd, LOCK_UN);
+        }
+        close(fd);
+    }
+    m_metrics->setMemoryUsage(readMemoryUsage(NULL));
+
+    return m_metrics->prometheus();
+}
+
+void Daemon::resizeBoosterPools(int minSize, int maxSize)
+{
+    m_poolMinSize = minSize;
+    m_poolMaxSize = maxSize;
+
+    // Extra spare boosters are used up by launches, missing ones are started
+    for (uint32_t type = 0; type < m_boosterTypes.size(); ++type) {
+        m_boosterTypes[type].pool->setLimits(minSize, maxSize);
+        reportPoolStatus(type);
+        fillBoosterPool(type);
     }
-    m_originalSigHandlers.clear();
+}
+
+void Daemon::restoreUnixSignals()
+{
+    if (sigprocmask(SIG_SETMASK, &m_originalSigMask, NULL) == -1)
+        warning("restoring signal mask failed: %m");
 }
 
 
 Daemon::~Daemon()
 {
     delete m_socketManager;
+    delete m_metrics;
     delete m_singleInstance;
+    for (BoosterTypeVector::iterator it = m_boosterTypes.begin(); it != m_boosterTypes.end(); ++it)
+    {
+        delete it->pool;
+        delete it->respawnScheduler;
+    }
+
+    if (m_signalFd != -1)
+        close(m_signalFd);
+
+    if (m_epollFd != -1)
+        close(m_epollFd);
+
+    if (m_timerFd != -1)
+        close(m_timerFd);
 
     Logger::closeLog();
 }
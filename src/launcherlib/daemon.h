@@ -23,6 +23,7 @@
 #define DAEMON_H
 
 #include "launcherlib.h"
+#include "memoryusage.h"
 
 #include <string>
 
@@ -42,9 +43,14 @@ using std::vector;
 using std::map;
 
 #include <signal.h>
+#include <stdint.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 
 class Booster;
+class BoosterPool;
+class LaunchMetrics;
+class RespawnScheduler;
 class SocketManager;
 class SingleInstance;
 
@@ -75,8 +81,18 @@ public:
     //! Destructor
     ~Daemon();
 
+    /*!
+     * \brief Register a booster type to be hosted by this daemon.
+     * \param booster Booster instance of the type. Every booster type
+     *        gets its own socket and pool of spare boosters, all served
+     *        by the same main loop. Must be called before run().
+     */
+    void addBooster(Booster *booster);
+
     /*!
      * \brief Run main loop and fork Boosters.
+     * \param booster Booster type hosted in addition to the ones
+     *        registered with addBooster(), can be NULL.
      */
     void run(Booster *booster);
 
@@ -89,23 +105,14 @@ public:
     void reapZombies();
 
     /*!
-     * Get fd to which signal handler writes the number
-     * of an arriving Unix signal.
-     */
-    int sigPipeFd() const;
-
-    /*!
-     * Set unix signal handler and save its original value.
+     * Restore signal mask changed for the signal fd to its saved value.
      */
-    void setUnixSignalHandler(int signum, sighandler_t handler);
-
-    /*!
-     * Restore unix signal handlers to their saved values.
-     */
-    void restoreUnixSignalHandlers();
+    void restoreUnixSignals();
 
 private:
 
+    struct Child;
+
     //! Disable copy-constructor
     Daemon(const Daemon & r);
 
@@ -121,18 +128,167 @@ private:
     //! Fork process that kills boosters if needed
     void forkKiller();
 
-    //! Forks and initializes a new Booster
-    void forkBooster(int sleepTime = 0);
+    //! Forks and initializes a new Booster of given type. Returns false
+    //! if forking has to wait for the template process to get ready.
+    bool forkBooster(uint32_t type);
+
+    //! Release daemon resources in a freshly forked child
+    void prepareChild();
+
+    //! Initialize and run booster in a child process, does not return.
+    //! upgradeFd is the booster end of its upgrade socket or -1.
+    void runBooster(uint32_t type, int upgradeFd);
+
+    //! Create socket pair for warm-up requests to a booster. Sets
+    //! both ends to -1 if that fails.
+    void createUpgradeSocket(int sv[2]);
+
+    //! Close upgrade socket of a booster that is no longer waiting
+    void closeUpgradeSocket(Child &child);
+
+    //! Store the upgrade socket of a spare booster and listen to its reports
+    void storeUpgradeSocket(pid_t pid, int upgradeFd);
+
+    //! Read warm-up reports of a spare booster, see Booster::WarmupReport
+    void handleUpgradeSocket(pid_t pid);
+
+    //! Close listening sockets of booster types other than the given one
+    void closeOtherSockets(uint32_t type);
+
+    //! Fork the template process that forks warm boosters of given type
+    void startTemplate(uint32_t type);
+
+    //! Let the template process of given type exit
+    void stopTemplate(uint32_t type);
+
+    //! Preload and serve fork requests in the template process, does not return
+    void runTemplate(uint32_t type, int fd);
+
+    //! Start the template process if needed and possible. Returns
+    //! false if boosters must be forked directly.
+    bool templateAvailable(uint32_t type);
+
+    //! Stop a failed template and fork boosters directly for a while
+    void templateFailed(uint32_t type);
+
+    //! Handle ready notification, fork replies and EOF from the template
+    void handleTemplateSocket(uint32_t type);
+
+    //! Request a booster from a ready template process. The reply is
+    //! handled by handleTemplateFork(). Returns false if the booster
+    //! must be forked directly.
+    bool forkFromTemplate(uint32_t type);
+
+    //! Handle the pid reply to a fork request sent by forkFromTemplate()
+    void handleTemplateFork(uint32_t type);
+
+    //! Forks new Boosters until the pool has the wanted number of spares.
+    //! Forking is postponed by RespawnScheduler within the given limits
+    //! (in milliseconds) unless in boot mode.
+    void fillBoosterPool(uint32_t type, unsigned minDelay = 0, unsigned maxDelay = 0);
+
+    //! Start boosters if the postponed respawn is due
+    void checkRespawn(uint32_t type);
+
+    //! Fork boosters now and log the respawn delay if one was pending
+    void startBoosters(uint32_t type, const char *reason);
+
+    //! Log pool size and hit / miss counters, forward them to systemd
+    void reportPoolStatus(uint32_t type);
 
-    //! Kill given pid with SIGKILL by default
-    void killProcess(pid_t pid, int signal = SIGKILL) const;
+    //! Kill given child with SIGKILL by default
+    void killProcess(pid_t pid, int signal = SIGKILL);
 
     //! Load single-instance plugin
     void loadSingleInstancePlugin();
 
-    //! Read and process data from a booster pipe
+    //! Read and process all pending data from a booster socket
     void readFromBoosterSocket(int fd);
 
+    //! Read and process one message from a booster socket.
+    //! Returns false if there was nothing to read.
+    bool readBoosterMessage(int fd);
+
+    //! Read and handle pending Unix signals from the signal fd
+    void readFromSignalFd();
+
+    //! Handle a Unix signal received via the signal fd
+    void handleSignal(int signal);
+
+    //! Start tracking a forked child of given booster type
+    void addChild(pid_t pid, uint32_t type);
+
+    //! Reap child whose pidfd became readable
+    void handleChildProcess(pid_t pid);
+
+    //! Release bookkeeping of an exited child and notify its invoker
+    void childExited(pid_t pid, int status);
+
+    //! Terminate booster whose invoker closed the connection
+    void handleInvokerDisconnect(pid_t boosterPid);
+
+    //! Add fd to the event loop, data is passed back with events
+    void watchFd(int fd, uint64_t data);
+
+    //! Watch an fd already in the event loop for writing instead of input
+    void watchFdOutput(int fd, uint64_t data);
+
+    //! Remove fd from the event loop
+    void unwatchFd(int fd);
+
+    //! Store invoker of a booster and listen to EOF on its socket
+    void storeInvoker(pid_t boosterPid, pid_t invokerPid, int socketFd);
+
+    //! Send exit status to the invoker of a child and close its socket
+    //! without blocking. The invoker is terminated if it does not close
+    //! its end in time.
+    void closeInvoker(Child &child, int exitStatus);
+
+    //! Start terminating a process: SIGTERM, then SIGKILL after a deadline.
+    //! Takes ownership of pidFd, which can be -1 if not available.
+    void terminateProcess(const char *label, pid_t pid, int pidFd);
+
+    //! Send signal to the process of a termination and set next deadline
+    void startKilling(uint32_t id, int signal);
+
+    //! Release resources of a termination, exit if it was the last one
+    //! pending while shutting down
+    void finishTermination(uint32_t id);
+
+    //! Handle input / EOF on the socket of a disconnecting invoker
+    void handleTerminationSocket(uint32_t id);
+
+    //! Handle exit of a process being terminated
+    void handleTerminationProcess(uint32_t id);
+
+    //! Advance terminations whose deadline has passed
+    void handleTimer();
+
+    //! Arm timer for the nearest termination deadline
+    void armTimer();
+
+    //! Start recording launch profiles whose deadline has passed
+    void recordProfiles(unsigned now);
+
+    //! Fork a process that records and saves the launch profile of
+    //! given application process
+    void startProfileRecorder(pid_t appPid, const string &fileName);
+
+    //! Log the result of a profile recorder, fd is its result pipe
+    void handleProfileRecorder(int fd);
+
+    //! Start the binary trace if --trace was given
+    void openTrace();
+
+    //! Keep the trace file of an exited process, removing the oldest ones
+    void keepTrace(pid_t pid);
+
+    //! Raise soft limit of open files to the hard limit
+    void raiseFileLimit();
+
+    //! Restore the limit of open files changed by raiseFileLimit()
+    void restoreFileLimit();
+
     //! Enter normal mode (restart boosters with cache enabled)
     void enterNormalMode();
 
@@ -142,6 +298,64 @@ private:
     //! Kill all active boosters with -9
     void killBoosters();
 
+    //! Ask spare boosters to warm up to given level in place. Boosters
+    //! that can't be upgraded are killed and replaced.
+    void upgradeBoosters(int level);
+
+    //! Let the template processes of all booster types exit
+    void stopTemplates();
+
+    //! Create the control socket, see controlSocketId()
+    void initControlSocket();
+
+    //! Return socket id of the control socket
+    string controlSocketId() const;
+
+    //! Accept connections to the control socket
+    void acceptControlClients();
+
+    //! Read the request of a control client and answer it once complete
+    void readControlClient(uint32_t id);
+
+    //! Answer a control request in a worker process that sends the
+    //! response to the client itself
+    void forkControlWorker(uint32_t id, const string &request);
+
+    //! Send more of the response to a control client, close it once sent
+    void writeControlClient(uint32_t id);
+
+    //! Close the connection of a control client
+    void closeControlClient(uint32_t id);
+
+    //! Execute a control request, return the response
+    string handleControlRequest(const string &request);
+
+    //! Return daemon and booster type status as control response lines
+    string controlStatus();
+
+    //! Return one control response line per child process
+    string controlChildren();
+
+    //! Return metrics in the Prometheus text format
+    string controlMetrics();
+
+    //! Return memory usage per process, per group and in total as control response lines
+    string controlMemory();
+
+    //! Memory usage summed up by group: application binary name, spare
+    //! boosters or template of a booster type, daemon
+    typedef map<string, MemoryUsage> MemoryUsageMap;
+
+    //! Read memory usage of the daemon and its children. One control
+    //! response line per process is stored in processLines if given.
+    MemoryUsageMap readMemoryUsage(string *processLines);
+
+    //! Return "template", "starting", "spare" or "application"
+    const char *childState(const Child &child) const;
+
+    //! Set the pool size limits of every booster type
+    void resizeBoosterPools(int minSize, int maxSize);
+
     //! Prints the usage and exits with given status
     void usage(const char *name, int status);
 
@@ -159,27 +373,183 @@ private:
      */
     bool m_bootMode;
 
-    //! Vector of current child PID's
-    typedef vector<pid_t> PidVect;
-    PidVect m_children;
+    //! Warm-up level of boosters started in boot mode (--boot-level)
+    int m_bootWarmupLevel;
+
+    //! Bookkeeping of a forked booster and the application it turns into
+    struct Child
+    {
+        pid_t pid;
+        int pidFd;          //!< -1 if pidfds are not supported
+        pid_t invokerPid;   //!< -1 if not known
+        int invokerPidFd;   //!< -1 if not known
+        int invokerFd;      //!< Socket of a waiting invoker or -1
+        int upgradeFd;      //!< Warm-up requests to a spare booster or -1
+        uint32_t type;      //!< Index of the booster type in m_boosterTypes
+        unsigned started;   //!< Time the child was forked
+        int warmupLevel;    //!< Level reported by a spare booster, -1 until ready
+        unsigned warmupTime; //!< Milliseconds the booster spent warming up
+        string binary;      //!< Launched binary, empty while a booster
+    };
+
+    //! Current children by pid
+    typedef map<pid_t, Child> ChildMap;
+    ChildMap m_children;
+
+    //! Number of children that need SIGCHLD for reaping
+    int m_childrenWithoutPidFd;
+
+    //! State of a hosted booster type
+    struct BoosterType
+    {
+        //! Booster instance of the type
+        Booster * booster;
+
+        //! Spare boosters waiting for invokers
+        BoosterPool * pool;
+
+        //! Timing of postponed booster respawns
+        RespawnScheduler * respawnScheduler;
+
+        //! True while the listening socket is watched for waiting invokers
+        bool watchingLaunchSocket;
+
+        //! Template process that forks warm boosters, -1 if not running
+        pid_t templatePid;
+
+        //! Socket for fork requests to the template process
+        int templateSocket;
+
+        //! True once the template has finished preloading
+        bool templateReady;
+
+        //! True while a fork request to the template is unanswered
+        bool templateForking;
+
+        //! Daemon end of the upgrade socket of the pending fork request
+        int templateUpgradeSocket;
+
+        //! Time by which a starting template must be ready or the
+        //! pending fork request must be answered
+        unsigned templateDeadline;
 
-    //! Storage of booster <-> invoker pid pairs
-    typedef map<pid_t, pid_t> PidMap;
-    PidMap m_boosterPidToInvokerPid;
+        //! Time after which a failed template can be restarted, 0 if none
+        unsigned templateRetry;
 
-    //! Storage of booster <-> invoker socket file descriptor pairs
-    typedef map<pid_t, pid_t> FdMap;
-    FdMap m_boosterPidToInvokerFd;
+        //! Warm-up time in milliseconds of the booster that got ready last
+        unsigned lastWarmupTime;
+    };
 
-    //! Current booster pid
-    pid_t m_boosterPid;
+    //! Hosted booster types, index is used as id in events and child records
+    typedef vector<BoosterType> BoosterTypeVector;
+    BoosterTypeVector m_boosterTypes;
+
+    //! Pool size limits (--pool-min, --pool-max) of every booster type
+    int m_poolMinSize;
+    int m_poolMaxSize;
+
+    //! Length of the accept queue of the invoker sockets (--listen-backlog)
+    int m_listenBacklog;
+
+    //! Template mode flag (--template)
+    bool m_useTemplate;
+
+    //! Time in milliseconds after a launch when the launch profile is
+    //! recorded (--record-profiles), 0 if profiles are not recorded
+    unsigned m_profileDelay;
+
+    //! Launched application whose profile is recorded later
+    struct PendingProfile
+    {
+        pid_t pid;
+        string fileName;
+        unsigned deadline;
+    };
+
+    typedef vector<PendingProfile> PendingProfileVector;
+    PendingProfileVector m_pendingProfiles;
+
+    //! Process recording a launch profile, see startProfileRecorder()
+    struct ProfileRecorder
+    {
+        pid_t appPid;
+        string fileName;
+    };
+
+    //! Profile recorders by the read end of their result pipe
+    typedef map<int, ProfileRecorder> ProfileRecorderMap;
+    ProfileRecorderMap m_profileRecorders;
+
+    //! Number of records in trace files (--trace), 0 if not tracing
+    unsigned m_traceRecords;
+
+    //! Exited processes whose trace files are kept, oldest first
+    vector<pid_t> m_exitedTraces;
 
     //! Socket pair used to tell the parent that a new booster is needed +
     //! some parameters.
     int m_boosterLauncherSocket[2];
 
-    //! Pipe used to safely catch Unix signals
-    int m_sigPipeFd[2];
+    //! Signal fd used to safely catch Unix signals
+    int m_signalFd;
+
+    //! Signal mask before the signals were blocked for m_signalFd
+    sigset_t m_originalSigMask;
+
+    //! Epoll instance of the main loop
+    int m_epollFd;
+
+    //! Limit of open files before raiseFileLimit()
+    struct rlimit m_originalFileLimit;
+
+    //! Timer used for termination deadlines
+    int m_timerFd;
+
+    //! State of an asynchronous invoker / process termination
+    struct Termination
+    {
+        enum Stage { Disconnecting, Terminating, Killing };
+
+        const char *label;
+        pid_t pid;
+        int pidFd;
+        int socketFd;
+        Stage stage;
+        unsigned deadline;
+    };
+
+    //! Pending terminations by id
+    typedef map<uint32_t, Termination> TerminationMap;
+    TerminationMap m_terminations;
+
+    //! Id for the next termination
+    uint32_t m_nextTerminationId;
+
+    //! True once SIGTERM / SIGINT has been received
+    bool m_exiting;
+
+    //! Time the daemon was started
+    unsigned m_startTime;
+
+    //! Pid of the daemon, control workers read its memory usage
+    pid_t m_pid;
+
+    //! Connection of a control client, the request read so far and
+    //! the response once the request is complete
+    struct ControlClient
+    {
+        int fd;
+        string request;
+        string response;
+        string::size_type sent;
+    };
+
+    //! Connected control clients by id
+    typedef map<uint32_t, ControlClient> ControlClientMap;
+    ControlClientMap m_controlClients;
+
+    //! Id for the next control client
+    uint32_t m_nextControlClientId;
 
     //! Argument vector initially given to the launcher process
     int m_initialArgc;
@@ -190,29 +560,29 @@ private:
     //! Singleton Daemon instance
     static Daemon * m_instance;
 
-    //! Time to sleep before forking a new booster
+    //! Minimum time in seconds before replacing a spare booster that exited
     static const int m_boosterSleepTime;
 
     //! Manager for invoker <-> booster sockets
     SocketManager * m_socketManager;
 
+    //! Launch counters and latency histograms
+    LaunchMetrics * m_metrics;
+
     //! Single instance plugin handle
     SingleInstance * m_singleInstance;
 
-    //! Original unix signal handlers are saved here
-    typedef map<int, sighandler_t> SigHandlerMap;
-    SigHandlerMap m_originalSigHandlers;
-
     //! True if systemd needs to be notified
     bool m_notifySystemd;
     string m_boostedApplication;
 
+    //! Binary of the boosted application (--application-binary), found
+    //! in PATH by the application name if not given
+    string m_applicationBinary;
+
     //! Drop capabilities needed for initialization
     static void dropCapabilities();
 
-    //! Booster instance
-    Booster * m_booster;
-
 #ifdef UNIT_TEST
     friend class Ut_Daemon;
 #endif
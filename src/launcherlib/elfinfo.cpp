@@ -0,0 +1,253 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#include "elfinfo.h"
+
+#include <cstring>
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef DF_1_PIE
+#define DF_1_PIE 0x08000000
+#endif
+
+ElfInfo::ElfInfo(const string &path) :
+    m_data(NULL),
+    m_size(0)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size >= (off_t)sizeof(ElfW(Ehdr))) {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            m_data = static_cast<const unsigned char *>(data);
+            m_size = st.st_size;
+        }
+    }
+    close(fd);
+
+    if (m_data && !isValid()) {
+        munmap(const_cast<unsigned char *>(m_data), m_size);
+        m_data = NULL;
+        m_size = 0;
+    }
+}
+
+ElfInfo::~ElfInfo()
+{
+    if (m_data)
+        munmap(const_cast<unsigned char *>(m_data), m_size);
+}
+
+bool ElfInfo::isValid() const
+{
+    if (!m_data)
+        return false;
+
+    const ElfW(Ehdr) *ehdr = reinterpret_cast<const ElfW(Ehdr) *>(m_data);
+    return (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) == 0 &&
+            ehdr->e_ident[EI_CLASS] == (sizeof(void *) == 8 ? ELFCLASS64 : ELFCLASS32) &&
+            ehdr->e_phentsize == sizeof(ElfW(Phdr)) &&
+            (ehdr->e_shnum == 0 || ehdr->e_shentsize == sizeof(ElfW(Shdr))));
+}
+
+bool ElfInfo::isDynamic() const
+{
+    return isValid() && reinterpret_cast<const ElfW(Ehdr) *>(m_data)->e_type == ET_DYN;
+}
+
+bool ElfInfo::isPieExecutable() const
+{
+    return (dynamicEntry(DT_FLAGS_1) & DF_1_PIE) != 0;
+}
+
+bool ElfInfo::exportsFunction(const char *name) const
+{
+    if (!isValid())
+        return false;
+
+    // Section headers give the size of the dynamic symbol table,
+    // which the dynamic section alone does not
+    const ElfW(Ehdr) *ehdr = reinterpret_cast<const ElfW(Ehdr) *>(m_data);
+    const ElfW(Shdr) *shdrs = static_cast<const ElfW(Shdr) *>(
+                at(ehdr->e_shoff, (size_t)ehdr->e_shnum * sizeof(ElfW(Shdr))));
+    if (!shdrs)
+        return false;
+
+    for (int i = 0; i < ehdr->e_shnum; ++i) {
+        const ElfW(Shdr) &symtab = shdrs[i];
+        if (symtab.sh_type != SHT_DYNSYM || symtab.sh_link >= ehdr->e_shnum ||
+            symtab.sh_entsize != sizeof(ElfW(Sym)))
+            continue;
+
+        const ElfW(Shdr) &strtab = shdrs[symtab.sh_link];
+        const ElfW(Sym) *syms = static_cast<const ElfW(Sym) *>(at(symtab.sh_offset, symtab.sh_size));
+        const char *strings = static_cast<const char *>(at(strtab.sh_offset, strtab.sh_size));
+        if (!syms || !strings)
+            return false;
+
+        size_t count = symtab.sh_size / sizeof(ElfW(Sym));
+        for (size_t j = 0; j < count; ++j) {
+            const ElfW(Sym) &sym = syms[j];
+            int bind = ELF64_ST_BIND(sym.st_info);
+            if (sym.st_shndx == SHN_UNDEF || sym.st_name >= strtab.sh_size ||
+                ELF64_ST_TYPE(sym.st_info) != STT_FUNC ||
+                (bind != STB_GLOBAL && bind != STB_WEAK) ||
+                ELF64_ST_VISIBILITY(sym.st_other) != STV_DEFAULT)
+                continue;
+
+            // Name must be terminated within the string table
+            const char *symName = strings + sym.st_name;
+            size_t left = strtab.sh_size - sym.st_name;
+            if (strnlen(symName, left) < left && strcmp(symName, name) == 0)
+                return true;
+        }
+    }
+
+    return false;
+}
+
+const void *ElfInfo::at(size_t offset, size_t size) const
+{
+    if (!m_data || offset > m_size || size > m_size - offset)
+        return NULL;
+    return m_data + offset;
+}
+
+vector<string> ElfInfo::neededLibraries() const
+{
+    vector<string> libraries;
+
+    size_t count = 0;
+    const ElfW(Dyn) *dyn = static_cast<const ElfW(Dyn) *>(dynamicSection(count));
+    if (!dyn)
+        return libraries;
+
+    for (size_t i = 0; i < count && dyn[i].d_tag != DT_NULL; ++i) {
+        if (dyn[i].d_tag != DT_NEEDED)
+            continue;
+
+        const char *name = dynamicString(dyn[i].d_un.d_val);
+        if (name)
+            libraries.push_back(name);
+    }
+
+    return libraries;
+}
+
+bool ElfInfo::needsLibrary(const string &prefix) const
+{
+    vector<string> libraries = neededLibraries();
+    for (vector<string>::const_iterator it = libraries.begin(); it != libraries.end(); ++it) {
+        if (it->compare(0, prefix.size(), prefix) == 0)
+            return true;
+    }
+    return false;
+}
+
+string ElfInfo::runPath() const
+{
+    // DT_RPATH is ignored by the dynamic loader if DT_RUNPATH is present
+    unsigned long offset = dynamicEntry(DT_RUNPATH);
+    if (!offset)
+        offset = dynamicEntry(DT_RPATH);
+
+    const char *path = offset ? dynamicString(offset) : NULL;
+    return path ? path : string();
+}
+
+const char *ElfInfo::dynamicString(size_t offset) const
+{
+    // String table is given as a virtual address
+    size_t size = dynamicEntry(DT_STRSZ);
+    size_t tableOffset = fileOffset(dynamicEntry(DT_STRTAB));
+    const char *strings = static_cast<const char *>(at(tableOffset, size));
+    if (!tableOffset || !strings || offset >= size)
+        return NULL;
+
+    // Must be terminated within the string table
+    if (strnlen(strings + offset, size - offset) == size - offset)
+        return NULL;
+
+    return strings + offset;
+}
+
+const void *ElfInfo::dynamicSection(size_t &count) const
+{
+    count = 0;
+    if (!isValid())
+        return NULL;
+
+    const ElfW(Ehdr) *ehdr = reinterpret_cast<const ElfW(Ehdr) *>(m_data);
+    const ElfW(Phdr) *phdrs = static_cast<const ElfW(Phdr) *>(
+                at(ehdr->e_phoff, (size_t)ehdr->e_phnum * sizeof(ElfW(Phdr))));
+    if (!phdrs)
+        return NULL;
+
+    for (int i = 0; i < ehdr->e_phnum; ++i) {
+        if (phdrs[i].p_type != PT_DYNAMIC)
+            continue;
+
+        const void *dyn = at(phdrs[i].p_offset, phdrs[i].p_filesz);
+        if (dyn)
+            count = phdrs[i].p_filesz / sizeof(ElfW(Dyn));
+        return dyn;
+    }
+
+    return NULL;
+}
+
+unsigned long ElfInfo::dynamicEntry(long tag) const
+{
+    size_t count = 0;
+    const ElfW(Dyn) *dyn = static_cast<const ElfW(Dyn) *>(dynamicSection(count));
+    if (!dyn)
+        return 0;
+
+    for (size_t i = 0; i < count && dyn[i].d_tag != DT_NULL; ++i) {
+        if (dyn[i].d_tag == tag)
+            return dyn[i].d_un.d_val;
+    }
+
+    return 0;
+}
+
+size_t ElfInfo::fileOffset(unsigned long address) const
+{
+    if (!isValid())
+        return 0;
+
+    const ElfW(Ehdr) *ehdr = reinterpret_cast<const ElfW(Ehdr) *>(m_data);
+    const ElfW(Phdr) *phdrs = static_cast<const ElfW(Phdr) *>(
+                at(ehdr->e_phoff, (size_t)ehdr->e_phnum * sizeof(ElfW(Phdr))));
+    if (!phdrs)
+        return 0;
+
+    for (int i = 0; i < ehdr->e_phnum; ++i) {
+        const ElfW(Phdr) &phdr = phdrs[i];
+        if (phdr.p_type == PT_LOAD && address >= phdr.p_vaddr &&
+            address - phdr.p_vaddr < phdr.p_filesz)
+            return phdr.p_offset + (address - phdr.p_vaddr);
+    }
+
+    return 0;
+}
@@ -0,0 +1,104 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifndef ELFINFO_H
+#define ELFINFO_H
+
+#include "launcherlib.h"
+
+#include <cstddef>
+#include <string>
+
+using std::string;
+
+#include <vector>
+
+using std::vector;
+
+/*!
+ * \class ElfInfo
+ * \brief Read-only inspection of an ELF binary of the native class.
+ *
+ * The file is mapped, not loaded, so inspecting it does not run any
+ * code of the binary. All lookups are bounds checked and simply fail
+ * on truncated or otherwise malformed files.
+ */
+class DECL_EXPORT ElfInfo
+{
+public:
+
+    //! Map the file at given path for inspection
+    explicit ElfInfo(const string &path);
+
+    //! Destructor
+    ~ElfInfo();
+
+    //! Return true if the file is an ELF binary of the native class
+    bool isValid() const;
+
+    //! Return true for shared objects and position independent executables (ET_DYN)
+    bool isDynamic() const;
+
+    //! Return true if the object is flagged as PIE executable (DF_1_PIE),
+    //! glibc refuses to dlopen() those
+    bool isPieExecutable() const;
+
+    //! Return true if the dynamic symbol table has a defined global function of given name
+    bool exportsFunction(const char *name) const;
+
+    //! Return sonames of the libraries the object depends on directly (DT_NEEDED)
+    vector<string> neededLibraries() const;
+
+    //! Return true if one of the needed libraries has a soname starting with given prefix
+    bool needsLibrary(const string &prefix) const;
+
+    //! Return library search path of the object (DT_RUNPATH or DT_RPATH), empty if none
+    string runPath() const;
+
+private:
+
+    //! Disable copy-constructor
+    ElfInfo(const ElfInfo & r);
+
+    //! Disable assignment operator
+    ElfInfo & operator= (const ElfInfo & r);
+
+    //! Return pointer to size bytes at offset or NULL if out of bounds
+    const void *at(size_t offset, size_t size) const;
+
+    //! Return the dynamic section and its number of entries, or NULL
+    const void *dynamicSection(size_t &count) const;
+
+    //! Return value of a dynamic section entry, or 0 if not present
+    unsigned long dynamicEntry(long tag) const;
+
+    //! Return string at given offset of the dynamic string table, or NULL
+    const char *dynamicString(size_t offset) const;
+
+    //! Return file offset of a virtual address of a loaded segment, or 0
+    size_t fileOffset(unsigned long address) const;
+
+    //! Mapped file, NULL if it could not be mapped
+    const unsigned char *m_data;
+
+    //! Size of the mapping
+    size_t m_size;
+
+#ifdef UNIT_TEST
+    friend class Ut_ElfInfo;
+#endif
+};
+
+#endif // ELFINFO_H
@@ -0,0 +1,275 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#include "launchmetrics.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+
+/* Bucket bounds are 2^n * (1 + k / SUB_BUCKETS) microseconds */
+static const int SUB_BUCKETS = 4;
+static const int MIN_EXPONENT = 7;     // 128 us
+static const int MAX_EXPONENT = 26;    // 67 s
+
+/* Applications counted separately per booster type, the rest are
+ * counted as "other" to bound the number of exported series */
+static const size_t MAX_APPLICATIONS = 64;
+
+static const char * const HISTOGRAM_NAMES[] = {
+    "appmotor_booster_ready_seconds",
+    "appmotor_warmup_seconds",
+    "appmotor_handshake_seconds",
+    "appmotor_respawn_delay_seconds",
+};
+
+static const char * const HISTOGRAM_HELP[] = {
+    "Time from forking a booster until it accepts invokers.",
+    "Time a booster spends preloading, per warm-up.",
+    "Time from accepting an invoker until its launch request is received.",
+    "Time booster respawn is postponed after a launch.",
+};
+
+LatencyHistogram::LatencyHistogram() :
+    m_buckets(bucketCount() + 1, 0),
+    m_count(0),
+    m_sum(0)
+{}
+
+int LatencyHistogram::bucketCount()
+{
+    return (MAX_EXPONENT - MIN_EXPONENT) * SUB_BUCKETS + 1;
+}
+
+uint64_t LatencyHistogram::bucketBound(int bucket)
+{
+    int exponent = MIN_EXPONENT + bucket / SUB_BUCKETS;
+    uint64_t base = (uint64_t)1 << exponent;
+    return base + base / SUB_BUCKETS * (bucket % SUB_BUCKETS);
+}
+
+void LatencyHistogram::record(uint64_t microseconds)
+{
+    // First bucket whose upper bound is not below the value
+    int low = 0;
+    int high = bucketCount();
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (bucketBound(middle) < microseconds)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    m_buckets[low]++;
+    m_count++;
+    m_sum += microseconds;
+}
+
+uint64_t LatencyHistogram::count() const
+{
+    return m_count;
+}
+
+uint64_t LatencyHistogram::sum() const
+{
+    return m_sum;
+}
+
+uint64_t LatencyHistogram::bucket(int bucket) const
+{
+    return m_buckets[bucket];
+}
+
+uint64_t LatencyHistogram::quantile(double q) const
+{
+    if (m_count == 0)
+        return 0;
+
+    uint64_t rank = std::max<uint64_t>((uint64_t)(q * m_count + 0.5), 1);
+    uint64_t seen = 0;
+    for (int i = 0; i < bucketCount(); ++i) {
+        seen += m_buckets[i];
+        if (seen >= rank)
+            return bucketBound(i);
+    }
+    return bucketBound(bucketCount() - 1);
+}
+
+LaunchMetrics::TypeMetrics::TypeMetrics() :
+    hits(0),
+    misses(0),
+    templateFallbacks(0)
+{}
+
+LaunchMetrics::LaunchMetrics() :
+    m_invokerFallbacks(0)
+{}
+
+void LaunchMetrics::recordLaunch(const string &type, const string &binary, bool missed)
+{
+    TypeMetrics &metrics = m_types[type];
+
+    string name = binary.substr(binary.rfind('/') + 1);
+    if (name.empty())
+        name = "unknown";
+    else if (metrics.launches.size() >= MAX_APPLICATIONS && !metrics.launches.count(name))
+        name = "other";
+
+    metrics.launches[name]++;
+    if (missed)
+        metrics.misses++;
+    else
+        metrics.hits++;
+}
+
+void LaunchMetrics::record(const string &type, Histogram histogram, uint64_t microseconds)
+{
+    m_types[type].histograms[histogram].record(microseconds);
+}
+
+void LaunchMetrics::recordTemplateFallback(const string &type)
+{
+    m_types[type].templateFallbacks++;
+}
+
+void LaunchMetrics::setInvokerFallbacks(uint64_t count)
+{
+    m_invokerFallbacks = count;
+}
+
+void LaunchMetrics::setMemoryUsage(const map<string, MemoryUsage> &usage)
+{
+    m_memoryUsage = usage;
+}
+
+// Return label value with backslash, quote and newline escaped
+static string labelValue(const string &value)
+{
+    string escaped;
+    for (string::const_iterator it = value.begin(); it != value.end(); ++it) {
+        if (*it == '\\' || *it == '"')
+            escaped += '\\';
+        if (*it == '\n')
+            escaped += "\\n";
+        else
+            escaped += *it;
+    }
+    return escaped;
+}
+
+static string seconds(uint64_t microseconds)
+{
+    char buf[32];
+    snprintf(buf, sizeof buf, "%.6f", microseconds / 1e6);
+    return buf;
+}
+
+string LaunchMetrics::prometheus() const
+{
+    std::ostringstream out;
+
+    out << "# HELP appmotor_launches_total Applications launched by boosters.\n"
+        << "# TYPE appmotor_launches_total counter\n";
+    for (TypeMetricsMap::const_iterator type = m_types.begin(); type != m_types.end(); ++type) {
+        const map<string, uint64_t> &launches = type->second.launches;
+        for (map<string, uint64_t>::const_iterator it = launches.begin(); it != launches.end(); ++it)
+            out << "appmotor_launches_total{type=\"" << labelValue(type->first)
+                << "\",app=\"" << labelValue(it->first) << "\"} " << it->second << '\n';
+    }
+
+    out << "# HELP appmotor_booster_misses_total Launches whose invoker had to wait for a booster.\n"
+        << "# TYPE appmotor_booster_misses_total counter\n";
+    for (TypeMetricsMap::const_iterator type = m_types.begin(); type != m_types.end(); ++type)
+        out << "appmotor_booster_misses_total{type=\"" << labelValue(type->first) << "\"} "
+            << type->second.misses << '\n';
+
+    out << "# HELP appmotor_booster_hits_total Launches served by an already waiting booster.\n"
+        << "# TYPE appmotor_booster_hits_total counter\n";
+    for (TypeMetricsMap::const_iterator type = m_types.begin(); type != m_types.end(); ++type)
+        out << "appmotor_booster_hits_total{type=\"" << labelValue(type->first) << "\"} "
+            << type->second.hits << '\n';
+
+    out << "# HELP appmotor_template_fallbacks_total Template failures after which boosters were forked directly.\n"
+        << "# TYPE appmotor_template_fallbacks_total counter\n";
+    for (TypeMetricsMap::const_iterator type = m_types.begin(); type != m_types.end(); ++type)
+        out << "appmotor_template_fallbacks_total{type=\"" << labelValue(type->first) << "\"} "
+            << type->second.templateFallbacks << '\n';
+
+    out << "# HELP appmotor_invoker_fallbacks_total Launches the invoker did without a booster.\n"
+        << "# TYPE appmotor_invoker_fallbacks_total counter\n"
+        << "appmotor_invoker_fallbacks_total " << m_invokerFallbacks << '\n';
+
+    out << "# HELP appmotor_memory_bytes Memory of the daemon, boosters and applications by group and kind.\n"
+        << "# TYPE appmotor_memory_bytes gauge\n";
+    for (map<string, MemoryUsage>::const_iterator it = m_memoryUsage.begin(); it != m_memoryUsage.end(); ++it) {
+        const MemoryUsage &usage = it->second;
+        const unsigned long values[] = {
+            usage.rss, usage.pss, usage.uss(), usage.sharedClean, usage.sharedDirty,
+            usage.privateClean, usage.privateDirty, usage.swap
+        };
+        static const char * const kinds[] = {
+            "rss", "pss", "uss", "shared_clean", "shared_dirty",
+            "private_clean", "private_dirty", "swap"
+        };
+        for (size_t i = 0; i < sizeof values / sizeof *values; ++i)
+            out << "appmotor_memory_bytes{group=\"" << labelValue(it->first) << "\",kind=\""
+                << kinds[i] << "\"} " << values[i] * 1024ull << '\n';
+    }
+
+    out << "# HELP appmotor_memory_processes Processes in a memory group.\n"
+        << "# TYPE appmotor_memory_processes gauge\n";
+    for (map<string, MemoryUsage>::const_iterator it = m_memoryUsage.begin(); it != m_memoryUsage.end(); ++it)
+        out << "appmotor_memory_processes{group=\"" << labelValue(it->first) << "\"} "
+            << it->second.processes << '\n';
+
+    for (int h = 0; h < HistogramCount; ++h) {
+        out << "# HELP " << HISTOGRAM_NAMES[h] << ' ' << HISTOGRAM_HELP[h] << '\n'
+            << "# TYPE " << HISTOGRAM_NAMES[h] << " histogram\n";
+
+        for (TypeMetricsMap::const_iterator type = m_types.begin(); type != m_types.end(); ++type) {
+            const LatencyHistogram &histogram = type->second.histograms[h];
+            string label = "type=\"" + labelValue(type->first) + "\"";
+
+            uint64_t cumulative = 0;
+            for (int i = 0; i < LatencyHistogram::bucketCount(); ++i) {
+                cumulative += histogram.bucket(i);
+                out << HISTOGRAM_NAMES[h] << "_bucket{" << label << ",le=\""
+                    << seconds(LatencyHistogram::bucketBound(i)) << "\"} " << cumulative << '\n';
+            }
+            out << HISTOGRAM_NAMES[h] << "_bucket{" << label << ",le=\"+Inf\"} " << histogram.count() << '\n'
+                << HISTOGRAM_NAMES[h] << "_sum{" << label << "} " << seconds(histogram.sum()) << '\n'
+                << HISTOGRAM_NAMES[h] << "_count{" << label << "} " << histogram.count() << '\n';
+        }
+    }
+
+    return out.str();
+}
+
+string LaunchMetrics::summary(const string &type) const
+{
+    std::ostringstream out;
+    TypeMetricsMap::const_iterator it = m_types.find(type);
+    if (it == m_types.end())
+        return out.str();
+
+    const TypeMetrics &metrics = it->second;
+    uint64_t launches = metrics.hits + metrics.misses;
+    out << "launches=" << launches
+        << " miss-rate=" << (launches ? metrics.misses * 100 / launches : 0) << '%'
+        << " ready-p50=" << metrics.histograms[BoosterReady].quantile(0.5) / 1000 << "ms"
+        << " handshake-p95=" << metrics.histograms[Handshake].quantile(0.95) << "us";
+    return out.str();
+}
@@ -0,0 +1,141 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifndef LAUNCHMETRICS_H
+#define LAUNCHMETRICS_H
+
+#include "launcherlib.h"
+#include "memoryusage.h"
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+using std::map;
+using std::string;
+using std::vector;
+
+/*!
+ * \class LatencyHistogram
+ * \brief Log-linear histogram of durations in microseconds.
+ *
+ * Every power of two from 128 us to 67 s is split into four linear
+ * buckets, so quantiles are accurate to 25 % over the whole range while
+ * the bucket bounds stay fixed, as Prometheus histograms require.
+ */
+class DECL_EXPORT LatencyHistogram
+{
+public:
+
+    LatencyHistogram();
+
+    //! Add a duration
+    void record(uint64_t microseconds);
+
+    //! Return number of recorded durations
+    uint64_t count() const;
+
+    //! Return sum of recorded durations in microseconds
+    uint64_t sum() const;
+
+    //! Return upper bound of the bucket holding the given quantile (0..1),
+    //! 0 if nothing has been recorded
+    uint64_t quantile(double q) const;
+
+    //! Return number of finite buckets, the last bucket counts the rest
+    static int bucketCount();
+
+    //! Return upper bound in microseconds of a finite bucket
+    static uint64_t bucketBound(int bucket);
+
+    //! Return number of durations in a bucket, not cumulative
+    uint64_t bucket(int bucket) const;
+
+private:
+
+    vector<uint64_t> m_buckets;
+    uint64_t m_count;
+    uint64_t m_sum;
+};
+
+/*!
+ * \class LaunchMetrics
+ * \brief Counters and latency histograms of the daemon, per booster type.
+ *
+ * The daemon records launches and booster timings as they happen.
+ * The metrics are exported in the Prometheus text format through the
+ * control socket and summarized in the systemd status.
+ */
+class DECL_EXPORT LaunchMetrics
+{
+public:
+
+    enum Histogram
+    {
+        BoosterReady,       //!< Booster forked until it accepts invokers
+        Warmup,             //!< Preloading done by a booster, see Booster::warmUp()
+        Handshake,          //!< Invoker accepted until the launch request is received
+        RespawnDelay,       //!< Respawn postponed after a launch, see RespawnScheduler
+        HistogramCount
+    };
+
+    LaunchMetrics();
+
+    //! Count a launch of the binary by a booster of the given type
+    void recordLaunch(const string &type, const string &binary, bool missed);
+
+    //! Add a duration to a histogram of the given booster type
+    void record(const string &type, Histogram histogram, uint64_t microseconds);
+
+    //! Count a template failure after which boosters are forked directly
+    void recordTemplateFallback(const string &type);
+
+    //! Set number of launches the invoker did without a booster
+    void setInvokerFallbacks(uint64_t count);
+
+    //! Set current memory usage by process group, see Daemon::readMemoryUsage()
+    void setMemoryUsage(const map<string, MemoryUsage> &usage);
+
+    //! Return all metrics in the Prometheus text exposition format
+    string prometheus() const;
+
+    //! Return a short summary of a booster type for the systemd status
+    string summary(const string &type) const;
+
+private:
+
+    struct TypeMetrics
+    {
+        TypeMetrics();
+
+        //! Launches by application binary name
+        map<string, uint64_t> launches;
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t templateFallbacks;
+        LatencyHistogram histograms[HistogramCount];
+    };
+
+    typedef map<string, TypeMetrics> TypeMetricsMap;
+    TypeMetricsMap m_types;
+
+    uint64_t m_invokerFallbacks;
+
+    map<string, MemoryUsage> m_memoryUsage;
+};
+
+#endif // LAUNCHMETRICS_H
@@ -0,0 +1,324 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#include "launchprofile.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+static const char PROFILE_HEADER[] = "# cutefish-appmotor launch profile";
+
+/* Bit of a /proc/<pid>/pagemap entry set if the page is mapped into
+ * the process, see Documentation/admin-guide/mm/pagemap.rst */
+static const uint64_t PAGEMAP_PRESENT = 1ull << 63;
+
+/* Pagemap entries read at once */
+static const size_t PAGEMAP_CHUNK = 1024;
+
+static unsigned long pageSize()
+{
+    static const unsigned long size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+LaunchProfile::LaunchProfile(const string &fileName) :
+    m_fileName(fileName)
+{}
+
+const string &LaunchProfile::fileName() const
+{
+    return m_fileName;
+}
+
+string LaunchProfile::directory()
+{
+    const char *cache = getenv("XDG_CACHE_HOME");
+    if (cache && cache[0] == '/')
+        return string(cache) + "/cutefish-appmotor/profiles";
+
+    const char *home = getenv("HOME");
+    if (home && home[0] == '/')
+        return string(home) + "/.cache/cutefish-appmotor/profiles";
+
+    return string();
+}
+
+string LaunchProfile::path() const
+{
+    string dir = directory();
+    if (dir.empty())
+        return string();
+
+    // Binaries of the same name in different directories get different
+    // profiles, FNV-1a hash of the full path tells them apart
+    uint32_t hash = 2166136261u;
+    for (string::const_iterator it = m_fileName.begin(); it != m_fileName.end(); ++it)
+        hash = (hash ^ (unsigned char)*it) * 16777619u;
+
+    char suffix[16];
+    snprintf(suffix, sizeof suffix, "-%08x", hash);
+
+    return dir + '/' + m_fileName.substr(m_fileName.rfind('/') + 1) + suffix + ".profile";
+}
+
+bool LaunchProfile::load()
+{
+    m_files.clear();
+
+    string profilePath = path();
+    std::ifstream profile(profilePath.c_str());
+    string line;
+    if (profilePath.empty() || !std::getline(profile, line) ||
+        line.compare(0, sizeof PROFILE_HEADER - 1, PROFILE_HEADER) != 0)
+        return false;
+
+    RangeVector *ranges = NULL;
+    while (std::getline(profile, line)) {
+        if (line.compare(0, 2, "F ") == 0) {
+            ranges = &m_files[line.substr(2)];
+        } else if (line.compare(0, 2, "R ") == 0 && ranges) {
+            Range range(0, 0);
+            std::istringstream numbers(line.substr(2));
+            if (numbers >> range.first >> range.second && range.second > 0)
+                ranges->push_back(range);
+        }
+    }
+
+    normalize();
+    return true;
+}
+
+bool LaunchProfile::save() const
+{
+    string profilePath = path();
+    if (profilePath.empty())
+        return false;
+
+    // Create the directory and missing parents
+    string dir = directory();
+    for (size_t slash = dir.find('/', 1); ; slash = dir.find('/', slash + 1)) {
+        mkdir(dir.substr(0, slash).c_str(), 0700);
+        if (slash == string::npos)
+            break;
+    }
+
+    // Readers never see a partially written profile. Profiles of the
+    // same binary may be recorded by several processes at once.
+    char suffix[32];
+    snprintf(suffix, sizeof suffix, ".%d.tmp", (int)getpid());
+    string temporary = profilePath + suffix;
+    {
+        std::ofstream profile(temporary.c_str(), std::ios::trunc);
+        profile << PROFILE_HEADER << " of " << m_fileName << '\n';
+        for (FileMap::const_iterator it = m_files.begin(); it != m_files.end(); ++it) {
+            profile << "F " << it->first << '\n';
+            for (RangeVector::const_iterator range = it->second.begin(); range != it->second.end(); ++range)
+                profile << "R " << range->first << ' ' << range->second << '\n';
+        }
+
+        profile.flush();
+        if (!profile) {
+            unlink(temporary.c_str());
+            return false;
+        }
+    }
+
+    return rename(temporary.c_str(), profilePath.c_str()) == 0;
+}
+
+bool LaunchProfile::record(pid_t pid)
+{
+    m_files.clear();
+
+    char path[32];
+    snprintf(path, sizeof path, "/proc/%d/maps", (int)pid);
+    std::ifstream maps(path);
+    snprintf(path, sizeof path, "/proc/%d/pagemap", (int)pid);
+    int pagemap = open(path, O_RDONLY | O_CLOEXEC);
+    if (!maps || pagemap == -1) {
+        if (pagemap != -1)
+            close(pagemap);
+        return false;
+    }
+
+    string line;
+    while (std::getline(maps, line)) {
+        unsigned long start = 0, end = 0, offset = 0, inode = 0;
+        int pathStart = 0;
+        if (sscanf(line.c_str(), "%lx-%lx %*s %lx %*s %lu %n", &start, &end, &offset, &inode, &pathStart) < 4 ||
+            inode == 0 || pathStart == 0)
+            continue;
+
+        // Only regular files that still exist
+        string file = line.substr(pathStart);
+        if (file.empty() || file[0] != '/' || file.compare(0, 5, "/dev/") == 0 ||
+            (file.size() > 10 && file.compare(file.size() - 10, 10, " (deleted)") == 0))
+            continue;
+
+        addPresentPages(pagemap, file, start, end, offset);
+    }
+
+    close(pagemap);
+    normalize();
+    return true;
+}
+
+void LaunchProfile::addPresentPages(int pagemap, const string &path, unsigned long start,
+                                    unsigned long end, unsigned long offset)
+{
+    RangeVector &ranges = m_files[path];
+    unsigned long first = offset / pageSize();
+    unsigned long count = (end - start) / pageSize();
+    unsigned long runStart = 0;
+    bool inRun = false;
+
+    uint64_t entries[PAGEMAP_CHUNK];
+    for (unsigned long done = 0; done < count; ) {
+        size_t wanted = std::min((unsigned long)PAGEMAP_CHUNK, count - done);
+        ssize_t len = pread(pagemap, entries, wanted * sizeof entries[0],
+                            (off_t)(start / pageSize() + done) * sizeof entries[0]);
+        if (len <= 0)
+            break;
+
+        // Runs of present pages become ranges of the file
+        size_t got = len / sizeof entries[0];
+        for (size_t i = 0; i < got; ++i, ++done) {
+            bool present = entries[i] & PAGEMAP_PRESENT;
+            if (present && !inRun) {
+                runStart = done;
+                inRun = true;
+            } else if (!present && inRun) {
+                ranges.push_back(Range(first + runStart, done - runStart));
+                inRun = false;
+            }
+        }
+    }
+
+    if (inRun)
+        ranges.push_back(Range(first + runStart, count - runStart));
+}
+
+void LaunchProfile::normalize()
+{
+    for (FileMap::iterator it = m_files.begin(); it != m_files.end(); ) {
+        RangeVector &ranges = it->second;
+        std::sort(ranges.begin(), ranges.end());
+
+        RangeVector merged;
+        for (RangeVector::const_iterator range = ranges.begin(); range != ranges.end(); ++range) {
+            if (!merged.empty() && range->first <= merged.back().first + merged.back().second) {
+                unsigned long end = std::max(merged.back().first + merged.back().second,
+                                             range->first + range->second);
+                merged.back().second = end - merged.back().first;
+            } else {
+                merged.push_back(*range);
+            }
+        }
+
+        if (merged.empty()) {
+            m_files.erase(it++);
+        } else {
+            ranges.swap(merged);
+            ++it;
+        }
+    }
+}
+
+unsigned long LaunchProfile::pages() const
+{
+    unsigned long count = 0;
+    for (FileMap::const_iterator it = m_files.begin(); it != m_files.end(); ++it) {
+        for (RangeVector::const_iterator range = it->second.begin(); range != it->second.end(); ++range)
+            count += range->second;
+    }
+    return count;
+}
+
+unsigned long LaunchProfile::commonPages(const LaunchProfile &other) const
+{
+    unsigned long count = 0;
+    for (FileMap::const_iterator it = m_files.begin(); it != m_files.end(); ++it) {
+        FileMap::const_iterator match = other.m_files.find(it->first);
+        if (match == other.m_files.end())
+            continue;
+
+        // Both range lists are sorted and free of overlaps
+        RangeVector::const_iterator a = it->second.begin();
+        RangeVector::const_iterator b = match->second.begin();
+        while (a != it->second.end() && b != match->second.end()) {
+            unsigned long begin = std::max(a->first, b->first);
+            unsigned long end = std::min(a->first + a->second, b->first + b->second);
+            if (begin < end)
+                count += end - begin;
+
+            if (a->first + a->second < b->first + b->second)
+                ++a;
+            else
+                ++b;
+        }
+    }
+    return count;
+}
+
+unsigned long LaunchProfile::prefetch() const
+{
+    unsigned long cached = 0;
+
+    for (FileMap::const_iterator it = m_files.begin(); it != m_files.end(); ++it) {
+        int fd = open(it->first.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            continue;
+
+        struct stat st;
+        if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+            close(fd);
+            continue;
+        }
+
+        // The file may have changed since the profile was recorded
+        unsigned long filePages = (st.st_size + pageSize() - 1) / pageSize();
+        void *data = filePages ? mmap(NULL, filePages * pageSize(), PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        vector<unsigned char> resident(filePages);
+        if (data == MAP_FAILED || mincore(data, filePages * pageSize(), &resident[0]) == -1)
+            resident.assign(filePages, 0);
+
+        for (RangeVector::const_iterator range = it->second.begin(); range != it->second.end(); ++range) {
+            if (range->first >= filePages)
+                break;
+
+            unsigned long count = std::min(range->second, filePages - range->first);
+            for (unsigned long i = range->first; i < range->first + count; i++)
+                cached += resident[i] & 1;
+
+            readahead(fd, range->first * pageSize(), count * pageSize());
+        }
+
+        if (data != MAP_FAILED)
+            munmap(data, filePages * pageSize());
+        close(fd);
+    }
+
+    return cached;
+}
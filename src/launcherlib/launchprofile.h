@@ -0,0 +1,111 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifndef LAUNCHPROFILE_H
+#define LAUNCHPROFILE_H
+
+#include "launcherlib.h"
+
+#include <sys/types.h>
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+using std::map;
+using std::pair;
+using std::string;
+using std::vector;
+
+/*!
+ * \class LaunchProfile
+ * \brief Pages of mapped files an application used while starting up.
+ *
+ * A profile is recorded from /proc/<pid>/maps of a running application:
+ * of every mapped file, the pages that the application has mapped in
+ * (present in /proc/<pid>/pagemap) are stored. Pages that are only in
+ * the page cache, e.g. because an earlier profile prefetched them, are
+ * not part of the working set. On the next launch
+ * of the same binary the profile is replayed as readahead, so a cold
+ * launch reads its working set in large requests instead of faulting
+ * it in page by page.
+ *
+ * Profiles are stored per application binary in
+ * $XDG_CACHE_HOME/cutefish-appmotor/profiles.
+ */
+class DECL_EXPORT LaunchProfile
+{
+public:
+
+    //! Create an empty profile of the application binary at given path
+    explicit LaunchProfile(const string &fileName);
+
+    //! Return path of the application binary
+    const string &fileName() const;
+
+    //! Return path of the stored profile
+    string path() const;
+
+    //! Read the stored profile, return false if there is none
+    bool load();
+
+    //! Store the profile, return false on failure
+    bool save() const;
+
+    //! Replace the profile with the pages mapped in by given process
+    bool record(pid_t pid);
+
+    //! Return the number of pages in the profile
+    unsigned long pages() const;
+
+    //! Return the number of pages that are in both profiles
+    unsigned long commonPages(const LaunchProfile &other) const;
+
+    /*!
+     * \brief Read the pages of the profile into the page cache.
+     * \return Number of pages that were already cached.
+     */
+    unsigned long prefetch() const;
+
+private:
+
+    //! Range of pages, first page and count
+    typedef pair<unsigned long, unsigned long> Range;
+    typedef vector<Range> RangeVector;
+
+    //! Page ranges by file path, sorted and without overlaps
+    typedef map<string, RangeVector> FileMap;
+
+    //! Add the pages of a mapping of a file that are present in the
+    //! page table of the process, read from its pagemap
+    void addPresentPages(int pagemap, const string &path, unsigned long start,
+                         unsigned long end, unsigned long offset);
+
+    //! Sort and merge the ranges of every file
+    void normalize();
+
+    //! Return directory of the profiles
+    static string directory();
+
+    string m_fileName;
+    FileMap m_files;
+
+#ifdef UNIT_TEST
+    friend class Ut_LaunchProfile;
+#endif
+};
+
+#endif // LAUNCHPROFILE_H
@@ -0,0 +1,89 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#include "launchtiming.h"
+#include "logger.h"
+
+#include <cerrno>
+#include <cstring>
+#include <time.h>
+#include <unistd.h>
+
+LaunchTiming::LaunchTiming() :
+    m_count(0),
+    m_start(0),
+    m_last(0)
+{
+    memset(&m_usage, 0, sizeof(m_usage));
+}
+
+void LaunchTiming::start()
+{
+    m_count = 0;
+    getrusage(RUSAGE_SELF, &m_usage);
+    m_start = m_last = now();
+}
+
+uint64_t LaunchTiming::elapsed() const
+{
+    return now() - m_start;
+}
+
+void LaunchTiming::mark(uint32_t stage)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    uint64_t end = now();
+
+    if (m_count < INVOKER_TIMING_MAX_STAGES) {
+        InvokerTiming &timing = m_stages[m_count++];
+        timing.stage = stage;
+        timing.minorFaults = usage.ru_minflt - m_usage.ru_minflt;
+        timing.majorFaults = usage.ru_majflt - m_usage.ru_majflt;
+        timing.voluntarySwitches = usage.ru_nvcsw - m_usage.ru_nvcsw;
+        timing.involuntarySwitches = usage.ru_nivcsw - m_usage.ru_nivcsw;
+        timing.reserved = 0;
+        timing.begin = m_last;
+        timing.end = end;
+    }
+
+    m_usage = usage;
+    m_last = end;
+}
+
+bool LaunchTiming::send(int fd)
+{
+    uint32_t header[2] = { INVOKER_MSG_TIMING, m_count };
+    char buf[sizeof(header) + sizeof(m_stages)];
+    memcpy(buf, header, sizeof(header));
+    memcpy(buf + sizeof(header), m_stages, m_count * sizeof(InvokerTiming));
+
+    size_t size = sizeof(header) + m_count * sizeof(InvokerTiming);
+    m_count = 0;
+
+    if (write(fd, buf, size) != (ssize_t)size) {
+        Logger::logWarning("LaunchTiming: can't send timing: %s", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+uint64_t LaunchTiming::now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
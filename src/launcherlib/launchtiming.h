@@ -0,0 +1,70 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifndef LAUNCHTIMING_H
+#define LAUNCHTIMING_H
+
+#include "launcherlib.h"
+#include "protocol.h"
+
+#include <sys/resource.h>
+
+/*!
+ * \class LaunchTiming
+ * \brief Records how long the stages of a launch take in this process.
+ *
+ * Each stage ends with mark() and begins where the previous one ended.
+ * Besides the monotonic time the page faults and context switches of
+ * the stage are recorded. Invokers started with --timing receive the
+ * stages with send() and print them together with their own.
+ */
+class DECL_EXPORT LaunchTiming
+{
+public:
+
+    //! Constructor
+    LaunchTiming();
+
+    //! Forget recorded stages, the next stage begins now
+    void start();
+
+    //! End the current stage
+    void mark(uint32_t stage);
+
+    //! Send recorded stages as INVOKER_MSG_TIMING with one write and forget them
+    bool send(int fd);
+
+    //! Return nanoseconds since start()
+    uint64_t elapsed() const;
+
+private:
+
+    //! Return CLOCK_MONOTONIC in nanoseconds
+    static uint64_t now();
+
+    InvokerTiming m_stages[INVOKER_TIMING_MAX_STAGES];
+    uint32_t      m_count;
+
+    //! Time of start() and end of the previous stage
+    uint64_t      m_start;
+    uint64_t      m_last;
+    struct rusage m_usage;
+
+#ifdef UNIT_TEST
+    friend class Ut_LaunchTiming;
+#endif
+};
+
+#endif // LAUNCHTIMING_H
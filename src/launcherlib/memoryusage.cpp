@@ -0,0 +1,94 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#include "memoryusage.h"
+
+#include <cstdio>
+#include <cstring>
+
+MemoryUsage::MemoryUsage() :
+    rss(0),
+    pss(0),
+    sharedClean(0),
+    sharedDirty(0),
+    privateClean(0),
+    privateDirty(0),
+    swap(0),
+    processes(0)
+{}
+
+bool MemoryUsage::read(pid_t pid)
+{
+    char path[64];
+    snprintf(path, sizeof path, "/proc/%d/smaps_rollup", (int)pid);
+    FILE *file = fopen(path, "re");
+    if (!file) {
+        // smaps has the same fields once per mapping, they add up the same
+        snprintf(path, sizeof path, "/proc/%d/smaps", (int)pid);
+        file = fopen(path, "re");
+    }
+    if (!file)
+        return false;
+
+    MemoryUsage usage;
+    char line[256];
+    while (fgets(line, sizeof line, file)) {
+        char key[64];
+        unsigned long value = 0;
+        if (sscanf(line, "%63[^:]: %lu kB", key, &value) != 2)
+            continue;
+
+        if (!strcmp(key, "Rss"))
+            usage.rss += value;
+        else if (!strcmp(key, "Pss"))
+            usage.pss += value;
+        else if (!strcmp(key, "Shared_Clean"))
+            usage.sharedClean += value;
+        else if (!strcmp(key, "Shared_Dirty"))
+            usage.sharedDirty += value;
+        else if (!strcmp(key, "Private_Clean"))
+            usage.privateClean += value;
+        else if (!strcmp(key, "Private_Dirty"))
+            usage.privateDirty += value;
+        else if (!strcmp(key, "Swap"))
+            usage.swap += value;
+    }
+    fclose(file);
+
+    // A process that has exited meanwhile has no mappings left
+    if (usage.rss == 0)
+        return false;
+
+    usage.processes = 1;
+    *this = usage;
+    return true;
+}
+
+void MemoryUsage::add(const MemoryUsage &other)
+{
+    rss += other.rss;
+    pss += other.pss;
+    sharedClean += other.sharedClean;
+    sharedDirty += other.sharedDirty;
+    privateClean += other.privateClean;
+    privateDirty += other.privateDirty;
+    swap += other.swap;
+    processes += other.processes;
+}
+
+unsigned long MemoryUsage::uss() const
+{
+    return privateClean + privateDirty;
+}
@@ -0,0 +1,60 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifndef MEMORYUSAGE_H
+#define MEMORYUSAGE_H
+
+#include "launcherlib.h"
+
+#include <sys/types.h>
+
+/*!
+ * \class MemoryUsage
+ * \brief Memory of a process split into shared and private pages.
+ *
+ * Values are in kB as reported by /proc/<pid>/smaps_rollup, or by
+ * /proc/<pid>/smaps on kernels without it. Pages a boosted application
+ * still shares with the booster it was forked from are shared pages,
+ * so comparing RSS to PSS tells how much memory preloading saves.
+ */
+class DECL_EXPORT MemoryUsage
+{
+public:
+
+    //! Constructor, all values zero
+    MemoryUsage();
+
+    //! Read usage of the given process, return false if it can't be read
+    bool read(pid_t pid);
+
+    //! Add usage of another process
+    void add(const MemoryUsage &other);
+
+    //! Unique set size: pages only this process maps
+    unsigned long uss() const;
+
+    unsigned long rss;
+    unsigned long pss;
+    unsigned long sharedClean;
+    unsigned long sharedDirty;
+    unsigned long privateClean;
+    unsigned long privateDirty;
+    unsigned long swap;
+
+    //! Number of processes summed up
+    unsigned int processes;
+};
+
+#endif // MEMORYUSAGE_H
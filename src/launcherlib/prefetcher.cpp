@@ -0,0 +1,193 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#include "prefetcher.h"
+#include "elfinfo.h"
+#include "launchprofile.h"
+#include "logger.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <link.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <deque>
+
+// Searched after the directories of the loaded libraries
+static const char * const DEFAULT_DIRECTORIES[] = {
+    "/lib64", "/usr/lib64", "/lib", "/usr/lib"
+};
+
+void Prefetcher::start(const string &fileName)
+{
+    // The helper is a grandchild, so that the caller only waits for the
+    // intermediate child, which exits right away, and never has to reap
+    // the helper itself
+    pid_t pid = fork();
+    if (pid == -1) {
+        Logger::logWarning("Prefetcher: cannot fork: %m");
+        return;
+    }
+
+    if (pid == 0) {
+        if (fork() == 0) {
+            prefetchProfile(fileName);
+        }
+        _exit(EXIT_SUCCESS);
+    }
+
+    while (waitpid(pid, NULL, 0) == -1 && errno == EINTR)
+        ;
+}
+
+void Prefetcher::prefetchProfile(const string &fileName)
+{
+    // A recorded profile covers the libraries as well, and
+    // only the parts of them that were actually used
+    LaunchProfile profile(fileName);
+    if (!profile.load()) {
+        prefetchClosure(fileName);
+        return;
+    }
+
+    unsigned long pages = profile.pages();
+    unsigned long cached = profile.prefetch();
+    Logger::logDebug("Prefetcher: %lu of %lu profiled pages of %s were cached",
+                     cached, pages, fileName.c_str());
+}
+
+void Prefetcher::prefetchClosure(const string &fileName)
+{
+    // Binary itself first, it is needed first
+    if (!readAhead(fileName))
+        return;
+
+    vector<string> directories;
+    set<string> visited;
+    loadedObjects(directories, visited);
+
+    std::deque<string> pending(1, fileName);
+    unsigned files = 1;
+
+    while (!pending.empty() && files < MAX_FILES) {
+        string path = pending.front();
+        pending.pop_front();
+
+        ElfInfo elf(path);
+        string origin = path.substr(0, path.rfind('/'));
+        string runPath = elf.runPath();
+
+        vector<string> needed = elf.neededLibraries();
+        for (vector<string>::const_iterator it = needed.begin(); it != needed.end(); ++it) {
+            if (!visited.insert(*it).second)
+                continue;
+
+            string library = findLibrary(*it, origin, runPath, directories);
+            if (library.empty() || !readAhead(library))
+                continue;
+
+            pending.push_back(library);
+            files++;
+        }
+    }
+}
+
+bool Prefetcher::readAhead(const string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        // Falls back to the advice if readahead() is not supported
+        if (readahead(fd, 0, st.st_size) == -1)
+            posix_fadvise(fd, 0, st.st_size, POSIX_FADV_WILLNEED);
+    }
+
+    close(fd);
+    return true;
+}
+
+string Prefetcher::findLibrary(const string &name, const string &origin,
+                               const string &runPath, const vector<string> &directories)
+{
+    if (name.find('/') != string::npos)
+        return name;
+
+    vector<string> candidates;
+
+    size_t begin = 0;
+    while (begin <= runPath.size() && !runPath.empty()) {
+        size_t end = runPath.find(':', begin);
+        if (end == string::npos)
+            end = runPath.size();
+
+        string directory = runPath.substr(begin, end - begin);
+        if (directory.compare(0, 7, "$ORIGIN") == 0)
+            directory = origin + directory.substr(7);
+        else if (directory.compare(0, 9, "${ORIGIN}") == 0)
+            directory = origin + directory.substr(9);
+
+        // Other substitutions are rare, leave those to the loader
+        if (!directory.empty() && directory.find('$') == string::npos)
+            candidates.push_back(directory);
+
+        begin = end + 1;
+    }
+
+    candidates.insert(candidates.end(), directories.begin(), directories.end());
+
+    for (vector<string>::const_iterator it = candidates.begin(); it != candidates.end(); ++it) {
+        string path = *it + '/' + name;
+        if (access(path.c_str(), R_OK) == 0)
+            return path;
+    }
+
+    return string();
+}
+
+static int addLoadedObject(struct dl_phdr_info *info, size_t, void *data)
+{
+    vector<string> *paths = static_cast<vector<string> *>(data);
+    if (info->dlpi_name && info->dlpi_name[0] == '/')
+        paths->push_back(info->dlpi_name);
+    return 0;
+}
+
+void Prefetcher::loadedObjects(vector<string> &directories, set<string> &names)
+{
+    vector<string> paths;
+    dl_iterate_phdr(addLoadedObject, &paths);
+
+    for (vector<string>::const_iterator it = paths.begin(); it != paths.end(); ++it) {
+        size_t slash = it->rfind('/');
+        string directory = it->substr(0, slash);
+        if (std::find(directories.begin(), directories.end(), directory) == directories.end())
+            directories.push_back(directory);
+
+        // Sonames normally equal the file names
+        names.insert(it->substr(slash + 1));
+    }
+
+    for (size_t i = 0; i < sizeof DEFAULT_DIRECTORIES / sizeof *DEFAULT_DIRECTORIES; i++) {
+        if (std::find(directories.begin(), directories.end(), DEFAULT_DIRECTORIES[i]) == directories.end())
+            directories.push_back(DEFAULT_DIRECTORIES[i]);
+    }
+}
@@ -0,0 +1,81 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifndef PREFETCHER_H
+#define PREFETCHER_H
+
+#include "launcherlib.h"
+
+#include <set>
+#include <string>
+#include <vector>
+
+using std::set;
+using std::string;
+using std::vector;
+
+/*!
+ * \class Prefetcher
+ * \brief Reads an application binary and its libraries into the page cache.
+ *
+ * The daemon starts it when a booster reports the binary it is about to
+ * load. The work is done in a short-lived helper process, which neither
+ * blocks the event loop nor is killed when the booster calls exec(), so
+ * the disk IO of a cold launch runs ahead of the dynamic loader instead
+ * of happening page by page inside it.
+ *
+ * The needed libraries are resolved like the dynamic loader does with
+ * DT_RUNPATH / DT_RPATH and the directories of the libraries already
+ * loaded in the daemon. Libraries the daemon has loaded are shared with
+ * the boosters forked from it and are skipped.
+ *
+ * If a LaunchProfile has been recorded for the binary, the pages in it
+ * are prefetched instead.
+ */
+class DECL_EXPORT Prefetcher
+{
+public:
+
+    //! Start prefetching a binary and its needed libraries in a helper process
+    static void start(const string &fileName);
+
+private:
+
+    //! Prefetch the recorded launch profile of the binary if there is one,
+    //! its dependency closure otherwise
+    static void prefetchProfile(const string &fileName);
+
+    //! Prefetch the binary and walk its dependencies
+    static void prefetchClosure(const string &fileName);
+
+    //! Ask the kernel to read the whole file, return false if it cannot be opened
+    static bool readAhead(const string &path);
+
+    //! Return path of a needed library, or an empty string if not found
+    static string findLibrary(const string &name, const string &origin,
+                              const string &runPath, const vector<string> &directories);
+
+    //! Add directories and sonames of the objects loaded in this process
+    static void loadedObjects(vector<string> &directories, set<string> &names);
+
+    //! Maximum number of files prefetched for one launch
+    static const unsigned MAX_FILES = 256;
+
+#ifdef UNIT_TEST
+    friend class Ut_Prefetcher;
+#endif
+};
+
+#endif // PREFETCHER_H
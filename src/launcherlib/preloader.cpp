@@ -0,0 +1,236 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#include "preloader.h"
+#include "logger.h"
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <fstream>
+
+static unsigned monotonicMicroseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+Preloader::Preloader() :
+    m_next(0),
+    m_end(0)
+{}
+
+void Preloader::setVariable(const string &name, const string &value)
+{
+    m_variables[name] = value;
+}
+
+bool Preloader::readManifest(const string &path)
+{
+    std::ifstream manifest(path.c_str());
+    if (!manifest)
+        return false;
+
+    m_groups.push_back(m_entries.size());
+
+    string line;
+    int number = 0;
+    while (std::getline(manifest, line)) {
+        number++;
+        if (!parseLine(line))
+            Logger::logWarning("Preloader: invalid line %d in %s: %s", number, path.c_str(), line.c_str());
+    }
+
+    return true;
+}
+
+bool Preloader::parseLine(const string &line)
+{
+    size_t begin = line.find_first_not_of(" \t");
+    if (begin == string::npos || line[begin] == '#')
+        return true;
+
+    size_t end = line.find_last_not_of(" \t") + 1;
+
+    if (line[begin] == '[') {
+        if (line[end - 1] != ']')
+            return false;
+        if (m_groups.back() != m_entries.size())
+            m_groups.push_back(m_entries.size());
+        return true;
+    }
+
+    int flags = RTLD_NOW | RTLD_GLOBAL;
+    size_t pos = begin;
+    for (; pos < end && line[pos] != '/' && line[pos] != '$'; pos++) {
+        switch (line[pos]) {
+        case 'N':
+            break;
+        case 'L':
+            flags = (flags & ~RTLD_NOW) | RTLD_LAZY;
+            break;
+        case 'D':
+            flags |= RTLD_DEEPBIND;
+            break;
+        case 'P':
+            flags &= ~RTLD_GLOBAL;
+            break;
+        default:
+            return false;
+        }
+    }
+
+    string path = line.substr(pos, end - pos);
+    if (path.empty())
+        return false;
+
+    // Expand variable at the start of the path
+    if (path[0] == '$') {
+        size_t slash = path.find('/');
+        map<string, string>::const_iterator it = m_variables.find(path.substr(1, slash - 1));
+        if (it == m_variables.end())
+            return false;
+        path = it->second + (slash == string::npos ? string() : path.substr(slash));
+    }
+
+    addPath(path, flags);
+    return true;
+}
+
+void Preloader::addPath(const string &path, int flags)
+{
+    Entry entry;
+    entry.flags = flags;
+    entry.loaded = false;
+    entry.loadTime = 0;
+
+    if (path.find_first_of("*?[") == string::npos) {
+        entry.path = path;
+        m_entries.push_back(entry);
+        return;
+    }
+
+    // Plugins that are not installed are not an error
+    glob_t files;
+    if (glob(path.c_str(), 0, NULL, &files) != 0)
+        return;
+
+    for (size_t i = 0; i < files.gl_pathc; i++) {
+        entry.path = files.gl_pathv[i];
+        m_entries.push_back(entry);
+    }
+    globfree(&files);
+}
+
+int Preloader::load()
+{
+    unsigned start = monotonicMicroseconds();
+
+    for (size_t i = 0; i < m_groups.size(); i++)
+        loadGroup(m_groups[i], i + 1 < m_groups.size() ? m_groups[i + 1] : m_entries.size());
+
+    int failures = 0;
+    for (vector<Entry>::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
+        if (it->loaded) {
+            Logger::logDebug("Preloader: loaded %s in %u us", it->path.c_str(), it->loadTime);
+        } else {
+            Logger::logWarning("Preloader: failed to load %s: %s", it->path.c_str(), it->error.c_str());
+            failures++;
+        }
+    }
+
+    Logger::logInfo("Preloader: loaded %d of %d entries in %u ms",
+                    (int)m_entries.size() - failures, (int)m_entries.size(),
+                    (monotonicMicroseconds() - start) / 1000);
+
+    return failures;
+}
+
+const vector<Preloader::Entry> &Preloader::entries() const
+{
+    return m_entries;
+}
+
+void Preloader::loadGroup(size_t begin, size_t end)
+{
+    m_next = begin;
+    m_end = end;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = cpus < 1 ? 1 : cpus > MAX_THREADS ? MAX_THREADS : cpus;
+    if (threads > end - begin)
+        threads = end - begin;
+
+    // The calling thread is one of the loaders
+    vector<pthread_t> helpers;
+    for (size_t i = 1; i < threads; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, loadEntries, this) == 0)
+            helpers.push_back(thread);
+    }
+
+    loadEntries(this);
+
+    // The template process forks boosters after preloading, with no
+    // other threads alive, see Booster::preloadTemplate()
+    for (vector<pthread_t>::iterator it = helpers.begin(); it != helpers.end(); ++it)
+        pthread_join(*it, NULL);
+}
+
+void *Preloader::loadEntries(void *preloader)
+{
+    Preloader *self = static_cast<Preloader *>(preloader);
+
+    for (;;) {
+        size_t index = __sync_fetch_and_add(&self->m_next, 1);
+        if (index >= self->m_end)
+            break;
+
+        loadEntry(self->m_entries[index]);
+    }
+
+    return NULL;
+}
+
+void Preloader::loadEntry(Entry &entry)
+{
+    unsigned start = monotonicMicroseconds();
+
+    // The dynamic loader serializes dlopen() calls, but reading the
+    // file in beforehand does not need its lock and runs in parallel
+    int fd = open(entry.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd != -1) {
+        struct stat st;
+        if (fstat(fd, &st) == 0)
+            readahead(fd, 0, st.st_size);
+        close(fd);
+    }
+
+    // Intentionally leaked, the objects stay loaded
+    if (dlopen(entry.path.c_str(), entry.flags)) {
+        entry.loaded = true;
+    } else {
+        const char *error = dlerror();
+        entry.error = error ? error : "unknown error";
+    }
+
+    entry.loadTime = monotonicMicroseconds() - start;
+}
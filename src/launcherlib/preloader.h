@@ -0,0 +1,117 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifndef PRELOADER_H
+#define PRELOADER_H
+
+#include "launcherlib.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+using std::map;
+using std::string;
+using std::vector;
+
+/*!
+ * \class Preloader
+ * \brief Loads the libraries and plugins listed in a preload manifest.
+ *
+ * Each line of the manifest is a path, optionally prefixed with dlopen
+ * modifiers as in scripts/library-helper.py:
+ *
+ *   - N  RTLD_NOW (default)
+ *   - L  RTLD_LAZY instead of RTLD_NOW
+ *   - D  RTLD_DEEPBIND in addition
+ *   - P  RTLD_LOCAL instead of RTLD_GLOBAL, e.g. for plugins
+ *
+ * Paths may start with a variable like $QT_PLUGINS that is set by the
+ * booster, and may contain shell wildcards. Empty lines and lines
+ * starting with '#' are ignored. A line "[name]" starts a new group.
+ * Groups are loaded in order, entries of one group are independent of
+ * each other and are loaded on several threads.
+ */
+class DECL_EXPORT Preloader
+{
+public:
+
+    //! Loaded manifest entry
+    struct Entry
+    {
+        string path;
+        int flags;
+        bool loaded;
+        //! Load time in microseconds
+        unsigned loadTime;
+        string error;
+    };
+
+    //! Constructor
+    Preloader();
+
+    //! Set value of a variable that can be used in the manifest
+    void setVariable(const string &name, const string &value);
+
+    //! Read entries from a manifest file, return false if it cannot be read
+    bool readManifest(const string &path);
+
+    /*!
+     * \brief Load all entries read from the manifest.
+     * Load times and failures are logged. The loaded objects are never
+     * closed. All threads have finished when this returns.
+     * \return Number of entries that failed to load.
+     */
+    int load();
+
+    //! Return the entries in manifest order
+    const vector<Entry> &entries() const;
+
+private:
+
+    //! Parse one manifest line, return false if it is invalid
+    bool parseLine(const string &line);
+
+    //! Add entries for a path that may contain wildcards
+    void addPath(const string &path, int flags);
+
+    //! Load entries of one group on several threads
+    void loadGroup(size_t begin, size_t end);
+
+    //! Thread function loading entries until the group is done
+    static void *loadEntries(void *preloader);
+
+    //! Read ahead and dlopen() one entry
+    static void loadEntry(Entry &entry);
+
+    //! Maximum number of threads used for loading
+    static const int MAX_THREADS = 4;
+
+    map<string, string> m_variables;
+    vector<Entry> m_entries;
+
+    //! Index of the first entry of each group
+    vector<size_t> m_groups;
+
+    //! Next entry to be loaded and end of the group being loaded
+    size_t m_next;
+    size_t m_end;
+
+#ifdef UNIT_TEST
+    friend class Ut_Preloader;
+#endif
+};
+
+#endif // PRELOADER_H
@@ -0,0 +1,210 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#include "respawnscheduler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+/* Respawn is postponed while CPU or IO pressure is above this (percent) */
+static const int PRESSURE_THRESHOLD = 10;
+
+/* Interval of pressure checks while respawn is postponed */
+static const unsigned CHECK_INTERVAL = 250;
+
+/* Time given to applications to start up, per launch within the
+ * launch rate window, before pressure is looked at at all.
+ */
+static const unsigned LAUNCH_SETTLE_TIME = 200;
+
+/* Shortest interval over which pressure is computed from stall
+ * totals, shorter intervals use the kernel provided 10 s average.
+ */
+static const unsigned MIN_SAMPLE_INTERVAL = 50;
+
+static const char CPU_PRESSURE_PATH[] = "/proc/pressure/cpu";
+static const char IO_PRESSURE_PATH[]  = "/proc/pressure/io";
+
+/* Note: timestamps wrap around, only differences are meaningful */
+static bool reached(unsigned now, unsigned deadline)
+{
+    return (int)(now - deadline) >= 0;
+}
+
+RespawnScheduler::RespawnScheduler() :
+    m_pending(false),
+    m_start(0),
+    m_minDeadline(0),
+    m_maxDeadline(0),
+    m_nextCheck(0),
+    m_cpuPressure(-1),
+    m_ioPressure(-1),
+    m_haveSample(false),
+    m_sampleTime(0),
+    m_cpuTotal(0),
+    m_ioTotal(0)
+{
+}
+
+void RespawnScheduler::schedule(unsigned now, unsigned minDelay, unsigned maxDelay)
+{
+    minDelay = std::min(minDelay, maxDelay);
+
+    if (!m_pending) {
+        m_pending = true;
+        m_start = now;
+        m_minDeadline = now + minDelay;
+        m_maxDeadline = now + maxDelay;
+    } else {
+        if (reached(m_minDeadline, now + minDelay))
+            m_minDeadline = now + minDelay;
+        if (reached(m_maxDeadline, now + maxDelay))
+            m_maxDeadline = now + maxDelay;
+    }
+
+    // Baseline for computing pressure over the delay
+    samplePressure(now);
+    m_nextCheck = now;
+}
+
+bool RespawnScheduler::isPending() const
+{
+    return m_pending;
+}
+
+void RespawnScheduler::cancel()
+{
+    m_pending = false;
+}
+
+bool RespawnScheduler::isDue(unsigned now, int recentLaunches)
+{
+    if (!m_pending)
+        return false;
+
+    if (reached(now, m_maxDeadline)) {
+        samplePressure(now);
+        return true;
+    }
+
+    unsigned earliest = m_start + LAUNCH_SETTLE_TIME * (unsigned)std::max(recentLaunches, 0);
+    if (reached(earliest, m_maxDeadline))
+        earliest = m_maxDeadline;
+    if (reached(m_minDeadline, earliest))
+        earliest = m_minDeadline;
+
+    if (!reached(now, earliest)) {
+        m_nextCheck = earliest;
+        return false;
+    }
+
+    samplePressure(now);
+
+    // Without any load information keep waiting until the upper
+    // limit like a fixed delay would
+    bool known = m_cpuPressure >= 0 || m_ioPressure >= 0;
+    if (known && m_cpuPressure <= PRESSURE_THRESHOLD && m_ioPressure <= PRESSURE_THRESHOLD)
+        return true;
+
+    m_nextCheck = known ? now + CHECK_INTERVAL : m_maxDeadline;
+    if (reached(m_nextCheck, m_maxDeadline))
+        m_nextCheck = m_maxDeadline;
+    return false;
+}
+
+unsigned RespawnScheduler::nextCheck() const
+{
+    return m_nextCheck;
+}
+
+unsigned RespawnScheduler::elapsed(unsigned now) const
+{
+    return now - m_start;
+}
+
+unsigned RespawnScheduler::maxDelay() const
+{
+    return m_maxDeadline - m_start;
+}
+
+int RespawnScheduler::cpuPressure() const
+{
+    return m_cpuPressure;
+}
+
+int RespawnScheduler::ioPressure() const
+{
+    return m_ioPressure;
+}
+
+void RespawnScheduler::samplePressure(unsigned now)
+{
+    int cpuAverage = -1, ioAverage = -1;
+    unsigned long long cpuTotal = 0, ioTotal = 0;
+    bool haveCpu = readPressure(CPU_PRESSURE_PATH, cpuAverage, cpuTotal);
+    bool haveIo = readPressure(IO_PRESSURE_PATH, ioAverage, ioTotal);
+
+    // The 10 s averages lag behind, so prefer stall time accumulated
+    // since the previous sample when there is one. Totals are in
+    // microseconds, the interval in milliseconds.
+    unsigned interval = now - m_sampleTime;
+    bool fresh = m_haveSample && interval >= MIN_SAMPLE_INTERVAL;
+
+    if (!haveCpu)
+        m_cpuPressure = readLoad();
+    else if (fresh && cpuTotal >= m_cpuTotal)
+        m_cpuPressure = (int)std::min((cpuTotal - m_cpuTotal) / (interval * 10ull), 100ull);
+    else
+        m_cpuPressure = cpuAverage;
+
+    if (!haveIo)
+        m_ioPressure = -1;
+    else if (fresh && ioTotal >= m_ioTotal)
+        m_ioPressure = (int)std::min((ioTotal - m_ioTotal) / (interval * 10ull), 100ull);
+    else
+        m_ioPressure = ioAverage;
+
+    m_cpuTotal = cpuTotal;
+    m_ioTotal = ioTotal;
+    m_haveSample = haveCpu || haveIo;
+    m_sampleTime = now;
+}
+
+bool RespawnScheduler::readPressure(const char *path, int &average, unsigned long long &total)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return false;
+
+    float avg10 = 0;
+    int rc = fscanf(file, "some avg10=%f avg60=%*f avg300=%*f total=%llu", &avg10, &total);
+    fclose(file);
+    if (rc != 2)
+        return false;
+
+    average = (int)(avg10 + 0.5f);
+    return true;
+}
+
+int RespawnScheduler::readLoad()
+{
+    double load = 0;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (getloadavg(&load, 1) != 1 || cpus < 1)
+        return -1;
+    return (int)std::min(load * 100 / cpus, 100.0);
+}
@@ -0,0 +1,110 @@
+/***************************************************************************
+**
+** Copyright (c) 2021 CutefishOS.
+** All rights reserved.
+**
+** This file is part of applauncherd
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License version 2.1 as published by the Free Software Foundation
+** and appearing in the file LICENSE.LGPL included in the packaging
+** of this file.
+**
+****************************************************************************/
+
+#ifndef RESPAWNSCHEDULER_H
+#define RESPAWNSCHEDULER_H
+
+#include "launcherlib.h"
+
+/*!
+ * \class RespawnScheduler
+ * \brief Decides when replacement boosters are started.
+ *
+ * Starting a booster right after a launch competes for CPU and IO with
+ * the application that is starting up. Instead of a fixed delay, the
+ * respawn is postponed while the system is under pressure, as reported
+ * by /proc/pressure/cpu and /proc/pressure/io (or the load average if
+ * pressure stall information is not available), and for a short settle
+ * time that grows with the recent launch rate. The delay always stays
+ * within the limits given when the respawn is scheduled.
+ */
+class DECL_EXPORT RespawnScheduler
+{
+public:
+
+    //! Constructor
+    RespawnScheduler();
+
+    /*!
+     * \brief Request a respawn. Limits of an already pending respawn
+     *        are tightened, never extended.
+     * \param now Monotonic timestamp in milliseconds.
+     * \param minDelay Delay in milliseconds that is always waited.
+     * \param maxDelay Delay in milliseconds after which respawn happens
+     *                 regardless of system load.
+     */
+    void schedule(unsigned now, unsigned minDelay, unsigned maxDelay);
+
+    //! Return true if a respawn has been scheduled
+    bool isPending() const;
+
+    //! Forget the pending respawn
+    void cancel();
+
+    /*!
+     * \brief Check whether the pending respawn should happen now.
+     * \param now Monotonic timestamp in milliseconds.
+     * \param recentLaunches Number of recent launches, see BoosterPool.
+     * \return True if boosters should be started now. Otherwise
+     *         nextCheck() tells when to check again.
+     */
+    bool isDue(unsigned now, int recentLaunches);
+
+    //! Return timestamp of the next isDue() check
+    unsigned nextCheck() const;
+
+    //! Return milliseconds since the pending respawn was scheduled
+    unsigned elapsed(unsigned now) const;
+
+    //! Return upper limit of the pending respawn delay in milliseconds
+    unsigned maxDelay() const;
+
+    //! Return CPU pressure in percent sampled by the last isDue(), -1 if not known
+    int cpuPressure() const;
+
+    //! Return IO pressure in percent sampled by the last isDue(), -1 if not known
+    int ioPressure() const;
+
+private:
+
+    //! Sample CPU and IO pressure
+    void samplePressure(unsigned now);
+
+    //! Read "some" 10 s average (percent) and stall total (us) of a pressure file
+    static bool readPressure(const char *path, int &average, unsigned long long &total);
+
+    //! Return one minute load average per CPU in percent, -1 if not available
+    static int readLoad();
+
+    bool m_pending;
+    unsigned m_start;
+    unsigned m_minDeadline;
+    unsigned m_maxDeadline;
+    unsigned m_nextCheck;
+    int m_cpuPressure;
+    int m_ioPressure;
+
+    //! Stall totals of the previous sample
+    bool m_haveSample;
+    unsigned m_sampleTime;
+    unsigned long long m_cpuTotal;
+    unsigned long long m_ioTotal;
+
+#ifdef UNIT_TEST
+    friend class Ut_RespawnScheduler;
+#endif
+};
+
+#endif // RESPAWNSCHEDULER_H
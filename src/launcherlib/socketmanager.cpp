@@ -26,6 +26,10 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/un.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/sock_diag.h>
+#include <linux/unix_diag.h>
 #include <unistd.h>
 #include <cstdlib>
 #include <cstring>
@@ -115,7 +119,7 @@ string SocketManager::prepareSocket(const string &socketId) const
     return socketPath;
 }
 
-void SocketManager::initSocket(const string & socketId)
+void SocketManager::initSocket(const string & socketId, int backlog)
 {
     // Initialize a socket at socketId if one already doesn't
     // exist for that id / path.
@@ -145,8 +149,10 @@ void SocketManager::initSocket(const string & socketId)
             throw std::runtime_error(msg);
         }
 
-        // Create a new local socket
-        int socketFd = socket(PF_UNIX, SOCK_STREAM, 0);
+        // Create a new local socket. Spare boosters poll it before
+        // accepting, so that they can handle other requests while
+        // waiting and do not get stuck when another booster accepts.
+        int socketFd = socket(PF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
         if (socketFd < 0)
             throw std::runtime_error("SocketManager: Failed to open socket\n");
 
@@ -160,7 +166,7 @@ void SocketManager::initSocket(const string & socketId)
         }
 
         // Listen to the socket
-        if (listen(socketFd, 10) < 0)
+        if (listen(socketFd, backlog) < 0)
         {
             string msg;
             msg += "SocketManager: Failed to listen to socket ";
@@ -168,6 +174,8 @@ void SocketManager::initSocket(const string & socketId)
             throw std::runtime_error(msg);
         }
 
+        Logger::logDebug("SocketManager: listen backlog %d", backlog);
+
         // Set permissions
         chmod(socketPath.c_str(), S_IRUSR | S_IWUSR | S_IXUSR);
 
@@ -212,6 +220,55 @@ unsigned int SocketManager::socketCount() const
     return m_socketHash.size();
 }
 
+int SocketManager::pendingConnections(const string & socketId)
+{
+    struct stat st;
+    int socketFd = findSocket(socketId);
+    if (socketFd == -1 || fstat(socketFd, &st) == -1)
+        return -1;
+
+    // Length of the accept queue is only available via sock_diag,
+    // the socket is looked up by its inode
+    int diagFd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+    if (diagFd == -1)
+        return -1;
+
+    struct {
+        struct nlmsghdr header;
+        struct unix_diag_req request;
+    } query;
+    memset(&query, 0, sizeof query);
+    query.header.nlmsg_len = sizeof query;
+    query.header.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+    query.header.nlmsg_flags = NLM_F_REQUEST;
+    query.request.sdiag_family = AF_UNIX;
+    query.request.udiag_ino = st.st_ino;
+    query.request.udiag_show = UDIAG_SHOW_RQLEN;
+    query.request.udiag_cookie[0] = query.request.udiag_cookie[1] = ~0U;
+
+    int pending = -1;
+    long buf[1024];
+    ssize_t len = -1;
+    if (send(diagFd, &query, sizeof query, 0) == (ssize_t)sizeof query)
+        len = recv(diagFd, buf, sizeof buf, MSG_DONTWAIT);
+    close(diagFd);
+
+    struct nlmsghdr *header = reinterpret_cast<struct nlmsghdr *>(buf);
+    if (len < 0 || !NLMSG_OK(header, (size_t)len) || header->nlmsg_type != SOCK_DIAG_BY_FAMILY)
+        return -1;
+
+    struct unix_diag_msg *msg = static_cast<struct unix_diag_msg *>(NLMSG_DATA(header));
+    int attrLen = header->nlmsg_len - NLMSG_LENGTH(sizeof *msg);
+    for (struct rtattr *attr = reinterpret_cast<struct rtattr *>(msg + 1);
+         RTA_OK(attr, attrLen); attr = RTA_NEXT(attr, attrLen)) {
+        // For listening sockets the receive queue is the accept queue
+        if (attr->rta_type == UNIX_DIAG_RQLEN && RTA_PAYLOAD(attr) >= sizeof(struct unix_diag_rqlen))
+            pending = static_cast<struct unix_diag_rqlen *>(RTA_DATA(attr))->udiag_rqueue;
+    }
+
+    return pending;
+}
+
 SocketManager::SocketHash SocketManager::getState()
 {
     return m_socketHash;
@@ -25,6 +25,7 @@
 #include "launcherlib.h"
 #include <map>
 #include <string>
+#include <sys/socket.h>
 
 using std::map;
 using std::string;
@@ -44,8 +45,10 @@ public:
 
     /*! \brief Initialize a file socket.
      *  \param socketId Path to the socket file.
+     *  \param backlog Number of connections that can wait to be accepted,
+     *         the kernel limits it to net.core.somaxconn.
      */
-    void initSocket(const string & socketId);
+    void initSocket(const string & socketId, int backlog = SOMAXCONN);
 
     /*! \brief Close a file socket.
      *  \param socketId Path to the socket file.
@@ -64,6 +67,12 @@ public:
     //! Return count of currently active sockets
     unsigned int socketCount() const;
 
+    /*! \brief Return number of connections waiting to be accepted.
+     *  \param socketId Path to the socket file.
+     *  \returns connection count or -1 if it can't be queried.
+     */
+    int pendingConnections(const string & socketId);
+
     // Type of the internal state
     typedef map<string, int> SocketHash;
 